@@ -0,0 +1,692 @@
+#pragma once
+
+#include "ImageProcessor.hpp"
+#include "GermsPositioning.hpp"
+#include "GrowAndMerge.hpp"
+#include "ImageUtil.hpp"
+#include "ThreadPool.hpp"
+#include "Instrumentation.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifndef RG_RESSOURCES_DIR
+#define RG_RESSOURCES_DIR "ressources"
+#endif
+
+// Inputs, timing and differential verification of seg_bench (bench/seg_bench.cpp), shared with
+// seg_tests (tests/seg_tests.cpp)
+
+struct BenchConfig {
+    std::vector<cv::Size> sizes = {cv::Size(640, 480), cv::Size(1920, 1080), cv::Size(3840, 2160), cv::Size(7680, 4320)};
+    std::vector<std::string> inputs = {"flat", "noisy", "gradient", "checkerboard", "image_couche", "image_debout"};
+    std::vector<std::string> stages = {"calculate_region_variance", "position_germs", "rg_seg", "fill_mask", "edge_mask",
+                                       "boundary_pixels", "chain_codes"};
+    std::vector<int> threads;
+    int repetitions = 5;
+    int warmup = 1;
+    int maxDivision = 5;
+    cv::Size tileSize = cv::Size(0, 0);
+    GrowAndMerge::Engine engine = GrowAndMerge::Engine::Queue;
+    MergeStrategy merge = MergeStrategy::Greedy;
+    bool fillGaps = false;
+    std::string predicate = "hsv"; // GrowthPolicies.hpp: hsv, gray or lab
+    int connectivity = 8;
+    std::string ressources = RG_RESSOURCES_DIR;
+    std::string jsonPath;
+    std::string countersPath;
+    std::string tracePath;
+    int64_t maxAllocations = -1; // -1: not checked
+    std::vector<std::string> verify; // variants checked by --verify, empty: timing sweep
+    std::string baselinePath;
+    std::string recordBaselinePath;
+    double speedupTolerance = 0.8;
+    bool sizesGiven = false;
+};
+
+struct BenchResult {
+    std::string input;
+    cv::Size size;
+    std::string stage;
+    int threads;
+    size_t seeds;
+    std::vector<double> samples; // ms
+    uint64_t allocations;        // most heap allocations of a timed call
+};
+
+// Instrumentation::write_json() of one (input, size, thread count)
+struct CounterReport {
+    std::string input;
+    cv::Size size;
+    int threads;
+    std::string json;
+};
+
+std::vector<std::string> split(const std::string &text, char separator) {
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, separator)) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+cv::Size parse_size(const std::string &text) {
+    std::vector<std::string> parts = split(text, 'x');
+    if (parts.size() != 2) {
+        throw std::invalid_argument("size must be WxH: " + text);
+    }
+    return {std::stoi(parts[0]), std::stoi(parts[1])};
+}
+
+// Synthetic inputs only depend on std::mt19937 raw output, which is identical on every platform
+cv::Mat make_input(const std::string &name, const cv::Size &size, const std::string &ressources) {
+    cv::Mat image(size, CV_8UC3);
+
+    if (name == "flat") {
+        image.setTo(cv::Scalar(90, 140, 60));
+    } else if (name == "noisy") {
+        std::mt19937 noise(20240601);
+        for (int i = 0; i < image.rows; ++i) {
+            uchar* row = image.ptr<uchar>(i);
+            for (int j = 0; j < image.cols * 3; ++j) {
+                row[j] = (uchar)(96 + noise() % 64);
+            }
+        }
+    } else if (name == "gradient") {
+        for (int i = 0; i < image.rows; ++i) {
+            for (int j = 0; j < image.cols; ++j) {
+                image.at<cv::Vec3b>(i, j) = cv::Vec3b((uchar)(255 * j / std::max(1, image.cols - 1)),
+                                                      (uchar)(255 * i / std::max(1, image.rows - 1)),
+                                                      128);
+            }
+        }
+    } else if (name == "checkerboard") {
+        const int cell = 32;
+        for (int i = 0; i < image.rows; ++i) {
+            for (int j = 0; j < image.cols; ++j) {
+                bool dark = ((i / cell) + (j / cell)) % 2 == 0;
+                image.at<cv::Vec3b>(i, j) = dark ? cv::Vec3b(40, 40, 160) : cv::Vec3b(200, 220, 230);
+            }
+        }
+    } else {
+        // One of the ressources/ images, tiled up to the requested size
+        cv::Mat tile = cv::imread(ressources + "/" + name + ".png", cv::IMREAD_COLOR);
+        if (tile.empty()) {
+            return {};
+        }
+        cv::Mat tiled;
+        cv::repeat(tile, (size.height + tile.rows - 1) / tile.rows, (size.width + tile.cols - 1) / tile.cols, tiled);
+        image = tiled(cv::Rect(0, 0, size.width, size.height)).clone();
+    }
+    return image;
+}
+
+// rg_seg reports its coverage on std::cout, which would interleave with the JSON report. The text
+// is dropped rather than buffered, so that it does not count as an allocation of the stage
+class SilenceStdout {
+private:
+    struct NullBuffer : std::streambuf {
+        int overflow(int c) override { return traits_type::not_eof(c); }
+
+        std::streamsize xsputn(const char*, std::streamsize n) override { return n; }
+    };
+
+    NullBuffer sink;
+    std::streambuf* previous;
+
+public:
+    SilenceStdout() : previous(std::cout.rdbuf(&sink)) { }
+
+    ~SilenceStdout() { std::cout.rdbuf(previous); }
+};
+
+// Most heap allocations made by one timed call of the last time_stage()
+uint64_t lastStageAllocations = 0;
+
+std::vector<double> time_stage(int warmup, int repetitions, const std::function<void()> &setup,
+                               const std::function<void()> &stage) {
+    std::vector<double> samples;
+    samples.reserve(repetitions);
+    lastStageAllocations = 0;
+    for (int r = 0; r < warmup + repetitions; ++r) {
+        setup();
+        uint64_t allocationsBefore = Instrumentation::heap_allocations();
+        auto begin = std::chrono::steady_clock::now();
+        stage();
+        auto end = std::chrono::steady_clock::now();
+        uint64_t allocations = Instrumentation::heap_allocations() - allocationsBefore;
+        if (r >= warmup) {
+            samples.push_back(std::chrono::duration<double, std::milli>(end - begin).count());
+            lastStageAllocations = std::max(lastStageAllocations, allocations);
+        }
+    }
+    return samples;
+}
+
+// Nearest-rank percentile of sorted samples
+double percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(sorted.size(), std::max<size_t>(1, rank)) - 1];
+}
+
+// rg_seg and the stages rendering its result, for one instance of BasicGrowAndMerge
+template <class Segmenter>
+void time_growing_stages(const BenchConfig &config, ThreadPool &pool, const cv::Mat &image,
+                         const std::vector<cv::Point> &seeds, const std::function<bool(const std::string &)> &wants,
+                         const std::function<void(const std::string &, size_t, std::vector<double>)> &record) {
+    Segmenter growAndMerge;
+    growAndMerge.set_thread_pool(pool);
+    growAndMerge.set_tile_size(config.tileSize);
+    growAndMerge.set_growth_engine(config.engine);
+    growAndMerge.set_merge_strategy(config.merge);
+    growAndMerge.set_fill_gaps(config.fillGaps);
+    cv::Mat mask;
+    std::vector<cv::Point> runSeeds;
+    SilenceStdout silence;
+
+    if (wants("rg_seg") || wants("fill_mask") || wants("edge_mask") || wants("boundary_pixels") ||
+        wants("chain_codes")) {
+        std::vector<double> samples = time_stage(config.warmup, config.repetitions, [&]() {
+            mask = cv::Mat::zeros(image.size(), CV_8UC3);
+            runSeeds = seeds;
+        }, [&]() {
+            growAndMerge.rg_seg(image, mask, runSeeds, true, false);
+        });
+        if (wants("rg_seg")) {
+            record("rg_seg", seeds.size(), std::move(samples));
+        }
+    }
+
+    if (wants("fill_mask")) {
+        record("fill_mask", seeds.size(), time_stage(config.warmup, config.repetitions, [&]() {
+            mask = cv::Mat::zeros(image.size(), CV_8UC3);
+        }, [&]() {
+            growAndMerge.render_mask(mask, false);
+        }));
+    }
+
+    if (wants("edge_mask")) {
+        record("edge_mask", seeds.size(), time_stage(config.warmup, config.repetitions, [&]() {
+            mask = cv::Mat::zeros(image.size(), CV_8UC3);
+        }, [&]() {
+            growAndMerge.render_mask(mask, true);
+        }));
+    }
+
+    if (wants("boundary_pixels")) {
+        std::vector<cv::Point> pixels;
+        record("boundary_pixels", seeds.size(), time_stage(config.warmup, config.repetitions, []() { }, [&]() {
+            growAndMerge.boundary_pixels(pixels);
+        }));
+    }
+
+    if (wants("chain_codes")) {
+        std::vector<typename Segmenter::Contour> contours;
+        record("chain_codes", seeds.size(), time_stage(config.warmup, config.repetitions, []() { }, [&]() {
+            growAndMerge.chain_codes(contours);
+        }));
+    }
+}
+
+// Instance of the configured connectivity
+template <class Predicate>
+void time_growing_stages_with(const BenchConfig &config, ThreadPool &pool, const cv::Mat &image,
+                              const std::vector<cv::Point> &seeds, const std::function<bool(const std::string &)> &wants,
+                              const std::function<void(const std::string &, size_t, std::vector<double>)> &record) {
+    if (config.connectivity == 4) {
+        time_growing_stages<BasicGrowAndMerge<Predicate, FourConnected>>(config, pool, image, seeds, wants, record);
+    } else {
+        time_growing_stages<BasicGrowAndMerge<Predicate, EightConnected>>(config, pool, image, seeds, wants, record);
+    }
+}
+
+// Instance of the configured predicate
+void run_growing_stages(const BenchConfig &config, ThreadPool &pool, const cv::Mat &image,
+                        const std::vector<cv::Point> &seeds, const std::function<bool(const std::string &)> &wants,
+                        const std::function<void(const std::string &, size_t, std::vector<double>)> &record) {
+    if (config.predicate == "gray") {
+        time_growing_stages_with<GrayThresholdPredicate<>>(config, pool, image, seeds, wants, record);
+    } else if (config.predicate == "lab") {
+        time_growing_stages_with<LabDistancePredicate<>>(config, pool, image, seeds, wants, record);
+    } else {
+        time_growing_stages_with<HsvIntervalPredicate>(config, pool, image, seeds, wants, record);
+    }
+}
+
+void run_benchmarks(const BenchConfig &config, std::vector<BenchResult> &results, std::vector<CounterReport> &counters) {
+    auto wants = [&config](const std::string &stage) {
+        return std::find(config.stages.begin(), config.stages.end(), stage) != config.stages.end();
+    };
+
+    for (const cv::Size &size : config.sizes) {
+        for (const std::string &name : config.inputs) {
+            cv::Mat source = make_input(name, size, config.ressources);
+            if (source.empty()) {
+                std::cerr << "Skipping " << name << ": cannot load it from " << config.ressources << std::endl;
+                continue;
+            }
+
+            // Same preprocessing as the application
+            ImageProcessor imageProcessor;
+            imageProcessor.process_image(source);
+            cv::Mat image = imageProcessor.get_image_rgb();
+
+            for (int numThreads : config.threads) {
+                ThreadPool pool(numThreads);
+                // OpenCV's own parallel loops (color conversions) follow the sweep too
+                cv::setNumThreads(numThreads);
+                Instrumentation::global().reset_stages();
+                std::cerr << name << " " << size.width << "x" << size.height << ", " << numThreads << " thread(s)" << std::endl;
+
+                auto record = [&](const std::string &stage, size_t seeds, std::vector<double> samples) {
+                    results.push_back({name, size, stage, numThreads, seeds, std::move(samples), lastStageAllocations});
+                };
+
+                if (wants("calculate_region_variance")) {
+                    ImageUtil imageUtil;
+                    record("calculate_region_variance", 0, time_stage(config.warmup, config.repetitions, []() { }, [&]() {
+                        imageUtil.calculate_region_variance(image, cv::Point(0, 0), cv::Point(image.cols, image.rows));
+                    }));
+                }
+
+                // Reference seeds for the downstream stages, computed once per input
+                std::vector<cv::Point> seeds;
+                {
+                    GermsPositioningV2 positioningV2;
+                    positioningV2.set_thread_pool(pool);
+                    positioningV2.position_germs(image, config.maxDivision, seeds);
+                }
+
+                if (wants("position_germs")) {
+                    std::unique_ptr<GermsPositioningV2> positioningV2;
+                    std::vector<cv::Point> germs;
+                    record("position_germs", seeds.size(), time_stage(config.warmup, config.repetitions, [&]() {
+                        positioningV2.reset(new GermsPositioningV2());
+                        positioningV2->set_thread_pool(pool);
+                        germs.clear();
+                    }, [&]() {
+                        positioningV2->position_germs(image, config.maxDivision, germs);
+                    }));
+                }
+
+                run_growing_stages(config, pool, image, seeds, wants, record);
+
+                if (!config.countersPath.empty()) {
+                    std::ostringstream json;
+                    Instrumentation::global().write_json(json);
+                    counters.push_back({name, size, numThreads, json.str()});
+                }
+            }
+        }
+    }
+}
+
+// A way of running rg_seg that has to give the partition of the reference
+struct VerifyVariant {
+    std::string name;
+    bool parallel;       // every thread of the sweep instead of one
+    bool simd;           // best neighbor kernel of the CPU instead of the scalar one
+    GrowAndMerge::Engine engine;
+    MergeStrategy merge; // pinned, whatever --merge: compared with the reference run of the same strategy
+};
+
+// The baseline rg_seg, greedy merges included
+const VerifyVariant VERIFY_REFERENCE = {"reference", false, false, GrowAndMerge::Engine::Queue, MergeStrategy::Greedy};
+
+// Greedy merges test the region means at the moment two regions meet, which depends on the order the
+// pixels are grown in: the scanline engine grows the same pixel sets in another order, so it is checked
+// with graph merges, where growing never reads a region mean, against the graph reference run.
+// Tile-parallel growing is not a variant: a tile grows its own seeds first, so its boundaries follow
+// the seed order within the tiles and differ from the reference ones on smooth variations (adjusted
+// Rand index 0.27 to 0.76 on gradient and the ressources/ images). seg_tests checks that it gives the
+// same partition on one worker and on several instead.
+const std::vector<VerifyVariant> VERIFY_VARIANTS = {
+    {"threads", true, false, GrowAndMerge::Engine::Queue, MergeStrategy::Greedy},
+    {"simd", false, true, GrowAndMerge::Engine::Queue, MergeStrategy::Greedy},
+    {"span", false, false, GrowAndMerge::Engine::Span, MergeStrategy::Graph},
+    {"accelerated", true, true, GrowAndMerge::Engine::Span, MergeStrategy::Graph},
+};
+
+struct VerifyResult {
+    std::string input;
+    cv::Size size;
+    std::string variant;
+    MergeStrategy merge;
+    bool identical;
+    bool singleRegion;      // the reference is one region: ari holds the pixel agreement
+    double ari;             // 1 when identical, reported to tell a near miss from a broken path
+    double speedup;         // reference p50 / variant p50
+    bool inBaseline;        // false without --baseline, or when the baseline has no line for the result
+    double baselineSpeedup; // 0 when not in the baseline
+    bool passed;
+};
+
+// Overlap of the (label in a, label in b) pairs, one lookup per run of the same pair
+struct Contingency {
+    std::unordered_map<uint64_t, uint64_t> cells;
+    std::unordered_map<int, uint64_t> rowsA;
+    std::unordered_map<int, uint64_t> rowsB;
+    uint64_t total = 0;
+};
+
+Contingency contingency(const cv::Mat &a, const cv::Mat &b) {
+    CV_Assert(a.size() == b.size() && a.type() == CV_32S && b.type() == CV_32S);
+    Contingency table;
+    for (int i = 0; i < a.rows; ++i) {
+        const int* rowA = a.ptr<int>(i);
+        const int* rowB = b.ptr<int>(i);
+        int start = 0;
+        for (int j = 1; j <= a.cols; ++j) {
+            if (j == a.cols || rowA[j] != rowA[start] || rowB[j] != rowB[start]) {
+                uint64_t count = (uint64_t)(j - start);
+                table.cells[((uint64_t)(uint32_t)rowA[start] << 32) | (uint32_t)rowB[start]] += count;
+                table.rowsA[rowA[start]] += count;
+                table.rowsB[rowB[start]] += count;
+                start = j;
+            }
+        }
+    }
+    table.total = a.total();
+    return table;
+}
+
+// O(pixels) - same partition up to relabeling: every label of a overlaps one label of b and conversely
+bool same_partition(const Contingency &table) {
+    return table.cells.size() == table.rowsA.size() && table.cells.size() == table.rowsB.size();
+}
+
+// O(pixels) - adjusted Rand index (Hubert & Arabie), 1 for the same partition, about 0 for unrelated ones
+double adjusted_rand_index(const Contingency &table) {
+    auto pairs = [](uint64_t n) { return 0.5 * (double)n * ((double)n - 1.0); };
+    double index = 0.0, sumA = 0.0, sumB = 0.0;
+    for (const auto &cell : table.cells) {
+        index += pairs(cell.second);
+    }
+    for (const auto &row : table.rowsA) {
+        sumA += pairs(row.second);
+    }
+    for (const auto &row : table.rowsB) {
+        sumB += pairs(row.second);
+    }
+    double expected = (table.total > 1) ? sumA * sumB / pairs(table.total) : 0.0;
+    double maximum = 0.5 * (sumA + sumB);
+    if (maximum == expected) {
+        // Both partitions are trivial (one region, or one pixel per region)
+        return index == expected ? 1.0 : 0.0;
+    }
+    return (index - expected) / (maximum - expected);
+}
+
+// O(pixels) - share of the pixels in the largest overlap of their label of a, 1 for the same partition.
+// Unlike the adjusted Rand index it does not drop to 0 when a is a single region
+double pixel_agreement(const Contingency &table) {
+    std::unordered_map<int, uint64_t> largest;
+    for (const auto &cell : table.cells) {
+        uint64_t &overlap = largest[(int)(cell.first >> 32)];
+        overlap = std::max(overlap, cell.second);
+    }
+    uint64_t agreeing = 0;
+    for (const auto &row : largest) {
+        agreeing += row.second;
+    }
+    return (table.total > 0) ? (double)agreeing / (double)table.total : 1.0;
+}
+
+std::string baseline_key(const std::string &input, const cv::Size &size, const std::string &variant) {
+    return input + " " + std::to_string(size.width) + "x" + std::to_string(size.height) + " " + variant;
+}
+
+// One "<input> <W>x<H> <variant> <speedup>" line per result, '#' comments
+std::map<std::string, double> read_baseline(const std::string &path) {
+    std::map<std::string, double> baseline;
+    std::ifstream in(path);
+    if (!in) {
+        throw std::invalid_argument("cannot read the baseline " + path);
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::string input, size, variant;
+        double speedup;
+        if (line.empty() || line[0] == '#' || !(fields >> input >> size >> variant >> speedup)) {
+            continue;
+        }
+        baseline[baseline_key(input, parse_size(size), variant)] = speedup;
+    }
+    return baseline;
+}
+
+bool write_baseline(const std::string &path, const std::vector<VerifyResult> &results) {
+    std::ofstream os(path);
+    if (!os) {
+        std::cerr << "seg_bench: cannot write " << path << std::endl;
+        return false;
+    }
+    os << "# seg_bench --verify speedups over the reference rg_seg, " << std::thread::hardware_concurrency()
+       << " hardware threads\n";
+    for (const VerifyResult &result : results) {
+        os << baseline_key(result.input, result.size, result.variant) << " " << result.speedup << "\n";
+    }
+    return (bool)os;
+}
+
+void run_verification(const BenchConfig &config, std::vector<VerifyResult> &results) {
+    std::map<std::string, double> baseline;
+    if (!config.baselinePath.empty()) {
+        baseline = read_baseline(config.baselinePath);
+    }
+    std::vector<VerifyVariant> variants;
+    for (const VerifyVariant &variant : VERIFY_VARIANTS) {
+        if (config.verify[0] == "all" ||
+            std::find(config.verify.begin(), config.verify.end(), variant.name) != config.verify.end()) {
+            variants.push_back(variant);
+        }
+    }
+    int maxThreads = *std::max_element(config.threads.begin(), config.threads.end());
+    ThreadPool serialPool(1);
+    ThreadPool parallelPool(maxThreads);
+
+    for (const cv::Size &size : config.sizes) {
+        for (const std::string &name : config.inputs) {
+            cv::Mat source = make_input(name, size, config.ressources);
+            if (source.empty()) {
+                std::cerr << "Skipping " << name << ": cannot load it from " << config.ressources << std::endl;
+                continue;
+            }
+            ImageProcessor imageProcessor;
+            imageProcessor.process_image(source);
+            cv::Mat image = imageProcessor.get_image_rgb();
+
+            // The same seeds for every variant
+            std::vector<cv::Point> seeds;
+            GermsPositioningV2 positioningV2;
+            positioningV2.set_thread_pool(serialPool);
+            positioningV2.position_germs(image, config.maxDivision, seeds);
+
+            // Labels and p50 of one variant
+            auto run = [&](const VerifyVariant &variant, cv::Mat &labels) {
+                ThreadPool &pool = variant.parallel ? parallelPool : serialPool;
+                cv::setNumThreads(variant.parallel ? maxThreads : 1);
+                GrowAndMerge growAndMerge;
+                growAndMerge.set_thread_pool(pool);
+                growAndMerge.set_neighbor_isa(variant.simd ? NeighborKernel::best_isa() : NeighborKernel::Isa::Scalar);
+                growAndMerge.set_growth_engine(variant.engine);
+                growAndMerge.set_merge_strategy(variant.merge);
+                growAndMerge.set_fill_gaps(config.fillGaps);
+                cv::Mat mask;
+                std::vector<cv::Point> runSeeds;
+                SilenceStdout silence;
+                std::vector<double> samples = time_stage(config.warmup, config.repetitions, [&]() {
+                    mask = cv::Mat::zeros(image.size(), CV_8UC3);
+                    runSeeds = seeds;
+                }, [&]() {
+                    growAndMerge.rg_seg(image, mask, runSeeds, true, false);
+                });
+                labels = growAndMerge.get_labels().clone();
+                std::sort(samples.begin(), samples.end());
+                return percentile(samples, 50);
+            };
+
+            // The reference run of each merge strategy (the greedy one is VERIFY_REFERENCE), labels and p50
+            std::map<MergeStrategy, std::pair<cv::Mat, double>> references;
+            auto reference_for = [&](MergeStrategy merge) -> const std::pair<cv::Mat, double>& {
+                auto found = references.find(merge);
+                if (found == references.end()) {
+                    VerifyVariant reference = VERIFY_REFERENCE;
+                    reference.merge = merge;
+                    std::cerr << name << " " << size.width << "x" << size.height << ": reference ("
+                              << (merge == MergeStrategy::Greedy ? "greedy" : "graph") << ")" << std::endl;
+                    found = references.emplace(merge, std::pair<cv::Mat, double>()).first;
+                    found->second.second = run(reference, found->second.first);
+                }
+                return found->second;
+            };
+
+            for (const VerifyVariant &variant : variants) {
+                const cv::Mat &referenceLabels = reference_for(variant.merge).first;
+                double referenceMs = reference_for(variant.merge).second;
+                std::cerr << name << " " << size.width << "x" << size.height << ": " << variant.name << std::endl;
+                cv::Mat labels;
+                double ms = run(variant, labels);
+                Contingency table = contingency(referenceLabels, labels);
+
+                VerifyResult result;
+                result.input = name;
+                result.size = size;
+                result.variant = variant.name;
+                result.merge = variant.merge;
+                result.identical = same_partition(table);
+                result.singleRegion = table.rowsA.size() == 1;
+                if (result.identical) {
+                    result.ari = 1.0;
+                } else {
+                    result.ari = result.singleRegion ? pixel_agreement(table) : adjusted_rand_index(table);
+                }
+                result.speedup = (ms > 0) ? referenceMs / ms : 0.0;
+                auto recorded = baseline.find(baseline_key(name, size, variant.name));
+                result.inBaseline = recorded != baseline.end();
+                result.baselineSpeedup = result.inBaseline ? recorded->second : 0.0;
+                // With a baseline, a result it does not list fails rather than passing unchecked
+                bool fastEnough = config.baselinePath.empty() ||
+                                  (result.inBaseline && result.speedup >= config.speedupTolerance * result.baselineSpeedup);
+                result.passed = result.identical && fastEnough;
+                results.push_back(result);
+            }
+        }
+    }
+}
+
+void write_verification_json(std::ostream &os, const BenchConfig &config, const std::vector<VerifyResult> &results) {
+    os.setf(std::ios::fixed);
+    os.precision(4);
+
+    os << "{\n";
+    os << "  \"benchmark\": \"seg_bench --verify\",\n";
+    os << "  \"version\": 1,\n";
+    os << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+    os << "  \"config\": {\"repetitions\": " << config.repetitions << ", \"warmup\": " << config.warmup
+       << ", \"max_division\": " << config.maxDivision << ", \"fill_gaps\": "
+       << (config.fillGaps ? "true" : "false") << ", \"speedup_tolerance\": " << config.speedupTolerance
+       << ", \"speedup_checked\": " << (config.baselinePath.empty() ? "false" : "true") << "},\n";
+    os << "  \"results\": [";
+    for (size_t r = 0; r < results.size(); ++r) {
+        const VerifyResult &result = results[r];
+        os << (r ? ",\n" : "\n");
+        os << "    {\"input\": \"" << result.input << "\", \"width\": " << result.size.width
+           << ", \"height\": " << result.size.height << ", \"variant\": \"" << result.variant
+           << "\", \"merge\": \"" << (result.merge == MergeStrategy::Greedy ? "greedy" : "graph")
+           << "\", \"identical\": " << (result.identical ? "true" : "false") << ", \"single_region\": "
+           << (result.singleRegion ? "true" : "false") << ", \"ari\": " << result.ari << ", \"speedup\": " << result.speedup
+           << ", \"baseline_speedup\": " << (result.inBaseline ? std::to_string(result.baselineSpeedup) : "null")
+           << ", \"passed\": " << (result.passed ? "true" : "false") << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+bool write_counters(const std::string &path, const std::vector<CounterReport> &counters) {
+    std::ofstream os(path);
+    if (!os) {
+        std::cerr << "seg_bench: cannot write " << path << std::endl;
+        return false;
+    }
+    os << "[";
+    for (size_t r = 0; r < counters.size(); ++r) {
+        const CounterReport &report = counters[r];
+        os << (r ? "," : "") << "\n{\"input\": \"" << report.input << "\", \"width\": " << report.size.width
+           << ", \"height\": " << report.size.height << ", \"threads\": " << report.threads
+           << ", \"instrumentation\": " << report.json << "}";
+    }
+    os << "]\n";
+    return (bool)os;
+}
+
+void write_json(std::ostream &os, const BenchConfig &config, const std::vector<BenchResult> &results) {
+    os.setf(std::ios::fixed);
+    os.precision(4);
+
+    os << "{\n";
+    os << "  \"benchmark\": \"seg_bench\",\n";
+    os << "  \"version\": 1,\n";
+    os << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n";
+    os << "  \"config\": {\"repetitions\": " << config.repetitions << ", \"warmup\": " << config.warmup
+       << ", \"max_division\": " << config.maxDivision << ", \"tile\": [" << config.tileSize.width << ", "
+       << config.tileSize.height << "], \"engine\": \""
+       << (config.engine == GrowAndMerge::Engine::Span ? "span" : "queue") << "\", \"merge\": \""
+       << (config.merge == MergeStrategy::Greedy ? "greedy" : "graph") << "\", \"predicate\": \""
+       << config.predicate << "\", \"connectivity\": " << config.connectivity
+       << ", \"fill_gaps\": " << (config.fillGaps ? "true" : "false")
+       << ", \"max_allocations\": " << config.maxAllocations << "},\n";
+    os << "  \"results\": [";
+    for (size_t r = 0; r < results.size(); ++r) {
+        const BenchResult &result = results[r];
+        std::vector<double> sorted = result.samples;
+        std::sort(sorted.begin(), sorted.end());
+
+        double mean = 0.0;
+        for (double sample : sorted) {
+            mean += sample;
+        }
+        mean /= std::max<size_t>(1, sorted.size());
+        double variance = 0.0;
+        for (double sample : sorted) {
+            variance += (sample - mean) * (sample - mean);
+        }
+        double stddev = std::sqrt(variance / std::max<size_t>(1, sorted.size()));
+
+        os << (r ? ",\n" : "\n");
+        os << "    {\"input\": \"" << result.input << "\", \"width\": " << result.size.width
+           << ", \"height\": " << result.size.height << ", \"stage\": \"" << result.stage
+           << "\", \"threads\": " << result.threads << ", \"seeds\": " << result.seeds
+           << ", \"ms\": {\"min\": " << (sorted.empty() ? 0.0 : sorted.front()) << ", \"mean\": " << mean
+           << ", \"stddev\": " << stddev << ", \"p50\": " << percentile(sorted, 50)
+           << ", \"p90\": " << percentile(sorted, 90) << ", \"p99\": " << percentile(sorted, 99)
+           << ", \"max\": " << (sorted.empty() ? 0.0 : sorted.back()) << "}, \"allocations\": " << result.allocations
+           << ", \"samples\": [";
+        for (size_t s = 0; s < result.samples.size(); ++s) {
+            os << (s ? ", " : "") << result.samples[s];
+        }
+        os << "]}";
+    }
+    os << "\n  ]\n}\n";
+}
@@ -0,0 +1,237 @@
+#include "SegBench.hpp"
+
+/**
+ * seg_bench - per-stage benchmark of the segmentation pipeline.
+ *
+ * Every (input, size, stage, thread count) combination is run `warmup` times untimed, then
+ * `repetitions` times timed; the JSON report holds min / mean / stddev / percentiles / max in ms.
+ * Synthetic inputs are generated from a fixed seed so runs are comparable between releases.
+ *
+ *   seg_bench [--sizes 640x480,1920x1080,...] [--inputs flat,noisy,...] [--stages rg_seg,...]
+ *             [--threads 1,2,4,...] [--repetitions N] [--warmup N] [--division N]
+ *             [--tile WxH] [--engine queue|span] [--merge graph|greedy] [--predicate hsv|gray|lab]
+ *             [--connectivity 4|8] [--fill-gaps 0|1]
+ *             [--ressources DIR] [--json FILE] [--counters FILE] [--trace FILE] [--max-allocations N]
+ *
+ * --counters and --trace need a build with RG_INSTRUMENTATION (see Instrumentation.hpp): the first
+ * writes the hot-path counters of every (input, size, thread count), the second the per-thread
+ * timeline of the whole run in Chrome trace format.
+ *
+ * seg_bench is built with RG_HEAP_ACCOUNTING: every result also holds the most heap allocations made
+ * by one timed call. With --max-allocations N the exit status is non-zero when a result exceeds N,
+ * e.g. `--stages rg_seg,fill_mask,edge_mask --threads 1,4 --max-allocations 0` checks that a reused
+ * GrowAndMerge segments without allocating once warmed up, on one worker or several, as the
+ * allocations test of seg_tests does.
+ *
+ *   seg_bench --verify all|threads,simd,span,... [--baseline FILE] [--record-baseline FILE]
+ *             [--speedup-tolerance X] [--sizes ...] [--inputs ...] [--threads ...] [--repetitions N]
+ *
+ * --verify replaces the timing sweep by a differential check of the accelerated growing paths (see
+ * VERIFY_VARIANTS) against the reference rg_seg: one worker, scalar neighbor kernel, pixel queue, no
+ * tiles, greedy merges (the default strategy, whatever --merge). Every variant segments every input
+ * from the same seeds; its label image must be the same partition as the reference one, up to
+ * relabeling (the adjusted Rand index, or the pixel agreement when the reference is a single region,
+ * is reported when it is not). With --baseline, the speedup of every result (reference p50 / variant
+ * p50) must be listed in the baseline file, written by --record-baseline on the same machine, and stay
+ * above the tolerance times the recorded one; without it the speedups are not checked, which
+ * seg_bench reports loudly. The exit status is non-zero when a check fails.
+ */
+
+int main(int argc, char** argv) {
+    BenchConfig config;
+
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string option = argv[i];
+            if (i + 1 >= argc) {
+                throw std::invalid_argument("missing value for " + option);
+            }
+            std::string value = argv[++i];
+
+            if (option == "--sizes") {
+                config.sizesGiven = true;
+                config.sizes.clear();
+                for (const std::string &size : split(value, ',')) {
+                    config.sizes.push_back(parse_size(size));
+                }
+            } else if (option == "--inputs") {
+                config.inputs = split(value, ',');
+            } else if (option == "--stages") {
+                config.stages = split(value, ',');
+            } else if (option == "--threads") {
+                for (const std::string &count : split(value, ',')) {
+                    config.threads.push_back(std::stoi(count));
+                }
+            } else if (option == "--repetitions") {
+                config.repetitions = std::max(1, std::stoi(value));
+            } else if (option == "--warmup") {
+                config.warmup = std::max(0, std::stoi(value));
+            } else if (option == "--division") {
+                config.maxDivision = std::stoi(value);
+            } else if (option == "--tile") {
+                config.tileSize = parse_size(value);
+            } else if (option == "--engine") {
+                if (value == "queue") {
+                    config.engine = GrowAndMerge::Engine::Queue;
+                } else if (value == "span") {
+                    config.engine = GrowAndMerge::Engine::Span;
+                } else {
+                    throw std::invalid_argument("unknown engine " + value);
+                }
+            } else if (option == "--merge") {
+                if (value == "graph") {
+                    config.merge = MergeStrategy::Graph;
+                } else if (value == "greedy") {
+                    config.merge = MergeStrategy::Greedy;
+                } else {
+                    throw std::invalid_argument("unknown merge strategy " + value);
+                }
+            } else if (option == "--predicate") {
+                if (value != "hsv" && value != "gray" && value != "lab") {
+                    throw std::invalid_argument("unknown predicate " + value);
+                }
+                config.predicate = value;
+            } else if (option == "--connectivity") {
+                config.connectivity = std::stoi(value);
+                if (config.connectivity != 4 && config.connectivity != 8) {
+                    throw std::invalid_argument("connectivity must be 4 or 8: " + value);
+                }
+            } else if (option == "--fill-gaps") {
+                config.fillGaps = std::stoi(value) != 0;
+            } else if (option == "--ressources") {
+                config.ressources = value;
+            } else if (option == "--json") {
+                config.jsonPath = value;
+            } else if (option == "--counters") {
+                config.countersPath = value;
+            } else if (option == "--trace") {
+                config.tracePath = value;
+            } else if (option == "--max-allocations") {
+                config.maxAllocations = std::max(0, std::stoi(value));
+            } else if (option == "--verify") {
+                config.verify = split(value, ',');
+                for (const std::string &name : config.verify) {
+                    bool known = name == "all";
+                    for (const VerifyVariant &variant : VERIFY_VARIANTS) {
+                        known = known || variant.name == name;
+                    }
+                    if (!known) {
+                        throw std::invalid_argument("unknown variant " + name);
+                    }
+                }
+            } else if (option == "--baseline") {
+                config.baselinePath = value;
+            } else if (option == "--record-baseline") {
+                config.recordBaselinePath = value;
+            } else if (option == "--speedup-tolerance") {
+                config.speedupTolerance = std::stod(value);
+            } else {
+                throw std::invalid_argument("unknown option " + option);
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << "seg_bench: " << e.what() << std::endl;
+        return -1;
+    }
+
+    if (config.threads.empty()) {
+        // 1, 2, 4, ... up to the hardware concurrency
+        int maxThreads = (int)std::max(1u, std::thread::hardware_concurrency());
+        for (int n = 1; n < maxThreads; n *= 2) {
+            config.threads.push_back(n);
+        }
+        config.threads.push_back(maxThreads);
+    }
+
+    if ((!config.countersPath.empty() || !config.tracePath.empty()) && !Instrumentation::enabled()) {
+        std::cerr << "seg_bench: --counters and --trace need a build with -DRG_INSTRUMENTATION=ON" << std::endl;
+        return -1;
+    }
+
+    if (!config.verify.empty()) {
+        if (!config.sizesGiven) {
+            config.sizes = {cv::Size(640, 480), cv::Size(1920, 1080)};
+        }
+        std::vector<VerifyResult> verifyResults;
+        try {
+            run_verification(config, verifyResults);
+        } catch (const std::exception &e) {
+            std::cerr << "seg_bench: " << e.what() << std::endl;
+            return -1;
+        }
+
+        if (config.jsonPath.empty()) {
+            write_verification_json(std::cout, config, verifyResults);
+        } else {
+            std::ofstream out(config.jsonPath);
+            if (!out) {
+                std::cerr << "seg_bench: cannot write " << config.jsonPath << std::endl;
+                return -1;
+            }
+            write_verification_json(out, config, verifyResults);
+        }
+        if (!config.recordBaselinePath.empty() && !write_baseline(config.recordBaselinePath, verifyResults)) {
+            return -1;
+        }
+
+        bool failed = false;
+        for (const VerifyResult &result : verifyResults) {
+            if (!result.passed) {
+                std::string measure = result.singleRegion ? "pixel agreement " : "ARI ";
+                std::cerr << "seg_bench: " << result.variant << " on " << result.input << " " << result.size.width << "x"
+                          << result.size.height << ": " << (result.identical ? "same partition" : measure + std::to_string(result.ari))
+                          << ", speedup " << result.speedup << " (baseline "
+                          << (result.inBaseline ? std::to_string(result.baselineSpeedup) : std::string("missing")) << ")" << std::endl;
+                failed = true;
+            }
+        }
+        if (config.baselinePath.empty()) {
+            std::cerr << "seg_bench: WARNING: no --baseline given, the speedups were NOT checked; record one with "
+                         "--record-baseline on the machine that runs the check" << std::endl;
+        }
+        return failed ? -1 : 0;
+    }
+
+    std::vector<BenchResult> results;
+    std::vector<CounterReport> counters;
+    run_benchmarks(config, results, counters);
+
+    if (!config.countersPath.empty() && !write_counters(config.countersPath, counters)) {
+        return -1;
+    }
+    if (!config.tracePath.empty()) {
+        std::ofstream out(config.tracePath);
+        if (!out) {
+            std::cerr << "seg_bench: cannot write " << config.tracePath << std::endl;
+            return -1;
+        }
+        Instrumentation::global().write_chrome_trace(out);
+    }
+
+    if (config.jsonPath.empty()) {
+        write_json(std::cout, config, results);
+    } else {
+        std::ofstream out(config.jsonPath);
+        if (!out) {
+            std::cerr << "seg_bench: cannot write " << config.jsonPath << std::endl;
+            return -1;
+        }
+        write_json(out, config, results);
+    }
+
+    if (config.maxAllocations >= 0) {
+        bool exceeded = false;
+        for (const BenchResult &result : results) {
+            if (result.allocations > (uint64_t)config.maxAllocations) {
+                std::cerr << "seg_bench: " << result.stage << " on " << result.input << " " << result.size.width << "x"
+                          << result.size.height << ", " << result.threads << " thread(s): " << result.allocations
+                          << " allocations per call, more than " << config.maxAllocations << std::endl;
+                exceeded = true;
+            }
+        }
+        if (exceeded) {
+            return -1;
+        }
+    }
+    return 0;
+}
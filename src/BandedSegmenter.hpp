@@ -0,0 +1,307 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include "GermsPositioning.hpp"
+#include "GrowAndMerge.hpp"
+
+#include "opencv2/imgproc.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Out-of-core segmentation of images larger than the memory, band by band.
+ *
+ * The input (binary PPM, or raw interleaved BGR with a known size) is memory-mapped and read in
+ * horizontal bands whose height follows the memory budget. Each band is read with a halo of
+ * HALO rows so that its blur matches the one of the whole image, then seeded and grown on its
+ * own; its regions are stitched to the last label row of the band above, the only state carried
+ * from band to band besides the region table. Provisional labels are appended to the label file
+ * as soon as a band is done; a final streaming pass rewrites them to their root IDs and renders
+ * the mask, one row at a time.
+ *
+ * Outputs: <prefix>_labels.raw (int32 root IDs, row-major, native endianness) and
+ * <prefix>_seg.ppm (rendered mask). Memory use is bounded by the budget plus the region table,
+ * which grows with the number of regions, not with the image size.
+ */
+class BandedSegmenter {
+private:
+    static constexpr int HALO = 2; // radius of the 5x5 Gaussian blur of ImageProcessor
+
+    // Band working set per pixel: BGR copy and blur, HSV, packed HSV, labels and the HSV
+    // summed-area tables (2 x 3 x CV_64F) of the seeding
+    static constexpr size_t BYTES_PER_PIXEL = 3 + 3 + 3 + 4 + 4 + 3 + 48;
+
+    MappedFile input;
+    const unsigned char* pixels = nullptr;
+    cv::Size imageSize;
+    bool rgbOrder = false;
+
+    size_t memoryBudget = (size_t)512 << 20;
+    int maxDivision = 5;
+    bool randColorization = false;
+    bool onlyEdge = false;
+
+    GrowAndMerge growAndMerge;
+
+    int bandHeight = 0;
+    int numBands = 0;
+
+    bool parse_pnm_header();
+
+    void read_band(int, int, cv::Mat &) const;
+
+    bool finalize(const std::string &, const std::string &);
+
+public:
+    // Binary PPM (P6, maxval 255)
+    bool open_pnm(const std::string &);
+
+    // Headerless interleaved BGR rows
+    bool open_raw(const std::string &, const cv::Size &);
+
+    void set_memory_budget(size_t);
+
+    void set_max_division(int);
+
+    void set_rand_colorization(bool);
+
+    void set_only_edge(bool);
+
+    cv::Size get_image_size() const;
+
+    // Rows per band for the current budget and image width
+    int get_band_height() const;
+
+    int get_num_bands() const;
+
+    bool run(const std::string &);
+};
+
+bool BandedSegmenter::open_pnm(const std::string &path) {
+    if (!input.open(path) || !parse_pnm_header()) {
+        input.close();
+        std::cerr << "Not a binary 8-bit PPM: " << path << std::endl;
+        return false;
+    }
+    rgbOrder = true;
+    return true;
+}
+
+bool BandedSegmenter::open_raw(const std::string &path, const cv::Size &size) {
+    if (!input.open(path) || size.area() <= 0 || input.size() < (size_t)size.width * size.height * 3) {
+        input.close();
+        std::cerr << "Raw input too small for " << size.width << "x" << size.height << ": " << path << std::endl;
+        return false;
+    }
+    pixels = input.data();
+    imageSize = size;
+    rgbOrder = false;
+    return true;
+}
+
+bool BandedSegmenter::parse_pnm_header() {
+    const unsigned char* data = input.data();
+    size_t length = input.size();
+    size_t pos = 0;
+
+    // Magic, width, height and maxval, separated by whitespace and '#' comments
+    auto next_token = [&]() {
+        std::string token;
+        while (pos < length) {
+            if (data[pos] == '#') {
+                while (pos < length && data[pos] != '\n') {
+                    pos++;
+                }
+            } else if (std::isspace(data[pos])) {
+                pos++;
+            } else {
+                break;
+            }
+        }
+        while (pos < length && !std::isspace(data[pos]) && token.size() < 16) {
+            token.push_back((char)data[pos++]);
+        }
+        return token;
+    };
+
+    if (next_token() != "P6") {
+        return false;
+    }
+    try {
+        int width = std::stoi(next_token());
+        int height = std::stoi(next_token());
+        int maxval = std::stoi(next_token());
+        pos++; // single whitespace before the raster
+        if (width <= 0 || height <= 0 || maxval != 255 || length < pos + (size_t)width * height * 3) {
+            return false;
+        }
+        imageSize = cv::Size(width, height);
+    } catch (const std::exception &) {
+        return false;
+    }
+    pixels = data + pos;
+    return true;
+}
+
+void BandedSegmenter::set_memory_budget(size_t bytes) {
+    memoryBudget = bytes;
+}
+
+void BandedSegmenter::set_max_division(int division) {
+    maxDivision = division;
+}
+
+void BandedSegmenter::set_rand_colorization(bool value) {
+    randColorization = value;
+}
+
+void BandedSegmenter::set_only_edge(bool value) {
+    onlyEdge = value;
+}
+
+cv::Size BandedSegmenter::get_image_size() const {
+    return imageSize;
+}
+
+int BandedSegmenter::get_band_height() const {
+    if (imageSize.area() <= 0) {
+        return 0;
+    }
+    size_t bytesPerRow = (size_t)imageSize.width * BYTES_PER_PIXEL;
+    int rows = (int)std::min<size_t>(memoryBudget / bytesPerRow, (size_t)imageSize.height + 2 * HALO) - 2 * HALO;
+    return std::max(1, std::min(rows, imageSize.height));
+}
+
+int BandedSegmenter::get_num_bands() const {
+    return numBands;
+}
+
+// Rows [y0, y1) as BGR, blurred like ImageProcessor::process_image
+void BandedSegmenter::read_band(int y0, int y1, cv::Mat &band) const {
+    int haloTop = std::max(0, y0 - HALO);
+    int haloBottom = std::min(imageSize.height, y1 + HALO);
+
+    // Zero-copy view of the mapping, never written to
+    cv::Mat raster(haloBottom - haloTop, imageSize.width, CV_8UC3,
+                   (void*)(pixels + (size_t)haloTop * imageSize.width * 3));
+    cv::Mat bgr;
+    if (rgbOrder) {
+        cv::cvtColor(raster, bgr, cv::COLOR_RGB2BGR);
+    } else {
+        bgr = raster.clone();
+    }
+    cv::GaussianBlur(bgr, bgr, cv::Size(5, 5), 0, 0);
+    band = bgr(cv::Rect(0, y0 - haloTop, imageSize.width, y1 - y0)).clone();
+}
+
+bool BandedSegmenter::run(const std::string &outputPrefix) {
+    if (!pixels) {
+        return false;
+    }
+    std::string labelPath = outputPrefix + "_labels.raw";
+    std::ofstream labelsOut(labelPath, std::ios::binary | std::ios::trunc);
+    if (!labelsOut) {
+        std::cerr << "Cannot write " << labelPath << std::endl;
+        return false;
+    }
+
+    bandHeight = get_band_height();
+    numBands = 0;
+    growAndMerge.begin_bands();
+
+    cv::Mat aboveRow;
+    for (int y0 = 0; y0 < imageSize.height; y0 += bandHeight) {
+        int y1 = std::min(imageSize.height, y0 + bandHeight);
+
+        cv::Mat band;
+        read_band(y0, y1, band);
+
+        std::vector<cv::Point> seeds;
+        GermsPositioningV2 positioningV2;
+        positioningV2.position_germs(band, maxDivision, seeds);
+
+        cv::Mat bandLabels;
+        growAndMerge.grow_band(band, y0, bandLabels, seeds, aboveRow, randColorization);
+
+        for (int i = 0; i < bandLabels.rows; ++i) {
+            labelsOut.write((const char*)bandLabels.ptr<int>(i), (std::streamsize)bandLabels.cols * sizeof(int));
+        }
+        aboveRow = bandLabels.row(bandLabels.rows - 1).clone();
+        numBands++;
+    }
+    labelsOut.close();
+    if (!labelsOut) {
+        std::cerr << "Cannot write " << labelPath << std::endl;
+        return false;
+    }
+
+    return finalize(labelPath, outputPrefix + "_seg.ppm");
+}
+
+bool BandedSegmenter::finalize(const std::string &labelPath, const std::string &maskPath) {
+    std::vector<int> roots;
+    growAndMerge.region_roots(roots);
+    const RegionTable &regions = growAndMerge.get_regions();
+
+    std::fstream labelsFile(labelPath, std::ios::binary | std::ios::in | std::ios::out);
+    std::ofstream maskOut(maskPath, std::ios::binary | std::ios::trunc);
+    if (!labelsFile || !maskOut) {
+        std::cerr << "Cannot write " << maskPath << std::endl;
+        return false;
+    }
+    maskOut << "P6\n" << imageSize.width << " " << imageSize.height << "\n255\n";
+
+    int width = imageSize.width;
+    std::streamsize rowBytes = (std::streamsize)width * sizeof(int);
+
+    // Reads row y, rewrites it with root IDs in place
+    auto resolve_row = [&](int y, std::vector<int> &row) {
+        labelsFile.seekg((std::streamoff)y * rowBytes);
+        labelsFile.read((char*)row.data(), rowBytes);
+        for (int &label : row) {
+            label = roots[label];
+        }
+        labelsFile.seekp((std::streamoff)y * rowBytes);
+        labelsFile.write((const char*)row.data(), rowBytes);
+    };
+
+    std::vector<int> previous, current(width), next(width);
+    std::vector<unsigned char> maskRow((size_t)width * 3);
+    uint64_t labeled = 0;
+
+    resolve_row(0, current);
+    for (int y = 0; y < imageSize.height; ++y) {
+        bool hasNext = y + 1 < imageSize.height;
+        if (hasNext) {
+            resolve_row(y + 1, next);
+        }
+
+        for (int x = 0; x < width; ++x) {
+            int label = current[x];
+            labeled += (label != 0);
+
+            // Same 4-neighbor test as GrowAndMerge::edge_row
+            bool draw = !onlyEdge ||
+                        (x > 0 && current[x - 1] != label) || (x + 1 < width && current[x + 1] != label) ||
+                        (!previous.empty() && previous[x] != label) || (hasNext && next[x] != label);
+            int color = draw ? regions.get_color(label) : 0;
+            maskRow[3 * x] = (unsigned char)((color >> 16) & 0xFF);
+            maskRow[3 * x + 1] = (unsigned char)((color >> 8) & 0xFF);
+            maskRow[3 * x + 2] = (unsigned char)(color & 0xFF);
+        }
+        maskOut.write((const char*)maskRow.data(), (std::streamsize)maskRow.size());
+
+        previous.swap(current);
+        current.swap(next);
+        next.resize(width);
+    }
+
+    std::cout << "Coverage percentage: " << (double)labeled / ((double)width * imageSize.height) * 100 << "%" << std::endl;
+    return (bool)labelsFile && (bool)maskOut;
+}
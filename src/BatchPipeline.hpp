@@ -0,0 +1,370 @@
+#pragma once
+
+#include "ImageProcessor.hpp"
+#include "GermsPositioning.hpp"
+#include "GrowAndMerge.hpp"
+#include "SegmentationFile.hpp"
+
+#include "opencv2/imgcodecs.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Fixed-capacity FIFO between two pipeline stages.
+ *
+ * push() blocks while the queue is full and pop() while it is empty; once close() has been called
+ * pop() drains the remaining items and then returns false.
+ */
+template <typename T>
+class BoundedQueue {
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed = false;
+
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+
+public:
+    explicit BoundedQueue(size_t);
+
+    void push(T);
+
+    bool pop(T &);
+
+    void close();
+};
+
+template <typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity) : capacity(std::max<size_t>(1, capacity)) { }
+
+template <typename T>
+void BoundedQueue<T>::push(T item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notFull.wait(lock, [this]() { return items.size() < capacity; });
+    items.push_back(std::move(item));
+    notEmpty.notify_one();
+}
+
+template <typename T>
+bool BoundedQueue<T>::pop(T &item) {
+    std::unique_lock<std::mutex> lock(mutex);
+    notEmpty.wait(lock, [this]() { return !items.empty() || closed; });
+    if (items.empty()) {
+        return false;
+    }
+    item = std::move(items.front());
+    items.pop_front();
+    notFull.notify_one();
+    return true;
+}
+
+template <typename T>
+void BoundedQueue<T>::close() {
+    std::lock_guard<std::mutex> guard(mutex);
+    closed = true;
+    notEmpty.notify_all();
+}
+
+/**
+ * @brief Headless segmentation of a directory (or a list file) of images.
+ *
+ * Decode, preprocessing, seeding, growing and encode run as five stages on their own threads,
+ * connected by bounded queues, so reading and writing images overlaps with the computation of
+ * the others. Seeding and growing still use the shared ThreadPool internally. Each stage thread keeps
+ * its ImageProcessor, GermsPositioningV2 or GrowAndMerge (with its SegmentationContext) from one
+ * image to the next, so their buffers are reused; what an item carries on is copied out of them.
+ * Each result is written as <output dir>/<input stem>.rgs (see SegmentationFile) and, unless
+ * disabled, as the rendered mask <output dir>/<input stem>_seg.png.
+ */
+class BatchPipeline {
+private:
+    struct Item {
+        std::filesystem::path path;
+        cv::Mat image;
+        cv::Mat hsv; // HSV of the preprocessed image, shared by the seeding and growing stages
+        std::vector<cv::Point> seeds;
+        cv::Mat mask;
+        cv::Mat labels;
+        RegionTable regions;
+    };
+
+    struct StageStats {
+        std::string name;
+        size_t count = 0;
+        size_t failures = 0;
+        double busySeconds = 0.0;
+    };
+
+    std::filesystem::path input;
+    std::filesystem::path outputDir;
+
+    size_t queueCapacity = 4;
+    int maxDivision = 5;
+    bool randColorization = false;
+    bool onlyEdge = false;
+    bool writeMasks = true;
+    bool fillGaps = false;
+
+    std::vector<StageStats> stats;
+    double wallSeconds = 0.0;
+
+    std::vector<std::filesystem::path> list_inputs() const;
+
+    // Runs the work on every item of the queue, passing on the ones it succeeds on. An item the work fails on, or
+    // throws on (logged), counts as a failure and is dropped; the stage goes on with the next one
+    template <typename Function>
+    void run_stage(StageStats &, BoundedQueue<Item> &, BoundedQueue<Item> *, Function);
+
+public:
+    BatchPipeline(const std::filesystem::path &, const std::filesystem::path &);
+
+    void set_queue_capacity(size_t);
+
+    void set_max_division(int);
+
+    void set_rand_colorization(bool);
+
+    void set_only_edge(bool);
+
+    void set_write_masks(bool);
+
+    // See GrowAndMerge::set_fill_gaps
+    void set_fill_gaps(bool);
+
+    // Returns false when the input cannot be listed or the output directory cannot be created
+    bool run();
+
+    void print_report(std::ostream &) const;
+};
+
+BatchPipeline::BatchPipeline(const std::filesystem::path &input, const std::filesystem::path &outputDir)
+    : input(input), outputDir(outputDir) { }
+
+void BatchPipeline::set_queue_capacity(size_t capacity) {
+    queueCapacity = capacity;
+}
+
+void BatchPipeline::set_max_division(int division) {
+    maxDivision = division;
+}
+
+void BatchPipeline::set_rand_colorization(bool value) {
+    randColorization = value;
+}
+
+void BatchPipeline::set_only_edge(bool value) {
+    onlyEdge = value;
+}
+
+void BatchPipeline::set_write_masks(bool value) {
+    writeMasks = value;
+}
+
+void BatchPipeline::set_fill_gaps(bool value) {
+    fillGaps = value;
+}
+
+std::vector<std::filesystem::path> BatchPipeline::list_inputs() const {
+    std::vector<std::filesystem::path> paths;
+
+    if (std::filesystem::is_directory(input)) {
+        const std::vector<std::string> extensions = {".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff",
+                                                     ".ppm", ".pgm", ".pnm", ".webp"};
+        for (const auto &entry : std::filesystem::directory_iterator(input)) {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (entry.is_regular_file() &&
+                std::find(extensions.begin(), extensions.end(), extension) != extensions.end()) {
+                paths.push_back(entry.path());
+            }
+        }
+        std::sort(paths.begin(), paths.end());
+    } else {
+        // One path per line, blank lines and '#' comments are skipped
+        std::ifstream list(input);
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty() && line[0] != '#') {
+                paths.emplace_back(line);
+            }
+        }
+    }
+    return paths;
+}
+
+template <typename Function>
+void BatchPipeline::run_stage(StageStats &stage, BoundedQueue<Item> &in, BoundedQueue<Item> *out, Function work) {
+    Item item;
+    while (in.pop(item)) {
+        auto begin = std::chrono::steady_clock::now();
+        bool ok;
+        try {
+            ok = work(item);
+        } catch (const std::exception &e) {
+            // A stage runs on its own std::thread: an escaping exception would terminate the process
+            std::cerr << stage.name << " failed on " << item.path << ": " << e.what() << std::endl;
+            ok = false;
+        } catch (...) {
+            std::cerr << stage.name << " failed on " << item.path << std::endl;
+            ok = false;
+        }
+        stage.busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        if (!ok) {
+            stage.failures++;
+            continue;
+        }
+        stage.count++;
+        if (out) {
+            out->push(std::move(item));
+        }
+    }
+    if (out) {
+        out->close();
+    }
+}
+
+bool BatchPipeline::run() {
+    if (!std::filesystem::exists(input)) {
+        std::cerr << "Input not found: " << input << std::endl;
+        return false;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(outputDir, error);
+    if (error) {
+        std::cerr << "Cannot create output directory " << outputDir << ": " << error.message() << std::endl;
+        return false;
+    }
+
+    std::vector<std::filesystem::path> paths = list_inputs();
+
+    stats.assign(5, StageStats());
+    stats[0].name = "decode";
+    stats[1].name = "preprocess";
+    stats[2].name = "seeding";
+    stats[3].name = "growing";
+    stats[4].name = "encode";
+
+    BoundedQueue<Item> toDecode(queueCapacity), toPreprocess(queueCapacity), toSeed(queueCapacity),
+                       toGrow(queueCapacity), toEncode(queueCapacity);
+
+    auto begin = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> stages;
+    stages.emplace_back([&]() {
+        run_stage(stats[0], toDecode, &toPreprocess, [](Item &item) {
+            item.image = cv::imread(item.path.string(), cv::IMREAD_COLOR);
+            if (item.image.empty()) {
+                std::cerr << "No image data: " << item.path << std::endl;
+                return false;
+            }
+            return true;
+        });
+    });
+    stages.emplace_back([&]() {
+        // The views are reused by the next image while the later stages still read these ones
+        ImageProcessor imageProcessor;
+        run_stage(stats[1], toPreprocess, &toSeed, [&imageProcessor](Item &item) {
+            imageProcessor.process_image(item.image);
+            item.image = imageProcessor.get_image_rgb().clone();
+            item.hsv = imageProcessor.get_image_hsv().clone();
+            return true;
+        });
+    });
+    stages.emplace_back([&]() {
+        GermsPositioningV2 positioningV2;
+        IntegralImage integral;
+        run_stage(stats[2], toSeed, &toGrow, [this, &positioningV2, &integral](Item &item) {
+            integral.compute_from_hsv(item.hsv);
+            positioningV2.position_germs(item.image, maxDivision, item.seeds, integral);
+            return true;
+        });
+    });
+    stages.emplace_back([&]() {
+        // The labels live in the context and are overwritten by the next image
+        SegmentationContext context;
+        GrowAndMerge growAndMerge;
+        growAndMerge.set_context(context);
+        growAndMerge.set_fill_gaps(fillGaps);
+        // No coverage line per image, the report sums the stage up
+        growAndMerge.set_quiet(true);
+        run_stage(stats[3], toGrow, &toEncode, [this, &growAndMerge, &context](Item &item) {
+            growAndMerge.set_features(item.hsv);
+            item.mask = cv::Mat::zeros(item.image.size(), CV_8UC3);
+            try {
+                growAndMerge.rg_seg(item.image, item.mask, item.seeds, randColorization, onlyEdge);
+            } catch (...) {
+                // The colors the failed call handed out are free again for the next image
+                context.discard();
+                throw;
+            }
+            item.labels = growAndMerge.get_labels().clone();
+            item.regions = growAndMerge.get_regions();
+            return true;
+        });
+    });
+    stages.emplace_back([&]() {
+        run_stage(stats[4], toEncode, nullptr, [this](Item &item) {
+            std::filesystem::path resultPath = outputDir / (item.path.stem().string() + ".rgs");
+            if (!SegmentationFile::write(resultPath.string(), item.labels, item.regions)) {
+                std::cerr << "Cannot write " << resultPath << std::endl;
+                return false;
+            }
+            if (writeMasks) {
+                std::filesystem::path maskPath = outputDir / (item.path.stem().string() + "_seg.png");
+                if (!cv::imwrite(maskPath.string(), item.mask)) {
+                    std::cerr << "Cannot write " << maskPath << std::endl;
+                    return false;
+                }
+            }
+            return true;
+        });
+    });
+
+    for (const auto &path : paths) {
+        Item item;
+        item.path = path;
+        toDecode.push(std::move(item));
+    }
+    toDecode.close();
+
+    for (std::thread &stage : stages) {
+        stage.join();
+    }
+
+    wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    return true;
+}
+
+void BatchPipeline::print_report(std::ostream &os) const {
+    char line[128];
+    std::snprintf(line, sizeof(line), "%-12s %8s %8s %10s %10s\n", "Stage", "Images", "Failed", "Busy (s)", "Images/s");
+    os << line;
+    for (const auto &stage : stats) {
+        double rate = (stage.busySeconds > 0) ? stage.count / stage.busySeconds : 0.0;
+        std::snprintf(line, sizeof(line), "%-12s %8zu %8zu %10.3f %10.2f\n",
+                      stage.name.c_str(), stage.count, stage.failures, stage.busySeconds, rate);
+        os << line;
+    }
+    size_t written = stats.empty() ? 0 : stats.back().count;
+    double rate = (wallSeconds > 0) ? written / wallSeconds : 0.0;
+    std::snprintf(line, sizeof(line), "%-12s %8zu %8s %10.3f %10.2f\n", "pipeline", written, "", wallSeconds, rate);
+    os << line;
+}
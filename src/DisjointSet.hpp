@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Disjoint-set forest (union-find) over dense integer IDs.
+ *
+ * Each set carries a weight (for regions: their pixel count) which drives the union by size:
+ * the heavier root always survives a union. find() applies full path compression, so a
+ * sequence of unions and finds runs in O(α(n)) amortized per operation.
+ */
+class DisjointSet {
+private:
+    std::vector<int> parent;
+    std::vector<uint32_t> size;
+
+public:
+    void clear();
+
+    void reserve(size_t);
+
+    // O(1)
+    int make_set(uint32_t weight = 1);
+
+    // O(α(n))
+    int find(int);
+
+    // O(α(n)) - returns the surviving root
+    int unite(int, int);
+
+    // O(α(n)) - like unite() but the root of the first argument always survives
+    int unite_into(int, int);
+
+    // O(elements of the other forest) - appends its elements from the given one on, with their IDs shifted
+    // to follow the last element of this forest; none of them may have a parent before the given one
+    void append(DisjointSet const&, int);
+
+    // O(1) - turns the element back into a singleton with the given weight
+    void reset(int, uint32_t weight = 0);
+
+    // O(1)
+    bool is_root(int) const;
+
+    // O(1)
+    void add_weight(int, uint32_t);
+
+    uint32_t get_size(int) const;
+
+    size_t count() const;
+};
+
+void DisjointSet::clear() {
+    parent.clear();
+    size.clear();
+}
+
+void DisjointSet::reserve(size_t n) {
+    parent.reserve(n);
+    size.reserve(n);
+}
+
+int DisjointSet::make_set(uint32_t weight) {
+    int id = (int)parent.size();
+    parent.push_back(id);
+    size.push_back(weight);
+    return id;
+}
+
+int DisjointSet::find(int id) {
+    int root = id;
+    while (parent[root] != root) {
+        root = parent[root];
+    }
+    while (parent[id] != root) {
+        int next = parent[id];
+        parent[id] = root;
+        id = next;
+    }
+    return root;
+}
+
+int DisjointSet::unite(int a, int b) {
+    a = find(a);
+    b = find(b);
+    if (a == b) {
+        return a;
+    }
+    // On equal sizes the first argument survives
+    if (size[a] < size[b]) {
+        std::swap(a, b);
+    }
+    parent[b] = a;
+    size[a] += size[b];
+    return a;
+}
+
+int DisjointSet::unite_into(int a, int b) {
+    a = find(a);
+    b = find(b);
+    if (a != b) {
+        parent[b] = a;
+        size[a] += size[b];
+    }
+    return a;
+}
+
+void DisjointSet::append(DisjointSet const& other, int first) {
+    int shift = (int)parent.size() - first;
+    for (int id = first; id < (int)other.parent.size(); ++id) {
+        parent.push_back(other.parent[id] + shift);
+        size.push_back(other.size[id]);
+    }
+}
+
+void DisjointSet::reset(int id, uint32_t weight) {
+    parent[id] = id;
+    size[id] = weight;
+}
+
+bool DisjointSet::is_root(int id) const {
+    return parent[id] == id;
+}
+
+void DisjointSet::add_weight(int root, uint32_t weight) {
+    size[root] += weight;
+}
+
+uint32_t DisjointSet::get_size(int root) const {
+    return size[root];
+}
+
+size_t DisjointSet::count() const {
+    return parent.size();
+}
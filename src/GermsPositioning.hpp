@@ -1,13 +1,19 @@
 #pragma once
 
 #include "SegmentedRegion.hpp"
+#include "LinearQuadtree.hpp"
 #include "ImageUtil.hpp"
+#include "IntegralImage.hpp"
+#include "ThreadPool.hpp"
+#include "Instrumentation.hpp"
 
 #include "opencv2/imgproc.hpp"
 
 #include <iostream>
 #include "ostream"
-#include <list>
+#include <algorithm>
+#include <array>
+#include <cmath>
 #include <vector>
 #include <random>
 #include <future>
@@ -52,17 +58,54 @@ void GermsPositioningV1::generate_seed(std::vector<cv::Point>& seeds, uint32_t w
 
 class GermsPositioningV2 {
 private:
-    std::list<SegmentedRegion> germsRegions;
+    LinearQuadtree quadtree; // leaves of the last division, in Morton order
     ImageUtil imageUtil;
+    IntegralImage integralImage; // HSV summed-area tables of the image being divided
+    const IntegralImage *sharedIntegral = nullptr; // nullptr: integralImage, otherwise tables of the caller
+    const std::vector<cv::Rect> *keptAreas = nullptr; // nullptr: every quad, otherwise only the quads meeting one
+
+    // See set_population_variance()
+    bool populationVariance = false;
+
+    ThreadPool *threadPool = nullptr; // nullptr: ThreadPool::shared()
+    std::vector<LinearQuadtree> workerGerms; // leaves found by each pool worker
+
+    ThreadPool &get_thread_pool();
+
+    const IntegralImage &get_integral_image() const;
+
+    // O(quad area), O(1) with set_population_variance() - variance the separation criterion is applied to
+    double quad_variance(const cv::Point &, const cv::Point &) const;
+
+    std::array<std::pair<cv::Point, cv::Point>, 4> quadrants(const cv::Point &, const cv::Point &) const;
+
+    // The location code of the quad travels with it, its level is the iteration counter
+    void divide_image_task(const cv::Mat &, const cv::Point &, const cv::Point &, int, int, uint64_t, ThreadPool::TaskGroup &);
+
+    void add_worker_germ(uint64_t code, int level, const cv::Point &topLeft, const cv::Point &bottomRight, double variance);
+
+    // Divides the area of the image on its own, down to the smallest quad of a division of the whole image;
+    // appends the seeds in image coordinates
+    void divide_area(const cv::Mat &, const cv::Rect &, int, std::vector<cv::Point> &);
 
 public:
-    const std::list<SegmentedRegion>& get_germs_regions() const;
+    const LinearQuadtree& get_quadtree() const;
 
-    void set_germs_regions(const std::list<SegmentedRegion> &);
+    // Empties the quadtree, rooted at the given area, before a serial divide_image()
+    void clear_germs(const cv::Rect &);
 
-    void add_germ(const cv::Point &topLeft, const cv::Point &bottomRight, double variance);
+    void set_thread_pool(ThreadPool &);
+
+    bool get_population_variance() const;
 
-    void delete_germ(const std::list<SegmentedRegion>::iterator &);
+    // Splits the quads on the population variance of the channels, in O(1) from the summed-area tables, instead of
+    // the one of ImageUtil::calculate_region_variance, whose squared deviations saturate at 255 (O(quad area)).
+    // Quads are no longer under-measured, so the same image gets more seeds (about 750 instead of 500 on the
+    // sample images): opt-in
+    void set_population_variance(bool);
+
+    // O(depth) - the quad must come from the subdivision of the root
+    void add_germ(const cv::Point &topLeft, const cv::Point &bottomRight, double variance);
 
     bool variance_criterion(const double & variance, const double limit) const;
     bool iteration_criterion(const int iterationLimit, const int iterationCounter) const;
@@ -80,20 +123,65 @@ public:
 
     void position_germs(cv::Mat&, int, std::vector<cv::Point> &);
 
+    // Same, with the HSV summed-area tables of the image already built (see ImageProcessor::get_integral_image)
+    void position_germs(cv::Mat&, int, std::vector<cv::Point> &, const IntegralImage &);
+
+    // Same, over the non-zero pixels of the CV_8U ROI mask (image size) only: the summed-area tables and the
+    // division cover the bounding box of the mask, and the seeds out of the mask are dropped. The quadtree is
+    // the division of that box, relative to its top-left corner
+    void position_germs(cv::Mat&, int, std::vector<cv::Point> &, const cv::Mat &);
+
+    // Same over a list of rectangles: one division of their bounding box, where the quads meeting no rectangle are
+    // neither split nor kept, and the seeds out of the rectangles are dropped. The quadtree holds the leaves of every
+    // rectangle, relative to the top-left corner of the box
+    void position_germs(cv::Mat&, int, std::vector<cv::Point> &, const std::vector<cv::Rect> &);
+
     friend std::ostream& operator<<(std::ostream&, const GermsPositioningV2&);
 };
 
-const std::list<SegmentedRegion>& GermsPositioningV2::get_germs_regions() const {
-    return germsRegions;
+const LinearQuadtree& GermsPositioningV2::get_quadtree() const {
+    return quadtree;
 }
 
-void GermsPositioningV2::add_germ(const cv::Point &topLeft, const cv::Point &bottomRight, double variance) {
-    std::lock_guard<std::mutex> guard(germMutex);
-    germsRegions.push_back(SegmentedRegion(topLeft, bottomRight, variance));
+void GermsPositioningV2::clear_germs(const cv::Rect &area) {
+    quadtree.clear(area);
+}
+
+void GermsPositioningV2::set_thread_pool(ThreadPool &pool) {
+    threadPool = &pool;
+}
+
+bool GermsPositioningV2::get_population_variance() const {
+    return populationVariance;
+}
+
+void GermsPositioningV2::set_population_variance(bool value) {
+    populationVariance = value;
+}
+
+double GermsPositioningV2::quad_variance(const cv::Point &topLeft, const cv::Point &bottomRight) const {
+    return populationVariance ? get_integral_image().region_population_variance(topLeft, bottomRight)
+                              : get_integral_image().region_variance(topLeft, bottomRight);
+}
+
+const IntegralImage &GermsPositioningV2::get_integral_image() const {
+    return sharedIntegral ? *sharedIntegral : integralImage;
+}
+
+ThreadPool &GermsPositioningV2::get_thread_pool() {
+    return threadPool ? *threadPool : ThreadPool::shared();
 }
 
-void GermsPositioningV2::delete_germ(const std::list<SegmentedRegion>::iterator & it) {
-    germsRegions.erase(it);
+void GermsPositioningV2::add_worker_germ(uint64_t code, int level, const cv::Point &topLeft, const cv::Point &bottomRight, double variance) {
+    // Tasks only run on pool workers and each worker owns its slot: no lock needed
+    workerGerms[get_thread_pool().current_worker()].add_leaf(code, level, topLeft, bottomRight, variance);
+}
+
+void GermsPositioningV2::add_germ(const cv::Point &topLeft, const cv::Point &bottomRight, double variance) {
+    std::lock_guard<std::mutex> guard(germMutex);
+    if (!quadtree.add_leaf(topLeft, bottomRight, variance)) {
+        std::cerr << "The quad is not a quad of the subdivision of " << quadtree.get_root() << "\n";
+    }
 }
 
 bool GermsPositioningV2::variance_criterion(const double & variance, const double limit) const {
@@ -146,7 +234,9 @@ void GermsPositioningV2::process_high_variance_region(const cv::Mat &image, cons
 }
 
 void GermsPositioningV2::divide_image(const cv::Mat &image, const cv::Point &topLeft, const cv::Point &bottomRight, int iterationLimit, int & iterationCounter) {
-    double variance = imageUtil.calculate_region_variance(image, topLeft, bottomRight);
+    RG_COUNT(QuadtreeNodes, 1);
+    // Same value as imageUtil.calculate_region_variance(image, topLeft, bottomRight) by default
+    double variance = quad_variance(topLeft, bottomRight);
 
     bool criterion = separation_criterion(variance, iterationLimit, iterationCounter, topLeft, bottomRight);
 
@@ -162,7 +252,8 @@ void GermsPositioningV2::divide_image(const cv::Mat &image, const cv::Point &top
     }
 }
 
-void GermsPositioningV2::divide_image_multithread(const cv::Mat &image, const cv::Point &topLeft, const cv::Point &bottomRight, int iterationLimit) {
+// Top-left, top-right, bottom-left and bottom-right quarters, as in process_high_variance_region
+std::array<std::pair<cv::Point, cv::Point>, 4> GermsPositioningV2::quadrants(const cv::Point &topLeft, const cv::Point &bottomRight) const {
     int midX = (topLeft.x + bottomRight.x) / 2;
     int midY = (topLeft.y + bottomRight.y) / 2;
 
@@ -172,45 +263,323 @@ void GermsPositioningV2::divide_image_multithread(const cv::Mat &image, const cv
     cv::Point leftMid = cv::Point(topLeft.x, midY);
     cv::Point midBottom = cv::Point(midX, bottomRight.y);
 
+    return {std::make_pair(topLeft, mid), std::make_pair(midTop, midRight),
+            std::make_pair(leftMid, midBottom), std::make_pair(mid, bottomRight)};
+}
 
-    std::vector<std::thread> threads;
+/**
+ * @brief Task version of divide_image: every subdivision is pushed to the pool as a separate task.
+ *
+ * The iteration counter is the depth of the quad and travels by value. The decisions are the
+ * same as in divide_image / process_high_variance_region.
+ */
+void GermsPositioningV2::divide_image_task(const cv::Mat &image, const cv::Point &topLeft, const cv::Point &bottomRight,
+                                           int iterationLimit, int iterationCounter, uint64_t code, ThreadPool::TaskGroup &group) {
+    RG_TRACE("divide_image");
+    if (keptAreas && std::none_of(keptAreas->begin(), keptAreas->end(), [&](const cv::Rect &area) {
+            return (area & cv::Rect(topLeft, bottomRight)).area() > 0;
+        })) {
+        return;
+    }
+    RG_COUNT(QuadtreeNodes, 1);
+    double variance = quad_variance(topLeft, bottomRight);
+    int level = iterationCounter;
 
-    int counter1 = 1, counter2 = 1, counter3 = 1, counter4 = 1;
+    if (!separation_criterion(variance, iterationLimit, iterationCounter, topLeft, bottomRight)) {
+        add_worker_germ(code, level, topLeft, bottomRight, variance);
+        return;
+    }
+    if (topLeft.x >= bottomRight.x || topLeft.y >= bottomRight.y) {
+        std::cerr << "Top left and bottom right pixels are not respecting the condition: topLeft.x < bottomRight.x and topLeft.y < bottomRight.y\n";
+        return;
+    }
 
-    threads.push_back(std::move(std::thread(&GermsPositioningV2::divide_image, this, std::ref(image), topLeft, mid, iterationLimit, std::ref(counter1))));
-    threads.push_back(std::move(std::thread(&GermsPositioningV2::divide_image, this, std::ref(image), midTop, midRight, iterationLimit, std::ref(counter2))));
-    threads.push_back(std::move(std::thread(&GermsPositioningV2::divide_image, this, std::ref(image), leftMid, midBottom, iterationLimit, std::ref(counter3))));
-    threads.push_back(std::move(std::thread(&GermsPositioningV2::divide_image, this, std::ref(image), mid, bottomRight, iterationLimit, std::ref(counter4))));
+    iterationCounter++;
+    if (!iteration_criterion(iterationLimit, iterationCounter)) {
+        // Can divide anymore, add the current region.
+        add_worker_germ(code, level, topLeft, bottomRight, -1);
+        return;
+    }
 
-    for (std::thread &t : threads) {
-        if (t.joinable()) {
-            t.join();
-        }
+    std::array<std::pair<cv::Point, cv::Point>, 4> children = quadrants(topLeft, bottomRight);
+    for (int q = 0; q < 4; ++q) {
+        std::pair<cv::Point, cv::Point> quadrant = children[q];
+        uint64_t childCode = LinearQuadtree::child_code(code, q);
+        get_thread_pool().run(group, [this, &image, quadrant, iterationLimit, iterationCounter, childCode, &group]() {
+            divide_image_task(image, quadrant.first, quadrant.second, iterationLimit, iterationCounter, childCode, group);
+        });
     }
 }
 
+void GermsPositioningV2::divide_image_multithread(const cv::Mat &image, const cv::Point &topLeft, const cv::Point &bottomRight, int iterationLimit) {
+    ThreadPool &pool = get_thread_pool();
+    cv::Rect root(topLeft, bottomRight);
+    workerGerms.resize(pool.get_num_workers());
+    for (LinearQuadtree &germs : workerGerms) {
+        germs.clear(root);
+    }
+
+    ThreadPool::TaskGroup group;
+    std::array<std::pair<cv::Point, cv::Point>, 4> children = quadrants(topLeft, bottomRight);
+    for (int q = 0; q < 4; ++q) {
+        std::pair<cv::Point, cv::Point> quadrant = children[q];
+        pool.run(group, [this, &image, quadrant, iterationLimit, q, &group]() {
+            divide_image_task(image, quadrant.first, quadrant.second, iterationLimit, 1, LinearQuadtree::child_code(0, q), group);
+        });
+    }
+    pool.wait(group);
+
+    // Morton order of the codes: the seeds do not depend on scheduling
+    size_t numLeaves = 0;
+    for (const LinearQuadtree &germs : workerGerms) {
+        numLeaves += germs.size();
+    }
+    quadtree.clear(root);
+    quadtree.reserve(numLeaves);
+    for (const LinearQuadtree &germs : workerGerms) {
+        quadtree.append(germs);
+    }
+    quadtree.sort();
+}
+
 void GermsPositioningV2::add_region_germ(std::vector<cv::Point> & seeds) {
-    for (const auto& germ : get_germs_regions()) {
-        seeds.push_back(imageUtil.calculate_middle_point(germ.getTopLeftPoint(), germ.getBottomRightPoint()));
+    for (int leaf = 0; leaf < (int)quadtree.size(); ++leaf) {
+        seeds.push_back(quadtree.get_center(leaf));
     }
 }
 
 void GermsPositioningV2::position_germs(cv::Mat& image, int maxDivision, std::vector<cv::Point> & seeds) {
+    RG_STAGE("position_germs");
     cv::Point initialTopLeft(0, 0);
     cv::Point initialBottomRight(image.cols, image.rows);
 
+    integralImage.compute(image);
+
     divide_image_multithread(image, initialTopLeft, initialBottomRight, maxDivision);
 
     add_region_germ(seeds);
 }
 
+void GermsPositioningV2::position_germs(cv::Mat& image, int maxDivision, std::vector<cv::Point> & seeds,
+                                        const IntegralImage & integral) {
+    RG_STAGE("position_germs");
+    CV_Assert(integral.size() == image.size());
+
+    // Only for the duration of the call: the tables belong to the caller
+    sharedIntegral = &integral;
+    divide_image_multithread(image, cv::Point(0, 0), cv::Point(image.cols, image.rows), maxDivision);
+    sharedIntegral = nullptr;
+
+    add_region_germ(seeds);
+}
+
+void GermsPositioningV2::divide_area(const cv::Mat &image, const cv::Rect &area, int maxDivision, std::vector<cv::Point> &seeds) {
+    // Same smallest quad as a division of the whole image: the depth shrinks with the area
+    double minQuad = std::max(1.0, std::max(image.cols, image.rows) / std::pow(2.0, maxDivision));
+    int division = (int)std::ceil(std::log2(std::max(1.0, std::max(area.width, area.height) / minQuad)));
+    division = std::max(1, std::min(maxDivision, division));
+
+    // O(area) - the tables only cover the area
+    cv::Mat part = image(area);
+    integralImage.compute(part);
+    divide_image_multithread(part, cv::Point(0, 0), cv::Point(area.width, area.height), division);
+
+    for (int leaf = 0; leaf < (int)quadtree.size(); ++leaf) {
+        seeds.push_back(quadtree.get_center(leaf) + area.tl());
+    }
+}
+
+void GermsPositioningV2::position_germs(cv::Mat& image, int maxDivision, std::vector<cv::Point> & seeds,
+                                        const cv::Mat & roiMask) {
+    RG_STAGE("position_germs");
+    CV_Assert(roiMask.size() == image.size() && roiMask.type() == CV_8U);
+    cv::Rect area = cv::boundingRect(roiMask);
+    if (area.empty()) {
+        quadtree.clear(area);
+        return;
+    }
+
+    size_t first = seeds.size();
+    divide_area(image, area, maxDivision, seeds);
+    seeds.erase(std::remove_if(seeds.begin() + first, seeds.end(),
+                               [&](const cv::Point &seed) { return roiMask.at<uchar>(seed) == 0; }),
+                seeds.end());
+}
+
+void GermsPositioningV2::position_germs(cv::Mat& image, int maxDivision, std::vector<cv::Point> & seeds,
+                                        const std::vector<cv::Rect> & rects) {
+    RG_STAGE("position_germs");
+    cv::Rect imageArea(0, 0, image.cols, image.rows);
+    std::vector<cv::Rect> areas;
+    cv::Rect box;
+    for (const cv::Rect &rect : rects) {
+        cv::Rect area = rect & imageArea;
+        if (!area.empty()) {
+            box |= area;
+            areas.push_back(area);
+        }
+    }
+    if (areas.empty()) {
+        quadtree.clear(cv::Rect());
+        return;
+    }
+    // Relative to the box, as the division
+    for (cv::Rect &area : areas) {
+        area -= box.tl();
+    }
+
+    size_t first = seeds.size();
+    // Only for the duration of the call
+    keptAreas = &areas;
+    divide_area(image, box, maxDivision, seeds);
+    keptAreas = nullptr;
+    seeds.erase(std::remove_if(seeds.begin() + first, seeds.end(),
+                               [&](const cv::Point &seed) {
+                                   return std::none_of(areas.begin(), areas.end(),
+                                                       [&](const cv::Rect &area) { return area.contains(seed - box.tl()); });
+                               }),
+                seeds.end());
+}
+
 std::ostream& operator<<(std::ostream& os, const GermsPositioningV2& gpv2)
 {
-    for (const auto& germ : gpv2.get_germs_regions()) {
+    const LinearQuadtree &quadtree = gpv2.get_quadtree();
+    for (int leaf = 0; leaf < (int)quadtree.size(); ++leaf) {
         os << "\n -------------------------------- \n";
-        os << germ;
+        os << SegmentedRegion(quadtree.get_top_left(leaf), quadtree.get_bottom_right(leaf), quadtree.get_variance(leaf));
         os << "\n -------------------------------- \n";
 
     }
     return os;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief Octree version of GermsPositioningV2::divide_image, for a slab of slices.
+ *
+ * A cuboid is split at the midpoints of its sides, along z too while it spans more than one slice,
+ * as long as the same criteria as a quad allow it: a mean HSV variance of at least 110, a depth
+ * within the limit and at least 30 voxels. Each leaf gives a seed at its center. The variance of a
+ * cuboid comes from summed-volume tables: plane z of a table holds the summed-area table of the
+ * slices before z, so the sums over a cuboid are the rectangle of plane bottomRight.z minus the one
+ * of plane topLeft.z, eight lookups whatever the depth.
+ */
+class GermsPositioningOctree {
+private:
+    // depth + 1 CV_64FC3 planes of (rows + 1) x (cols + 1): the HSV values and their squares summed over
+    // [0, x) x [0, y) x [0, z) of the slab
+    std::vector<cv::Mat> volumeSum;
+    std::vector<cv::Mat> volumeSqSum;
+    GermsPositioningV2 criteria;
+
+    // O(1) - per channel sum of the table over the cuboid [topLeft, bottomRight)
+    cv::Vec3d cuboid_sum(const std::vector<cv::Mat> &, const cv::Point3i &, const cv::Point3i &) const;
+
+public:
+    // O(voxels) - tables of the slab, from its HSV slices
+    void set_slices(const std::vector<cv::Mat> &);
+
+    // O(1) - same value as IntegralImage::region_population_variance over the voxels of [topLeft, bottomRight)
+    double region_variance(const cv::Point3i &, const cv::Point3i &) const;
+
+    void divide_volume(const cv::Point3i &, const cv::Point3i &, int, int, std::vector<cv::Point3i> &) const;
+
+    // Seeds in slab coordinates, in depth-first order of the octree
+    void position_germs(const std::vector<cv::Mat> &, int, std::vector<cv::Point3i> &);
+};
+
+void GermsPositioningOctree::set_slices(const std::vector<cv::Mat> &hsvSlices) {
+    int depth = (int)hsvSlices.size();
+    volumeSum.resize(depth + 1);
+    volumeSqSum.resize(depth + 1);
+    if (depth == 0) {
+        return;
+    }
+    int rows = hsvSlices[0].rows + 1;
+    int cols = hsvSlices[0].cols + 1;
+    volumeSum[0] = cv::Mat::zeros(rows, cols, CV_64FC3);
+    volumeSqSum[0] = cv::Mat::zeros(rows, cols, CV_64FC3);
+    for (int z = 0; z < depth; ++z) {
+        // Summed-area tables of the slice, plus the plane below
+        cv::integral(hsvSlices[z], volumeSum[z + 1], volumeSqSum[z + 1], CV_64F, CV_64F);
+        for (int y = 0; y < rows; ++y) {
+            const cv::Vec3d *sumBelow = volumeSum[z].ptr<cv::Vec3d>(y);
+            const cv::Vec3d *sqSumBelow = volumeSqSum[z].ptr<cv::Vec3d>(y);
+            cv::Vec3d *sum = volumeSum[z + 1].ptr<cv::Vec3d>(y);
+            cv::Vec3d *sqSum = volumeSqSum[z + 1].ptr<cv::Vec3d>(y);
+            for (int x = 0; x < cols; ++x) {
+                sum[x] += sumBelow[x];
+                sqSum[x] += sqSumBelow[x];
+            }
+        }
+    }
+}
+
+cv::Vec3d GermsPositioningOctree::cuboid_sum(const std::vector<cv::Mat> &table, const cv::Point3i &topLeft,
+                                             const cv::Point3i &bottomRight) const {
+    cv::Vec3d total(0, 0, 0);
+    const int zs[2] = {bottomRight.z, topLeft.z};
+    for (int i = 0; i < 2; ++i) {
+        const cv::Mat &plane = table[zs[i]];
+        const cv::Vec3d &a = plane.at<cv::Vec3d>(topLeft.y, topLeft.x);
+        const cv::Vec3d &b = plane.at<cv::Vec3d>(topLeft.y, bottomRight.x);
+        const cv::Vec3d &c = plane.at<cv::Vec3d>(bottomRight.y, topLeft.x);
+        const cv::Vec3d &d = plane.at<cv::Vec3d>(bottomRight.y, bottomRight.x);
+        double sign = i == 0 ? 1.0 : -1.0;
+        for (int k = 0; k < 3; ++k) {
+            total[k] += sign * (d[k] - b[k] - c[k] + a[k]);
+        }
+    }
+    return total;
+}
+
+double GermsPositioningOctree::region_variance(const cv::Point3i &topLeft, const cv::Point3i &bottomRight) const {
+    double count = (double)(bottomRight.x - topLeft.x) * (bottomRight.y - topLeft.y) * (bottomRight.z - topLeft.z);
+    if (count <= 0) {
+        return 0.0;
+    }
+    cv::Vec3d values = cuboid_sum(volumeSum, topLeft, bottomRight);
+    cv::Vec3d squares = cuboid_sum(volumeSqSum, topLeft, bottomRight);
+    double variance = 0.0;
+    for (int c = 0; c < 3; ++c) {
+        variance += std::max(0.0, count * squares[c] - values[c] * values[c]) / (count * count);
+    }
+    return variance / 3.0;
+}
+
+void GermsPositioningOctree::divide_volume(const cv::Point3i &topLeft, const cv::Point3i &bottomRight, int iterationLimit,
+                                           int iterationCounter, std::vector<cv::Point3i> &seeds) const {
+    RG_COUNT(QuadtreeNodes, 1);
+    double variance = region_variance(topLeft, bottomRight);
+    double voxels = (double)(bottomRight.x - topLeft.x) * (bottomRight.y - topLeft.y) * (bottomRight.z - topLeft.z);
+    bool split = criteria.variance_criterion(variance, 110.0) && criteria.iteration_criterion(iterationLimit, iterationCounter) &&
+                 voxels >= 30 && bottomRight.x - topLeft.x > 1 && bottomRight.y - topLeft.y > 1;
+
+    if (!split || !criteria.iteration_criterion(iterationLimit, iterationCounter + 1)) {
+        seeds.emplace_back((topLeft.x + bottomRight.x) / 2, (topLeft.y + bottomRight.y) / 2, (topLeft.z + bottomRight.z) / 2);
+        return;
+    }
+
+    cv::Point3i mid((topLeft.x + bottomRight.x) / 2, (topLeft.y + bottomRight.y) / 2, (topLeft.z + bottomRight.z) / 2);
+    // A single slice is only split in x and y
+    int zHalves = (bottomRight.z - topLeft.z > 1) ? 2 : 1;
+    for (int hz = 0; hz < zHalves; ++hz) {
+        for (int hy = 0; hy < 2; ++hy) {
+            for (int hx = 0; hx < 2; ++hx) {
+                cv::Point3i childTopLeft(hx ? mid.x : topLeft.x, hy ? mid.y : topLeft.y,
+                                         zHalves == 1 ? topLeft.z : (hz ? mid.z : topLeft.z));
+                cv::Point3i childBottomRight(hx ? bottomRight.x : mid.x, hy ? bottomRight.y : mid.y,
+                                             zHalves == 1 ? bottomRight.z : (hz ? bottomRight.z : mid.z));
+                divide_volume(childTopLeft, childBottomRight, iterationLimit, iterationCounter + 1, seeds);
+            }
+        }
+    }
+}
+
+void GermsPositioningOctree::position_germs(const std::vector<cv::Mat> &hsvSlices, int maxDivision, std::vector<cv::Point3i> &seeds) {
+    if (hsvSlices.empty()) {
+        return;
+    }
+    set_slices(hsvSlices);
+    divide_volume(cv::Point3i(0, 0, 0), cv::Point3i(hsvSlices[0].cols, hsvSlices[0].rows, (int)hsvSlices.size()),
+                  maxDivision, 1, seeds);
+}
@@ -1,106 +1,468 @@
 #pragma once
 
+#include <algorithm>
 #include <random>
 #include <cstdlib>
-#include <unordered_map>
-#include <unordered_set>
-#include <list>
 #include <vector>
-#include<queue>
 
 #include "opencv2/imgcodecs.hpp"
 #include "opencv2/imgproc.hpp"
 
+#include "RegionTable.hpp"
+#include "SegmentationContext.hpp"
+#include "GrowthPolicies.hpp"
+#include "NeighborKernel.hpp"
+#include "ThreadPool.hpp"
+#include "Instrumentation.hpp"
+
 std::mt19937 generator{ std::random_device{}() };
 
-class GrowAndMerge {
+// Queue: breadth-first growth, pixel by pixel. Span: scanline fill of horizontal runs. Both grow
+// the same connected pixel sets, see BasicGrowAndMerge::grow_spans()
+enum class GrowthEngine { Queue, Span };
+
+// Greedy: two regions are tested, and merged, whenever a growing pixel meets the other one. Graph: growing
+// only records the region contacts, merged afterwards by increasing distance of their means, see merge_graph()
+enum class MergeStrategy { Greedy, Graph };
+
+/**
+ * @brief Region growing and merging, specialized at compile time on a homogeneity predicate and a
+ * connectivity, see GrowthPolicies.hpp. GrowAndMerge is the HSV interval, 8-connected instance.
+ */
+template <class Predicate, class Connectivity>
+class BasicGrowAndMerge {
+public:
+    // Same type for every predicate and connectivity
+    using Engine = GrowthEngine;
+
+    // Outer contour of a region: Freeman codes (0 = east, 1 = north-east, ... counterclockwise) from start
+    struct Contour {
+        int region;
+        cv::Point start;
+        std::vector<uchar> codes;
+    };
+
 private:
+    using Span = SegmentationContext::Span;
+
+    using Scratch = SegmentationContext::Scratch;
 
-    using region_type = std::pair<std::list<cv::Point>, std::vector<cv::Scalar>>;
-    using region_container = std::unordered_map<int, region_type>;
+    // Region IDs are dense: 0 is the unlabeled background, seed i owns ID i+1
+    using region_container = RegionTable;
 
     region_container regions;
 
+    // Label image of the last run, holding root region IDs
+    cv::Mat labels;
+
     int numSeeds = 10;
 
+    // Tile-parallel growing is enabled when the tile size is not empty
+    cv::Size tileSize = cv::Size(0, 0);
+
+    ThreadPool *threadPool = nullptr; // nullptr: ThreadPool::shared()
+
+    SegmentationContext ownContext;
+    SegmentationContext *context = nullptr; // nullptr: ownContext
+
+    NeighborKernel neighborKernel;
+
+    Engine engine = Engine::Queue;
+
+    MergeStrategy mergeStrategy = MergeStrategy::Greedy;
+
+    // Gives every unlabeled pixel left by the seeds to an adjacent region, see fill_gaps()
+    bool fillGaps = false;
+
+    // rg_seg() and rg_seg_roi() print no coverage line on std::cout
+    bool quiet = false;
+
+    // Set from begin_bands() to region_roots(): the colors handed out stay in use, listed here, so that
+    // the regions of different bands never share a color
+    bool holdColors = false;
+    std::vector<int> heldColors;
+
+    // Feature plane given by set_features() for the next call, empty: converted from the image
+    cv::Mat sharedFeatures;
+
+    // Set during rg_seg_update(): regions alive before the update win every merge they take part in
+    std::vector<char> carriedRegions;
+
+    // Colors of the carried regions, kept in use while rg_seg_update() hands out the colors of its seeds
+    std::vector<int> carriedColors;
+
+    // Position of the grown buffer in the whole image, not null while growing a band of grow_band()
+    cv::Point origin = cv::Point(0, 0);
+
+    // Set during rg_seg_roi(): CV_8U plane of the buffer size, non-zero where pixels may be labeled
+    cv::Mat roiMask;
+
+    // Set during seg(), up to flatten_labels(): generation stamps of the label plane and the generation of the call,
+    // see SegmentationContext. The labels of the other pixels are left by earlier calls and read as 0
+    cv::Mat stamps;
+    uint16_t stamp = 0;
+
+    // Part of the image the label plane covers: the whole image, or the ROI bounding box after rg_seg_roi()
+    cv::Rect labelArea;
+
     // O(1)
     int bgr_to_hex(cv::Vec3b const&);
 
     cv::Vec3b hex_to_bgr(int);
 
-    // O(1)
-    std::pair<cv::Scalar, cv::Scalar> interval_bounds(cv::Scalar const&);
+    // O(1) - pixel test of the predicate, on the NeighborKernel for interval predicates
+    bool accepts(cv::Vec4b const&, cv::Vec4b const&, cv::Vec4b const&) const;
 
-    // O(1)
-    bool predicate(cv::Scalar const&, cv::Scalar const&, cv::Scalar const&);
+    // O(1) - false for the pixels out of the mask of rg_seg_roi()
+    bool in_roi(int, int) const;
 
-    // O(1)
-    void update_mean(region_type &, cv::Scalar const&);
+    // O(1) - label of the pixel (x, y), 0 when an earlier call wrote it
+    int label_at(cv::Mat const&, int, int) const;
+
+    // O(1) - labels the pixel (x, y) for the current call
+    void set_label(cv::Mat &, int, int, int);
+
+    // O(1) - merge test: the mean of each region against the words of the other, the first one given
+    bool mergeable(region_container const&, int, cv::Vec4b const&, cv::Vec4b const&, int) const;
 
     // O(1)
-    cv::Scalar componentwise_min(cv::Scalar const&, cv::Scalar const&);
+    void update_mean(region_container &, int, cv::Point const&, cv::Vec4b const&);
+
+    // O(α(n))
+    void merge(region_container &, int &, int &);
+
+    // O(regions + pixels)
+    void flatten_labels(region_container &, cv::Mat &);
 
-    cv::Scalar componentwise_max(cv::Scalar const&, cv::Scalar const&);
+    // O(1) - appends the pair to the contacts of the thread, unless it is the last one recorded
+    void record_contact(Scratch &, int, int);
 
-    void update_buffer(cv::Mat &, std::list<cv::Point> const&, int);
+    // O(edges log(edges)) - merge stage of MergeStrategy::Graph over the contacts of every thread
+    void merge_graph(region_container &);
 
-    // O(min(size1, size2))
-    void merge(region_container &, cv::Mat &, int &, int &);
+    // O(1) - squared distance between the means of two regions
+    static double mean_distance(region_container const&, int, int);
+
+    // O(1) - labeled neighbor region of the pixel whose mean is the closest to its value, the first one on ties
+    int closest_region(cv::Mat const&, cv::Mat const&, cv::Rect const&, cv::Point const&,
+                       std::vector<cv::Vec3f> const&) const;
+
+    // O(pixels) - labels the pixels reachable from a region through unlabeled pixels, see the definition
+    void fill_gaps(region_container &, cv::Mat const&, cv::Mat &);
 
     // O(1)
-    void process(region_container &, std::vector<cv::Mat> const&, cv::Mat &, std::queue<cv::Point> &, cv::Point const&, int &);
+    void process(region_container &, cv::Mat const&, cv::Mat &, Scratch &, cv::Point const&,
+                 cv::Rect const&, int &);
+
+    void growing(region_container &, cv::Mat const&, cv::Mat &, cv::Point const&, cv::Rect const&, int);
+
+    // O(pixels claimed) - claims the pixel for the region, whose bounds are set, and grows it from there
+    void grow_from(region_container &, cv::Mat const&, cv::Mat &, cv::Point const&, cv::Rect const&, int);
+
+    void grow_queue(region_container &, cv::Mat const&, cv::Mat &, Scratch &, cv::Point const&, cv::Rect const&, int);
+
+    // O(1) - merge test (or contact) of the current region against a labeled neighbor, same as in process()
+    void touch(region_container &, Scratch &, int &, int);
+
+    // O(run length) - claims the accepted unlabeled pixels left and right of (x, y)
+    Span fill_span(region_container &, cv::Mat const&, cv::Mat &, int, int, cv::Rect const&, int);
+
+    void grow_spans(region_container &, cv::Mat const&, cv::Mat &, Scratch &, cv::Rect const&, int, Span);
+
+    void grow_tiles(region_container &, cv::Mat const&, cv::Mat &, std::vector<cv::Point> const&);
+
+    // O(1) - part of the buffer covered by the tile
+    cv::Rect tile_area(int, int, cv::Size) const;
 
-    void growing(region_container &, std::vector<cv::Mat> const&, cv::Mat &, cv::Point const&, int);
+    // O(α(n))
+    void stitch_pair(region_container &, Scratch &, int, int);
 
-    std::vector<int> generate_random_unique_BGR(size_t);
+    // O(tile border length / threads + label pairs across the borders)
+    void stitch_tiles(region_container &, cv::Mat const&, int, int);
+
+    // O(rounds * tile border length / threads + pixels claimed / threads) - grows the regions on across the
+    // tile borders, each tile within itself
+    void grow_across_tiles(region_container &, cv::Mat const&, cv::Mat &, int, int);
+
+    void generate_random_unique_BGR(size_t, std::vector<int> &);
 
     uchar check_bounds(uchar);
 
-    std::vector<int> generate_unique_BGR(cv::Mat const&, std::vector<cv::Point> const&);
+    void generate_unique_BGR(cv::Mat const&, std::vector<cv::Point> const&, std::vector<int> &);
+
+    // O(colors) - frees the colors just handed out, or holds them until region_roots() between bands
+    void end_colors(std::vector<int> const&);
+
+    // O(held colors)
+    void release_held_colors();
+
+    // Feature plane of the image (set_features(), or converted into the context), packed for the NeighborKernel
+    void pack_features(cv::Mat const&, cv::Mat &);
+
+    // O(regions) - BGR color of every region ID
+    void build_palette(region_container const&, std::vector<cv::Vec3b> &);
+
+    // Rows per task of the row-parallel passes over a buffer of the given width
+    static int row_grain(int);
 
-    void fill_mask(cv::Mat const&, cv::Mat &);
+    // O(cols) - flags[j] set when pixel j of row i has a 4-neighbor with another label
+    static void edge_row(cv::Mat const&, int, uchar*);
 
-    bool is_edge(cv::Mat const&, cv::Point const&);
+    // O(contour length)
+    static void trace_contour(cv::Mat const&, Contour &);
 
-    void edge_mask(cv::Mat const&, cv::Mat &);
+    // O(pixels / threads)
+    void fill_mask(region_container const&, cv::Mat const&, cv::Mat &);
+
+    // O(pixels / threads)
+    void edge_mask(region_container const&, cv::Mat const&, cv::Mat &);
 
     double coverage(region_container const&, uint32_t, uint32_t);
 
     void seg(cv::Mat const&, cv::Mat &, std::vector<cv::Point> const&, region_container &, bool randColorization);
 
+    void update(cv::Mat const&, cv::Mat &, cv::Mat const&, std::vector<cv::Point> const&, region_container &,
+                bool randColorization);
+
+    // Segments the area of the image only, within the CV_8U mask of the area size when it is not empty
+    void seg_roi(cv::Mat const&, cv::Mat &, cv::Rect const&, cv::Mat const&, std::vector<cv::Point> const&,
+                 bool randColorization, bool onlyEdge);
+
 public:
     const region_container& get_regions() const;
 
     void set_regions(const region_container&);
 
+    const cv::Mat& get_labels() const;
+
+    // Part of the image covered by get_labels(): the whole image, or the bounding box of the ROI after rg_seg_roi()
+    cv::Rect get_label_area() const;
+
+    // O(bounding box area)
+    void region_pixels(int, std::vector<cv::Point> &) const;
+
     int get_num_seeds() const; // getter method
 
     void set_num_seeds(int); // setter method
 
+    cv::Size get_tile_size() const;
+
+    void set_tile_size(cv::Size);
+
+    ThreadPool &get_thread_pool();
+
+    void set_thread_pool(ThreadPool &);
+
+    SegmentationContext &get_context();
+
+    // The context keeps the scratch buffers and the label plane between calls, see SegmentationContext
+    void set_context(SegmentationContext &);
+
+    NeighborKernel::Isa get_neighbor_isa() const;
+
+    void set_neighbor_isa(NeighborKernel::Isa);
+
+    Engine get_growth_engine() const;
+
+    void set_growth_engine(Engine);
+
+    MergeStrategy get_merge_strategy() const;
+
+    void set_merge_strategy(MergeStrategy);
+
+    // Feature plane of the image of the next call, as Predicate::convert computes it (for GrowAndMerge,
+    // ImageProcessor::get_image_hsv()), so that the image is not converted again. Kept without a copy,
+    // used by the next call only
+    void set_features(cv::Mat const&);
+
+    bool get_fill_gaps() const;
+
+    // Once the regions are merged, rg_seg() and rg_seg_update() give every unlabeled pixel to its most
+    // similar adjacent region, for a full coverage in a single run
+    void set_fill_gaps(bool);
+
+    bool get_quiet() const;
+
+    // Library users that own std::cout (the daemon, the benchmark) turn the coverage line off
+    void set_quiet(bool);
+
     void rg_seg(cv::Mat const&, cv::Mat &, std::vector<cv::Point> &, bool randColorization=true, bool onlyEdge=false);
+
+    // Re-segments only the pixels flagged in the CV_8U dirty mask, growing them from the given seeds and
+    // keeping the IDs and colors of the previous run elsewhere. Falls back to rg_seg() without a previous run.
+    void rg_seg_update(cv::Mat const&, cv::Mat &, cv::Mat const&, std::vector<cv::Point> &,
+                       bool randColorization=true, bool onlyEdge=false);
+
+    // Segments only the non-zero pixels of the CV_8U ROI mask (image size). Seeds out of the mask are skipped,
+    // regions never grow out of it, and the label plane, the feature planes and the rendering are sized to the
+    // bounding box of the mask (see get_label_area()); the pixels of dst out of the mask are left untouched,
+    // dst is zeroed first only when it does not have the image size and type
+    void rg_seg_roi(cv::Mat const&, cv::Mat &, cv::Mat const&, std::vector<cv::Point> &,
+                    bool randColorization=true, bool onlyEdge=false);
+
+    // Same over a list of rectangles, a mask of their bounding box being built only when there are several
+    void rg_seg_roi(cv::Mat const&, cv::Mat &, std::vector<cv::Rect> const&, std::vector<cv::Point> &,
+                    bool randColorization=true, bool onlyEdge=false);
+
+    // Coarse-to-fine refinement of the segmentation of another instance, run on src reduced `levels` times by
+    // cv::pyrDown: its labels are upsampled to src, the pixels of the coarse blocks within `margin` coarse pixels of
+    // a region boundary are unlabeled, and the regions grow back into them at full resolution with the same
+    // predicate. Regions are not merged again, the coarse run decided it. Returns the number of pixels unlabeled.
+    size_t rg_seg_refine(cv::Mat const&, cv::Mat &, BasicGrowAndMerge const&, int levels, int margin=1, bool onlyEdge=false);
+
+    // O(pixels) - renders the last segmentation again into a CV_8UC3 mask of the image size
+    void render_mask(cv::Mat &, bool onlyEdge=false);
+
+    // O(pixels) - labeled pixels drawn by render_mask(mask, true), in raster order, without rendering
+    void boundary_pixels(std::vector<cv::Point> &);
+
+    // O(pixels) - outer contour of every region of the last segmentation, by increasing region ID. A region
+    // split by rg_seg_update() only gets the contour of the part holding its first pixel in raster order.
+    void chain_codes(std::vector<Contour> &);
+
+    // Band by band segmentation of an image that does not fit in memory: begin_bands() empties the region
+    // table, then every grow_band() call grows the seeds of one band (BGR, band coordinates) into its CV_32S
+    // labels and stitches them to the last label row of the band above. The labels of a band are only
+    // provisional: later stitches can still merge their regions, region_roots() gives the final IDs. The
+    // regions of all the bands get different colors until region_roots() ends the image.
+    void begin_bands();
+
+    void grow_band(cv::Mat const&, int, cv::Mat &, std::vector<cv::Point> const&, cv::Mat const&,
+                   bool randColorization=true);
+
+    // O(regions + colors of the bands) - root ID of every region ID
+    void region_roots(std::vector<int> &);
 };
 
-const GrowAndMerge::region_container& GrowAndMerge::get_regions() const {
+using GrowAndMerge = BasicGrowAndMerge<HsvIntervalPredicate, EightConnected>;
+
+template <class Predicate, class Connectivity>
+const RegionTable& BasicGrowAndMerge<Predicate, Connectivity>::get_regions() const {
     return regions;
 }
 
-void GrowAndMerge::set_regions(const GrowAndMerge::region_container& regions) {
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_regions(const RegionTable& regions) {
     this->regions = regions;
 }
 
-int GrowAndMerge::get_num_seeds() const {
+template <class Predicate, class Connectivity>
+const cv::Mat& BasicGrowAndMerge<Predicate, Connectivity>::get_labels() const {
+    return labels;
+}
+
+template <class Predicate, class Connectivity>
+cv::Rect BasicGrowAndMerge<Predicate, Connectivity>::get_label_area() const {
+    return labelArea;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::region_pixels(int key, std::vector<cv::Point> & pixels) const {
+    regions.region_pixels(labels, key, pixels);
+}
+
+template <class Predicate, class Connectivity>
+int BasicGrowAndMerge<Predicate, Connectivity>::get_num_seeds() const {
     return numSeeds;
 }
 
-void GrowAndMerge::set_num_seeds(int seeds) {
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_num_seeds(int seeds) {
     numSeeds = seeds;
 }
 
-int GrowAndMerge::bgr_to_hex(cv::Vec3b const& bgr) {
+template <class Predicate, class Connectivity>
+cv::Size BasicGrowAndMerge<Predicate, Connectivity>::get_tile_size() const {
+    return tileSize;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_tile_size(cv::Size size) {
+    tileSize = size;
+}
+
+template <class Predicate, class Connectivity>
+ThreadPool &BasicGrowAndMerge<Predicate, Connectivity>::get_thread_pool() {
+    return threadPool ? *threadPool : ThreadPool::shared();
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_thread_pool(ThreadPool &pool) {
+    threadPool = &pool;
+}
+
+template <class Predicate, class Connectivity>
+SegmentationContext &BasicGrowAndMerge<Predicate, Connectivity>::get_context() {
+    return context ? *context : ownContext;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_context(SegmentationContext &value) {
+    context = &value;
+}
+
+template <class Predicate, class Connectivity>
+NeighborKernel::Isa BasicGrowAndMerge<Predicate, Connectivity>::get_neighbor_isa() const {
+    return neighborKernel.get_isa();
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_neighbor_isa(NeighborKernel::Isa isa) {
+    neighborKernel.set_isa(isa);
+}
+
+template <class Predicate, class Connectivity>
+GrowthEngine BasicGrowAndMerge<Predicate, Connectivity>::get_growth_engine() const {
+    return engine;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_growth_engine(Engine value) {
+    engine = value;
+}
+
+template <class Predicate, class Connectivity>
+MergeStrategy BasicGrowAndMerge<Predicate, Connectivity>::get_merge_strategy() const {
+    return mergeStrategy;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_merge_strategy(MergeStrategy value) {
+    mergeStrategy = value;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_features(cv::Mat const& features) {
+    sharedFeatures = features;
+}
+
+template <class Predicate, class Connectivity>
+bool BasicGrowAndMerge<Predicate, Connectivity>::get_fill_gaps() const {
+    return fillGaps;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_fill_gaps(bool value) {
+    fillGaps = value;
+}
+
+template <class Predicate, class Connectivity>
+bool BasicGrowAndMerge<Predicate, Connectivity>::get_quiet() const {
+    return quiet;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_quiet(bool value) {
+    quiet = value;
+}
+
+template <class Predicate, class Connectivity>
+int BasicGrowAndMerge<Predicate, Connectivity>::bgr_to_hex(cv::Vec3b const& bgr) {
     return (bgr[2] << 16) | (bgr[1] << 8) | bgr[0];
 }
 
-cv::Vec3b GrowAndMerge::hex_to_bgr(int hexValue) {
+template <class Predicate, class Connectivity>
+cv::Vec3b BasicGrowAndMerge<Predicate, Connectivity>::hex_to_bgr(int hexValue) {
     uchar blue = hexValue & 0xFF;
     uchar green = (hexValue >> 8) & 0xFF;
     uchar red = (hexValue >> 16) & 0xFF;
@@ -108,132 +470,326 @@ cv::Vec3b GrowAndMerge::hex_to_bgr(int hexValue) {
     return {blue, green, red};
 }
 
-std::pair<cv::Scalar, cv::Scalar> GrowAndMerge::interval_bounds(cv::Scalar const& hsv) {
-    double th;
-    if (hsv[2] <= 25) { // Black
-        th = 30;
-        double lowerv = ((hsv[2] - th) < 0) ? 0 : hsv[2] - th;
-        double upperv = hsv[2] + th;
-        return std::make_pair(cv::Scalar(0, 0, lowerv), cv::Scalar(180, 255, upperv));
-    } else if (hsv[1] <= 70) {
-        if (hsv[2] <= 175) { // Gray
-            th = 40;
-            double lowerv = hsv[2] - th;
-            double upperv = hsv[2] + th;
-            return std::make_pair(cv::Scalar(0, 0, lowerv), cv::Scalar(180, 45, upperv));
-        } else { // White
-            th = 40;
-            double lowerv = hsv[2] - th;
-            double upperv = ((hsv[2] + th) > 255) ? 255 : hsv[2] + th;
-            return std::make_pair(cv::Scalar(0, 0, lowerv), cv::Scalar(180, 70, upperv));
-        }
-    }
-    th = 10;
-    double lowerh = (hsv[0] - th < 0) ? 0 : hsv[0] - th;
-    double upperh = (hsv[0] + th > 180) ? 180 : hsv[0] + th;
-    return std::make_pair(cv::Scalar(lowerh, 70, 50), cv::Scalar(upperh, 255, 255));
-}
-
-bool GrowAndMerge::predicate(cv::Scalar const& lowerb, cv::Scalar const& upperb, cv::Scalar const& value) {
-    // lowerb <= value <= upperb
-    return  value[0] >= lowerb[0] && value[0] <= upperb[0] &&
-            value[1] >= lowerb[1] && value[1] <= upperb[1] &&
-            value[2] >= lowerb[2] && value[2] <= upperb[2];
-}
-
-void GrowAndMerge::update_mean(region_type & region, cv::Scalar const& addedValue) {
-    cv::Scalar oldMean = region.second[2];
-    int size = (int)region.first.size();
-    cv::Scalar newMean = (oldMean * size + addedValue) / (size + 1);
-    region.second[2] = newMean;
-}
-
-cv::Scalar GrowAndMerge::componentwise_min(cv::Scalar const& sa, cv::Scalar const& sb) {
-    cv::Scalar ret;
-    ret[0] = std::min(sa[0], sb[0]);
-    ret[1] = std::min(sa[1], sb[1]);
-    ret[2] = std::min(sa[2], sb[2]);
-    return ret;
-}
-
-cv::Scalar GrowAndMerge::componentwise_max(cv::Scalar const& sa, cv::Scalar const& sb) {
-    cv::Scalar ret;
-    ret[0] = std::max(sa[0], sb[0]);
-    ret[1] = std::max(sa[1], sb[1]);
-    ret[2] = std::max(sa[2], sb[2]);
-    return ret;
-}
-
-void GrowAndMerge::update_buffer(cv::Mat & buffer, std::list<cv::Point> const& points, int newValue) {
-    for (auto const& point : points) {
-
-        buffer.at<int>(point) = newValue;
-    }
-}
-
-void GrowAndMerge::merge(region_container & regions, cv::Mat & buffer, int & r1Key, int & r2Key) {
-    std::vector<cv::Scalar> hsv1 = regions[r1Key].second;
-    std::vector<cv::Scalar> hsv2 = regions[r2Key].second;
-    std::vector<cv::Scalar> hsv(3, 0);
-    hsv[0] = componentwise_min(hsv1[0], hsv2[0]);
-    hsv[1] = componentwise_max(hsv1[1], hsv2[1]);
-
-    int size1 = (int)regions[r1Key].first.size();
-    int size2 = (int)regions[r2Key].first.size();
-    hsv[2] = (hsv1[2]*size1 + hsv2[2]*size2) / (size1 + size2);
-
-    if (size1 < size2) {
-        update_buffer(buffer, regions[r1Key].first, r2Key);
-        regions[r2Key].first.splice(
-                regions[r2Key].first.end(), regions[r1Key].first);
-        regions.erase(regions.find(r1Key));
-        regions[r2Key].second = hsv;
-        r1Key = r2Key;
-    } else { // R2 is smaller than R1
-        update_buffer(buffer, regions[r2Key].first, r1Key);
-        regions[r1Key].first.splice(
-                regions[r1Key].first.end(), regions[r2Key].first);
-        regions.erase(regions.find(r2Key));
-        regions[r1Key].second = hsv;
-        r2Key = r1Key;
-    }
-}
-
-void GrowAndMerge::process(region_container & regions, std::vector<cv::Mat> const& hsvChannels,
-             cv::Mat & buffer, std::queue<cv::Point> & queue, cv::Point const& current, int & currentKey) {
-    cv::Scalar lowerb = regions[currentKey].second[0];
-    cv::Scalar upperb = regions[currentKey].second[1];
-
-    for (int i = -1; i <= 1; ++i) {
-        for (int j = -1; j <= 1; ++j) {
-            if (i != 0 || j != 0) {
-                cv::Point neighbor(current.x + i, current.y + j);
-                if (neighbor.x >= 0 && neighbor.x < hsvChannels[0].cols &&
-                    neighbor.y >= 0 && neighbor.y < hsvChannels[0].rows) {
-                    int neighborKey = buffer.at<int>(neighbor);
-                    if (neighborKey == 0) {
-                        auto neighborH = (double) hsvChannels[0].at<uchar>(neighbor);
-                        auto neighborS = (double) hsvChannels[1].at<uchar>(neighbor);
-                        auto neighborV = (double) hsvChannels[2].at<uchar>(neighbor);
-                        cv::Scalar hsvNeighbor(neighborH, neighborS, neighborV);
-
-                        if (predicate(lowerb, upperb, hsvNeighbor)) {
-                            buffer.at<int>(neighbor) = currentKey;
-                            update_mean(regions[currentKey], hsvNeighbor);
-                            regions[currentKey].first.push_back(neighbor);
-                            queue.push(neighbor);
-                        }
-                    } else if (currentKey != neighborKey) {
-                        std::vector<cv::Scalar> hsvNeighborRegion =
-                                regions[neighborKey].second;
-                        cv::Scalar currentRegionHsvMean =
-                                regions[currentKey].second[2];
-                        if (predicate(lowerb, upperb, hsvNeighborRegion[2]) &&
-                            predicate(hsvNeighborRegion[0], hsvNeighborRegion[1], currentRegionHsvMean)) {
-                            merge(regions, buffer, currentKey, neighborKey);
-                        } else {
-                            std::cout << "";
-                        }
+template <class Predicate, class Connectivity>
+bool BasicGrowAndMerge<Predicate, Connectivity>::accepts(cv::Vec4b const& lowerb, cv::Vec4b const& upperb, cv::Vec4b const& value) const {
+    if constexpr (Predicate::interval) {
+        return neighborKernel.contains(lowerb, upperb, value);
+    } else {
+        RG_COUNT(PredicateEvaluations, 1);
+        return Predicate::accepts(lowerb, upperb, value);
+    }
+}
+
+template <class Predicate, class Connectivity>
+bool BasicGrowAndMerge<Predicate, Connectivity>::in_roi(int x, int y) const {
+    return !roiMask.data || roiMask.ptr<uchar>(y)[x];
+}
+
+template <class Predicate, class Connectivity>
+int BasicGrowAndMerge<Predicate, Connectivity>::label_at(cv::Mat const& buffer, int x, int y) const {
+    return (!stamps.data || stamps.ptr<uint16_t>(y)[x] == stamp) ? buffer.ptr<int>(y)[x] : 0;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::set_label(cv::Mat & buffer, int x, int y, int label) {
+    buffer.ptr<int>(y)[x] = label;
+    if (stamps.data) {
+        stamps.ptr<uint16_t>(y)[x] = stamp;
+    }
+}
+
+template <class Predicate, class Connectivity>
+bool BasicGrowAndMerge<Predicate, Connectivity>::mergeable(region_container const& regions, int key1, cv::Vec4b const& lowerb1,
+                             cv::Vec4b const& upperb1, int key2) const {
+    uint64_t sum1[3], sum2[3];
+    for (int c = 0; c < 3; ++c) {
+        sum1[c] = regions.get_sum(key1, c);
+        sum2[c] = regions.get_sum(key2, c);
+    }
+    return Predicate::accepts_mean(lowerb1, upperb1, sum2, regions.get_pixel_count(key2)) &&
+           Predicate::accepts_mean(regions.get_packed_lower_bound(key2), regions.get_packed_upper_bound(key2),
+                                   sum1, regions.get_pixel_count(key1));
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::update_mean(region_container & regions, int key, cv::Point const& pixel, cv::Vec4b const& addedValue) {
+    // The mean is derived from the running integer sums, see RegionTable::get_mean
+    regions.add_pixel(key, pixel + origin, addedValue);
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::merge(region_container & regions, int & r1Key, int & r2Key) {
+    // The buffer is left untouched: the absorbed ID now resolves to the survivor through
+    // the region table, and flatten_labels() rewrites every pixel once at the end.
+    int survivorKey;
+    int root1 = regions.find(r1Key);
+    int root2 = regions.find(r2Key);
+    cv::Vec4b lowerb1 = regions.get_packed_lower_bound(root1), upperb1 = regions.get_packed_upper_bound(root1);
+    cv::Vec4b lowerb2 = regions.get_packed_lower_bound(root2), upperb2 = regions.get_packed_upper_bound(root2);
+    if (!carriedRegions.empty() && carriedRegions[root1] && carriedRegions[root2]) {
+        // Two regions kept apart by the previous frames stay apart, otherwise pixels far from
+        // the change would switch IDs
+        return;
+    } else if (!carriedRegions.empty() && carriedRegions[root2] && !carriedRegions[root1]) {
+        survivorKey = regions.merge_into(root2, root1);
+    } else if (!carriedRegions.empty() && carriedRegions[root1] && !carriedRegions[root2]) {
+        survivorKey = regions.merge_into(root1, root2);
+    } else {
+        survivorKey = regions.merge(root1, root2);
+    }
+    if constexpr (!Predicate::interval) {
+        // The table keeps the union of the two intervals, which means nothing here
+        if (survivorKey == root1) {
+            regions.set_packed_bounds(survivorKey, lowerb1, upperb1);
+        } else {
+            regions.set_packed_bounds(survivorKey, lowerb2, upperb2);
+        }
+    }
+    RG_COUNT(MergesPerformed, 1);
+    r1Key = survivorKey;
+    r2Key = survivorKey;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::flatten_labels(region_container & regions, cv::Mat & buffer) {
+    RG_TRACE("flatten_labels");
+    // Resolve every ID to its root once, then the pixel pass is a plain lookup
+    std::vector<int> &root = get_context().get_roots();
+    root.assign(regions.size(), 0);
+    for (int id = 1; id < (int)regions.size(); ++id) {
+        root[id] = regions.find(id);
+    }
+
+    // The labels of earlier calls are zeroed on the way: the plane left holds current labels only
+    for (int i = 0; i < buffer.rows; ++i) {
+        int* row = buffer.ptr<int>(i);
+        const uint16_t* stampRow = stamps.data ? stamps.ptr<uint16_t>(i) : nullptr;
+        for (int j = 0; j < buffer.cols; ++j) {
+            int label = (!stampRow || stampRow[j] == stamp) ? row[j] : 0;
+            RG_COUNT(PixelsRelabeled, label != root[label]);
+            row[j] = root[label];
+        }
+    }
+    stamps.release();
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::record_contact(Scratch & scratch, int key1, int key2) {
+    // Along a shared border the same pair comes back pixel after pixel, build() drops the other repeats
+    uint64_t edge = RegionGraph::pack(key1, key2);
+    if (scratch.contacts.empty() || scratch.contacts.back() != edge) {
+        RG_COUNT(ContactsRecorded, 1);
+        scratch.contacts.push_back(edge);
+    }
+}
+
+template <class Predicate, class Connectivity>
+double BasicGrowAndMerge<Predicate, Connectivity>::mean_distance(region_container const& regions, int key1, int key2) {
+    cv::Scalar mean1 = regions.get_mean(key1), mean2 = regions.get_mean(key2);
+    double distance = 0;
+    for (int c = 0; c < 3; ++c) {
+        distance += (mean1[c] - mean2[c]) * (mean1[c] - mean2[c]);
+    }
+    return distance;
+}
+
+/**
+ * @brief Merge stage of MergeStrategy::Graph.
+ *
+ * Each adjacent region pair is tested once with the merge test of the greedy strategy, the
+ * closest means first, instead of once per pixel of their shared border in the order the seeds
+ * happened to grow. A merge moves the mean of the survivor: its pending candidates are outdated
+ * by the stamp and evaluated again at their new distance when they come out of the queue.
+ */
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::merge_graph(region_container & regions) {
+    RG_TRACE("merge_graph");
+    SegmentationContext &ctx = get_context();
+    RegionGraph &graph = ctx.get_graph();
+    graph.clear(regions.size());
+    ctx.gather_contacts(graph);
+    ctx.clear_contacts();
+    graph.build();
+
+    for (uint64_t edge : graph.get_edges()) {
+        int key1 = regions.find(RegionGraph::first(edge));
+        int key2 = regions.find(RegionGraph::second(edge));
+        if (key1 != key2) {
+            graph.push({mean_distance(regions, key1, key2), std::min(key1, key2), std::max(key1, key2), 0, 0});
+        }
+    }
+
+    while (!graph.empty()) {
+        RegionGraph::Candidate candidate = graph.pop();
+        int key1 = regions.find(candidate.region1);
+        int key2 = regions.find(candidate.region2);
+        if (key1 == key2) {
+            continue;
+        }
+        if (key1 != candidate.region1 || key2 != candidate.region2 ||
+            graph.get_stamp(key1) != candidate.stamp1 || graph.get_stamp(key2) != candidate.stamp2) {
+            int low = std::min(key1, key2), high = std::max(key1, key2);
+            graph.push({mean_distance(regions, low, high), low, high, graph.get_stamp(low), graph.get_stamp(high)});
+            continue;
+        }
+        if (!carriedRegions.empty() && carriedRegions[key1] && carriedRegions[key2]) {
+            continue;
+        }
+
+        RG_COUNT(MergesAttempted, 1);
+        if (mergeable(regions, key1, regions.get_packed_lower_bound(key1), regions.get_packed_upper_bound(key1), key2)) {
+            merge(regions, key1, key2);
+            graph.bump(key1);
+        }
+    }
+}
+
+template <class Predicate, class Connectivity>
+int BasicGrowAndMerge<Predicate, Connectivity>::closest_region(cv::Mat const& buffer, cv::Mat const& packed, cv::Rect const& area,
+                                                               cv::Point const& pixel, std::vector<cv::Vec3f> const& means) const {
+    cv::Vec4b const& value = packed.at<cv::Vec4b>(pixel);
+    int closest = 0;
+    float closestDistance = 0;
+    for (int n = 0; n < Connectivity::size; ++n) {
+        cv::Point neighbor(pixel.x + Connectivity::dx[n], pixel.y + Connectivity::dy[n]);
+        if (!area.contains(neighbor)) {
+            continue;
+        }
+        // Unlabeled (0) and queued (-1) neighbors are skipped
+        int key = buffer.at<int>(neighbor);
+        if (key > 0 && key != closest) {
+            float distance = 0;
+            for (int c = 0; c < 3; ++c) {
+                float d = (float)value[c] - means[key][c];
+                distance += d * d;
+            }
+            if (closest == 0 || distance < closestDistance) {
+                closest = key;
+                closestDistance = distance;
+            }
+        }
+    }
+    return closest;
+}
+
+/**
+ * @brief Multi-source breadth-first fill of the pixels no seed reached.
+ *
+ * The first layer is every unlabeled pixel next to a labeled one, found row-parallel; each
+ * following layer is the unlabeled neighbors of the previous one, so every pixel is queued once.
+ * Within a layer each pixel picks, among its labeled neighbors, the region whose mean is the
+ * closest to its value. The means are the ones of the grown regions and the picks of a layer are
+ * written after all of them are made, so the choices run in parallel and do not depend on the
+ * scheduling. Expects root IDs only (after flatten_labels()); unlabeled pixels out of reach of
+ * any region, in an image without regions, stay unlabeled.
+ */
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::fill_gaps(region_container & regions, cv::Mat const& packed, cv::Mat & buffer) {
+    RG_TRACE("fill_gaps");
+    SegmentationContext &ctx = get_context();
+    SegmentationContext::GapScratch &gaps = ctx.get_gap_scratch();
+    ThreadPool &pool = get_thread_pool();
+    cv::Rect area(0, 0, buffer.cols, buffer.rows);
+
+    gaps.means.resize(regions.size());
+    for (int key = 0; key < (int)regions.size(); ++key) {
+        cv::Scalar mean = regions.get_mean(key);
+        gaps.means[key] = cv::Vec3f((float)mean[0], (float)mean[1], (float)mean[2]);
+    }
+
+    // First layer, flagged row-parallel then gathered in raster order
+    cv::Mat flags = ctx.gap_flags_for(buffer.size());
+    pool.parallel_for(0, buffer.rows, row_grain(buffer.cols), [&](int first, int last) {
+        for (int i = first; i < last; ++i) {
+            const int* row = buffer.ptr<int>(i);
+            uchar* flagRow = flags.ptr<uchar>(i);
+            for (int j = 0; j < buffer.cols; ++j) {
+                flagRow[j] = 0;
+                for (int n = 0; n < Connectivity::size && row[j] == 0 && !flagRow[j] && in_roi(j, i); ++n) {
+                    cv::Point neighbor(j + Connectivity::dx[n], i + Connectivity::dy[n]);
+                    flagRow[j] = area.contains(neighbor) && buffer.at<int>(neighbor) > 0;
+                }
+            }
+        }
+    });
+    gaps.frontier.clear();
+    for (int i = 0; i < buffer.rows; ++i) {
+        const uchar* flagRow = flags.ptr<uchar>(i);
+        int* row = buffer.ptr<int>(i);
+        for (int j = 0; j < buffer.cols; ++j) {
+            if (flagRow[j]) {
+                row[j] = -1; // queued
+                gaps.frontier.emplace_back(j, i);
+            }
+        }
+    }
+
+    while (!gaps.frontier.empty()) {
+        int count = (int)gaps.frontier.size();
+        gaps.choices.resize(count);
+        pool.parallel_for(0, count, 4096, [&](int first, int last) {
+            for (int k = first; k < last; ++k) {
+                gaps.choices[k] = closest_region(buffer, packed, area, gaps.frontier[k], gaps.means);
+            }
+        });
+
+        for (int k = 0; k < count; ++k) {
+            cv::Point const& pixel = gaps.frontier[k];
+            buffer.at<int>(pixel) = gaps.choices[k];
+            update_mean(regions, gaps.choices[k], pixel, packed.at<cv::Vec4b>(pixel));
+        }
+
+        gaps.next.clear();
+        for (int k = 0; k < count; ++k) {
+            cv::Point const& pixel = gaps.frontier[k];
+            for (int n = 0; n < Connectivity::size; ++n) {
+                cv::Point neighbor(pixel.x + Connectivity::dx[n], pixel.y + Connectivity::dy[n]);
+                if (area.contains(neighbor) && buffer.at<int>(neighbor) == 0 && in_roi(neighbor.x, neighbor.y)) {
+                    buffer.at<int>(neighbor) = -1;
+                    gaps.next.push_back(neighbor);
+                }
+            }
+        }
+        gaps.frontier.swap(gaps.next);
+    }
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::process(region_container & regions, cv::Mat const& packed,
+             cv::Mat & buffer, Scratch & scratch, cv::Point const& current,
+             cv::Rect const& area, int & currentKey) {
+    // Words of the region when the pixel is dequeued, kept for all its neighbors
+    cv::Vec4b lowerb = regions.get_packed_lower_bound(currentKey);
+    cv::Vec4b upperb = regions.get_packed_upper_bound(currentKey);
+
+    // Away from the area border the 8 pixel tests of an interval predicate run at once
+    bool interior = Predicate::interval &&
+                    current.x > area.x && current.x < area.x + area.width - 1 &&
+                    current.y > area.y && current.y < area.y + area.height - 1;
+    unsigned acceptMask = interior ? neighborKernel.mask(packed, current, lowerb, upperb) : 0;
+
+    for (int n = 0; n < Connectivity::size; ++n) {
+        cv::Point neighbor(current.x + Connectivity::dx[n], current.y + Connectivity::dy[n]);
+        if (area.contains(neighbor)) {
+            // The background ID 0 is its own root, so unlabeled pixels still read 0
+            int neighborKey = regions.find(label_at(buffer, neighbor.x, neighbor.y));
+            if (neighborKey == 0) {
+                cv::Vec4b const& neighborValue = packed.at<cv::Vec4b>(neighbor);
+                bool accepted = interior ? (acceptMask >> Connectivity::bit[n]) & 1u
+                                         : accepts(lowerb, upperb, neighborValue);
+
+                if (accepted && in_roi(neighbor.x, neighbor.y)) {
+                    set_label(buffer, neighbor.x, neighbor.y, currentKey);
+                    update_mean(regions, currentKey, neighbor, neighborValue);
+                    scratch.queue.push(neighbor);
+                }
+            } else if (currentKey != neighborKey) {
+                if (mergeStrategy == MergeStrategy::Graph) {
+                    record_contact(scratch, currentKey, neighborKey);
+                } else {
+                    RG_COUNT(MergesAttempted, 1);
+                    if (mergeable(regions, currentKey, lowerb, upperb, neighborKey)) {
+                        merge(regions, currentKey, neighborKey);
                     }
                 }
             }
@@ -241,37 +797,423 @@ void GrowAndMerge::process(region_container & regions, std::vector<cv::Mat> cons
     }
 }
 
-void GrowAndMerge::growing(region_container & regions, std::vector<cv::Mat> const& hsvChannels,
-             cv::Mat & buffer, cv::Point const& seed, int currentKey) {
-    std::queue<cv::Point> queue;
-    queue.push(seed);
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::growing(region_container & regions, cv::Mat const& packed,
+             cv::Mat & buffer, cv::Point const& seed, cv::Rect const& area, int currentKey) {
+    cv::Vec4b seedValue = packed.at<cv::Vec4b>(seed);
 
-    auto seedH = (double)hsvChannels[0].at<uchar>(seed);
-    auto seedS = (double)hsvChannels[1].at<uchar>(seed);
-    auto seedV = (double)hsvChannels[2].at<uchar>(seed);
+    cv::Vec4b lowerb, upperb;
+    Predicate::seed_bounds(seedValue, lowerb, upperb);
+    regions.set_packed_bounds(currentKey, lowerb, upperb);
 
-    cv::Scalar hsvSeed(seedH, seedS, seedV);
-    std::pair<cv::Scalar, cv::Scalar> bounds = interval_bounds(hsvSeed);
-    regions[currentKey].second.emplace_back(bounds.first);
-    regions[currentKey].second.emplace_back(bounds.second);
-    regions[currentKey].second.emplace_back(0);
-    update_mean(regions[currentKey], hsvSeed);
+    RG_TRACE("growing");
+    grow_from(regions, packed, buffer, seed, area, currentKey);
+}
 
-    regions[currentKey].first.push_back(seed);
-    buffer.at<int>(seed) = currentKey;
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::grow_from(region_container & regions, cv::Mat const& packed,
+             cv::Mat & buffer, cv::Point const& start, cv::Rect const& area, int currentKey) {
+    update_mean(regions, currentKey, start, packed.at<cv::Vec4b>(start));
+    set_label(buffer, start.x, start.y, currentKey);
+
+    Scratch &scratch = get_context().scratch_for(get_thread_pool().current_worker());
+    if (engine == Engine::Span) {
+        grow_spans(regions, packed, buffer, scratch, area, currentKey,
+                   fill_span(regions, packed, buffer, start.x, start.y, area, currentKey));
+    } else {
+        grow_queue(regions, packed, buffer, scratch, start, area, currentKey);
+    }
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::grow_queue(region_container & regions, cv::Mat const& packed,
+             cv::Mat & buffer, Scratch & scratch, cv::Point const& seed, cv::Rect const& area, int currentKey) {
+    SegmentationContext::PointQueue &queue = scratch.queue;
+    queue.clear();
+    queue.push(seed);
 
     while (!queue.empty()) {
-        cv::Point current = queue.front();
-        queue.pop();
-        process(regions, hsvChannels, buffer, queue, current, currentKey);
+        cv::Point current = queue.pop();
+        process(regions, packed, buffer, scratch, current, area, currentKey);
+        RG_COUNT(PixelsDequeued, 1);
+        RG_HIGH_WATER(QueueHighWater, queue.size());
+    }
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::touch(region_container & regions, Scratch & scratch, int & currentKey, int label) {
+    int neighborKey = regions.find(label);
+    if (neighborKey == 0 || neighborKey == currentKey) {
+        return;
+    }
+    if (mergeStrategy == MergeStrategy::Graph) {
+        record_contact(scratch, currentKey, neighborKey);
+        return;
+    }
+    RG_COUNT(MergesAttempted, 1);
+    if (mergeable(regions, currentKey, regions.get_packed_lower_bound(currentKey),
+                  regions.get_packed_upper_bound(currentKey), neighborKey)) {
+        merge(regions, currentKey, neighborKey);
+    }
+}
+
+template <class Predicate, class Connectivity>
+typename BasicGrowAndMerge<Predicate, Connectivity>::Span BasicGrowAndMerge<Predicate, Connectivity>::fill_span(region_container & regions, cv::Mat const& packed,
+                                                                                 cv::Mat & buffer, int x, int y, cv::Rect const& area, int currentKey) {
+    const cv::Vec4b* packedRow = packed.ptr<cv::Vec4b>(y);
+    cv::Vec4b const& lowerb = regions.get_packed_lower_bound(currentKey);
+    cv::Vec4b const& upperb = regions.get_packed_upper_bound(currentKey);
+
+    Span span = {y, x, x};
+    while (span.xLeft > area.x && label_at(buffer, span.xLeft - 1, y) == 0 &&
+           accepts(lowerb, upperb, packedRow[span.xLeft - 1]) && in_roi(span.xLeft - 1, y)) {
+        span.xLeft--;
+        set_label(buffer, span.xLeft, y, currentKey);
+        update_mean(regions, currentKey, cv::Point(span.xLeft, y), packedRow[span.xLeft]);
+    }
+    while (span.xRight < area.x + area.width - 1 && label_at(buffer, span.xRight + 1, y) == 0 &&
+           accepts(lowerb, upperb, packedRow[span.xRight + 1]) && in_roi(span.xRight + 1, y)) {
+        span.xRight++;
+        set_label(buffer, span.xRight, y, currentKey);
+        update_mean(regions, currentKey, cv::Point(span.xRight, y), packedRow[span.xRight]);
     }
+    return span;
 }
 
-std::vector<int> GrowAndMerge::generate_random_unique_BGR(size_t size) {
+/**
+ * @brief Scanline counterpart of grow_queue().
+ *
+ * The region is grown by whole horizontal runs: a run is claimed by sweeping its row left and
+ * right, then the rows above and below are swept once over [xLeft - 1, xRight + 1] (the diagonal
+ * neighbors, 8-connected) or [xLeft, xRight] (4-connected), and every accepted unlabeled pixel
+ * found there starts a new run. Merge
+ * tests run once per change of label along the swept rows instead of once per pixel and neighbor,
+ * and a pixel rejected by the interval is tested at most once per adjacent run instead of once per
+ * labeled neighbor.
+ *
+ * A pixel is claimed when it is unlabeled and inside the interval of the region, whatever the
+ * order, so both engines grow the same connected pixel sets while that interval stays the same.
+ * A merge during the growth hands over the interval of the survivor; the runs are then swept in
+ * the same ring order as the queue, so the labels only differ in the rare cases where the two
+ * orders reach a merge at a different time.
+ */
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::grow_spans(region_container & regions, cv::Mat const& packed, cv::Mat & buffer,
+                              Scratch & scratch, cv::Rect const& area, int currentKey, Span first) {
+    int left = area.x, right = area.x + area.width - 1;
+    int top = area.y, bottom = area.y + area.height - 1;
+
+    // Runs are swept first in, first out, in rings around the seed like the pixels of grow_queue()
+    std::vector<Span> &runs = scratch.runs;
+    runs.clear();
+    runs.push_back(first);
+    for (size_t next = 0; next < runs.size(); ++next) {
+        Span span = runs[next];
+        RG_COUNT(PixelsDequeued, span.xRight - span.xLeft + 1);
+        RG_HIGH_WATER(QueueHighWater, runs.size() - next);
+
+        if (span.xLeft > left) {
+            touch(regions, scratch, currentKey, label_at(buffer, span.xLeft - 1, span.y));
+        }
+        if (span.xRight < right) {
+            touch(regions, scratch, currentKey, label_at(buffer, span.xRight + 1, span.y));
+        }
+
+        // Diagonal neighbors reach one pixel past each end of the run
+        int reach = Connectivity::diagonal ? 1 : 0;
+        int from = std::max(left, span.xLeft - reach);
+        int to = std::min(right, span.xRight + reach);
+        for (int y = span.y - 1; y <= span.y + 1; y += 2) {
+            if (y < top || y > bottom) {
+                continue;
+            }
+            const cv::Vec4b* packedRow = packed.ptr<cv::Vec4b>(y);
+            int lastLabel = 0;
+            for (int x = from; x <= to; ++x) {
+                int label = label_at(buffer, x, y);
+                if (label == 0) {
+                    lastLabel = 0;
+                    if (accepts(regions.get_packed_lower_bound(currentKey), regions.get_packed_upper_bound(currentKey),
+                                packedRow[x]) && in_roi(x, y)) {
+                        set_label(buffer, x, y, currentKey);
+                        update_mean(regions, currentKey, cv::Point(x, y), packedRow[x]);
+                        Span claimed = fill_span(regions, packed, buffer, x, y, area, currentKey);
+                        runs.push_back(claimed);
+                        x = claimed.xRight;
+                        lastLabel = currentKey;
+                    }
+                } else if (label != lastLabel) {
+                    touch(regions, scratch, currentKey, label);
+                    lastLabel = label;
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Grows the seeds tile by tile on the thread pool, lets the regions grow on across the tile
+ * borders, then stitches the tiles together.
+ *
+ * Every pass is parallel over the tiles, and in every pass a tile only writes its own pixels and
+ * its own region rows: the workers write to the buffer and to the region table without locking.
+ * The seeds first grow within the tile holding them. A tile without a seed, or the part of a tile
+ * cut off from its seeds, is left at 0 by that pass; grow_across_tiles() then continues the
+ * regions of the neighbor tiles into it, round after round, so the coverage is about the one of
+ * the serial growth. stitch_tiles() finally applies the merge test (or records the contact) of
+ * every region pair that meets across a border. Inside a tile the seeds and the continuations keep
+ * a fixed order and the steps between the passes run serially in tile order, so the result only
+ * depends on the tile size, not on the thread count or scheduling.
+ */
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::grow_tiles(region_container & regions, cv::Mat const& packed,
+                              cv::Mat & buffer, std::vector<cv::Point> const& seeds) {
+    int tilesX = (buffer.cols + tileSize.width - 1) / tileSize.width;
+    int tilesY = (buffer.rows + tileSize.height - 1) / tileSize.height;
+
+    int numTiles = tilesX * tilesY;
+    std::vector<SegmentationContext::TileScratch> &tiles = get_context().tiles_for(numTiles);
+    for (int tile = 0; tile < numTiles; ++tile) {
+        tiles[tile].seeds.clear();
+    }
+    for (size_t i = 0; i < seeds.size(); ++i) {
+        int tile = (seeds[i].y / tileSize.height) * tilesX + seeds[i].x / tileSize.width;
+        tiles[tile].seeds.push_back((int)i);
+    }
+
+    get_thread_pool().parallel_for(0, numTiles, 1, [&](int first, int last) {
+        for (int tile = first; tile < last; ++tile) {
+            cv::Rect area = tile_area(tile, tilesX, buffer.size());
+            RG_TRACE("grow_tile");
+            for (int i : tiles[tile].seeds) {
+                if (label_at(buffer, seeds[i].x, seeds[i].y) == 0) {
+                    growing(regions, packed, buffer, seeds[i], area, i + 1);
+                }
+            }
+        }
+    });
+
+    RG_TRACE("grow_across_tiles");
+    grow_across_tiles(regions, packed, buffer, tilesX, tilesY);
+    RG_TRACE("stitch_tiles");
+    stitch_tiles(regions, buffer, tilesX, tilesY);
+}
+
+template <class Predicate, class Connectivity>
+cv::Rect BasicGrowAndMerge<Predicate, Connectivity>::tile_area(int tile, int tilesX, cv::Size size) const {
+    return cv::Rect((tile % tilesX) * tileSize.width, (tile / tilesX) * tileSize.height, tileSize.width, tileSize.height) &
+           cv::Rect(0, 0, size.width, size.height);
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::stitch_pair(region_container & regions, Scratch & scratch, int key1, int key2) {
+    if (key1 == 0 || key2 == 0) {
+        return;
+    }
+    key1 = regions.find(key1);
+    key2 = regions.find(key2);
+    if (key1 == key2) {
+        return;
+    }
+    if (mergeStrategy == MergeStrategy::Graph) {
+        record_contact(scratch, key1, key2);
+        return;
+    }
+    RG_COUNT(MergesAttempted, 1);
+    // Same merge test as the one applied while growing
+    if (mergeable(regions, key1, regions.get_packed_lower_bound(key1), regions.get_packed_upper_bound(key1), key2)) {
+        merge(regions, key1, key2);
+    }
+}
+
+/**
+ * @brief Applies the merge test of the growth to the regions that touch across the tile borders.
+ *
+ * Each tile lists, in parallel, the label pairs met across its right and bottom borders (three
+ * neighbors per pixel when 8-connected), without the repeats of a shared border. Reading labels
+ * only, the tiles need no lock. The pairs are then tested by stitch_pair() serially, tile after
+ * tile: a merge changes the means the next tests see, and that order keeps the result the same
+ * for any thread count. The serial part is one test per pair of labels, not one per border pixel.
+ */
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::stitch_tiles(region_container & regions, cv::Mat const& buffer,
+                                                             int tilesX, int tilesY) {
+    std::vector<SegmentationContext::TileScratch> &tiles = get_context().tiles_for(tilesX * tilesY);
+    int reach = Connectivity::diagonal ? 1 : 0;
+
+    get_thread_pool().parallel_for(0, tilesX * tilesY, 1, [&](int first, int last) {
+        for (int tile = first; tile < last; ++tile) {
+            cv::Rect area = tile_area(tile, tilesX, buffer.size());
+            std::vector<uint64_t> &contacts = tiles[tile].contacts;
+            contacts.clear();
+            auto meet = [&](int label1, int label2) {
+                if (label1 != 0 && label2 != 0 && label1 != label2) {
+                    uint64_t pair = RegionGraph::pack(label1, label2);
+                    if (contacts.empty() || contacts.back() != pair) {
+                        contacts.push_back(pair);
+                    }
+                }
+            };
+
+            // Right border: (x, y) against its neighbors in column x + 1
+            int x = area.x + area.width - 1;
+            if (x + 1 < buffer.cols) {
+                for (int y = area.y; y < area.y + area.height; ++y) {
+                    for (int dy = -reach; dy <= reach; ++dy) {
+                        if (y + dy >= 0 && y + dy < buffer.rows) {
+                            meet(label_at(buffer, x, y), label_at(buffer, x + 1, y + dy));
+                        }
+                    }
+                }
+            }
+
+            // Bottom border: (x, y) against its neighbors in row y + 1
+            int y = area.y + area.height - 1;
+            if (y + 1 < buffer.rows) {
+                for (int x = area.x; x < area.x + area.width; ++x) {
+                    for (int dx = -reach; dx <= reach; ++dx) {
+                        if (x + dx >= 0 && x + dx < buffer.cols) {
+                            meet(label_at(buffer, x, y), label_at(buffer, x + dx, y + 1));
+                        }
+                    }
+                }
+            }
+        }
+    });
+
+    Scratch &scratch = get_context().scratch_for(get_thread_pool().current_worker());
+    for (int tile = 0; tile < tilesX * tilesY; ++tile) {
+        for (uint64_t pair : tiles[tile].contacts) {
+            stitch_pair(regions, scratch, RegionGraph::first(pair), RegionGraph::second(pair));
+        }
+    }
+}
+
+/**
+ * @brief Grows the regions of the tiles on into the unlabeled pixels of the neighbor tiles.
+ *
+ * A round lists, in parallel, the unlabeled pixels along the border of every tile that have a
+ * labeled neighbor in another tile. Serially, in tile order, each pixel the region of that
+ * neighbor accepts gets a continuation of the region: a new region row of the tile, with the
+ * bounds of the region, which grows from the pixel within the tile, all the pixels a region
+ * reaches in a tile sharing one row. The tiles then grow their continuations in parallel; a
+ * continuation only meets, and merges with, regions of its own tile. Rounds go on until no border
+ * pixel is accepted, each claiming at least one pixel, and a region reaches as far as in the serial
+ * growth, one tile further per round. Each continuation is then merged with the region it continues.
+ */
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::grow_across_tiles(region_container & regions, cv::Mat const& packed,
+                                                                  cv::Mat & buffer, int tilesX, int tilesY) {
+    SegmentationContext &ctx = get_context();
+    std::vector<SegmentationContext::TileScratch> &tiles = ctx.tiles_for(tilesX * tilesY);
+    std::vector<cv::Vec2i> &continuations = ctx.get_continuations();
+    continuations.clear();
+    cv::Rect image(0, 0, buffer.cols, buffer.rows);
+
+    // Continuation of each region in the tile being listed, 0: none yet
+    std::vector<int> &continuationOf = ctx.get_roots();
+
+    for (;;) {
+        get_thread_pool().parallel_for(0, tilesX * tilesY, 1, [&](int first, int last) {
+            for (int tile = first; tile < last; ++tile) {
+                cv::Rect area = tile_area(tile, tilesX, buffer.size());
+                std::vector<cv::Vec3i> &offers = tiles[tile].offers;
+                offers.clear();
+                auto offer = [&](int x, int y) {
+                    if (label_at(buffer, x, y) != 0) {
+                        return;
+                    }
+                    int lastLabel = 0;
+                    for (int n = 0; n < Connectivity::size; ++n) {
+                        cv::Point neighbor(x + Connectivity::dx[n], y + Connectivity::dy[n]);
+                        if (image.contains(neighbor) && !area.contains(neighbor)) {
+                            int label = label_at(buffer, neighbor.x, neighbor.y);
+                            if (label != 0 && label != lastLabel) {
+                                offers.emplace_back(x, y, label);
+                                lastLabel = label;
+                            }
+                        }
+                    }
+                };
+                for (int x = area.x; x < area.x + area.width; ++x) {
+                    offer(x, area.y);
+                    if (area.height > 1) {
+                        offer(x, area.y + area.height - 1);
+                    }
+                }
+                for (int y = area.y + 1; y < area.y + area.height - 1; ++y) {
+                    offer(area.x, y);
+                    if (area.width > 1) {
+                        offer(area.x + area.width - 1, y);
+                    }
+                }
+            }
+        });
+
+        // The offers are read from the labels of the other tiles before any of them grows on
+        size_t numStarts = 0;
+        continuationOf.assign(regions.size(), 0);
+        for (int tile = 0; tile < tilesX * tilesY; ++tile) {
+            std::vector<cv::Vec3i> &starts = tiles[tile].starts;
+            starts.clear();
+            size_t firstContinuation = continuations.size();
+            for (cv::Vec3i const& offer : tiles[tile].offers) {
+                cv::Point pixel(offer[0], offer[1]);
+                int root = regions.find(offer[2]);
+                if (!accepts(regions.get_packed_lower_bound(root), regions.get_packed_upper_bound(root),
+                             packed.at<cv::Vec4b>(pixel)) || !in_roi(pixel.x, pixel.y)) {
+                    continue;
+                }
+                if (continuationOf[root] == 0) {
+                    int key = regions.add_region(regions.get_seed(root), regions.get_color(root));
+                    regions.set_packed_bounds(key, regions.get_packed_lower_bound(root), regions.get_packed_upper_bound(root));
+                    continuationOf[root] = key;
+                    continuations.emplace_back(root, key);
+                }
+                starts.emplace_back(pixel.x, pixel.y, continuationOf[root]);
+            }
+            for (size_t c = firstContinuation; c < continuations.size(); ++c) {
+                continuationOf[continuations[c][0]] = 0;
+            }
+            numStarts += starts.size();
+        }
+        if (numStarts == 0) {
+            break;
+        }
+
+        get_thread_pool().parallel_for(0, tilesX * tilesY, 1, [&](int first, int last) {
+            for (int tile = first; tile < last; ++tile) {
+                cv::Rect area = tile_area(tile, tilesX, buffer.size());
+                RG_TRACE("grow_tile");
+                for (cv::Vec3i const& start : tiles[tile].starts) {
+                    cv::Point pixel(start[0], start[1]);
+                    // A merge within the tile may have widened or replaced the bounds
+                    int key = regions.find(start[2]);
+                    if (label_at(buffer, pixel.x, pixel.y) == 0 &&
+                        accepts(regions.get_packed_lower_bound(key), regions.get_packed_upper_bound(key),
+                                packed.at<cv::Vec4b>(pixel))) {
+                        grow_from(regions, packed, buffer, pixel, area, key);
+                    }
+                }
+            }
+        });
+    }
+
+    // Until here every region row only held pixels of one tile, so that the tiles never shared a row
+    for (cv::Vec2i const& continuation : continuations) {
+        int root = continuation[0], key = continuation[1];
+        if (regions.find(root) != regions.find(key)) {
+            merge(regions, root, key);
+        }
+    }
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::generate_random_unique_BGR(size_t size, std::vector<int> & randomColorList) {
     std::uniform_int_distribution<int> dis(55, 255);
 
-    std::unordered_set<int> usedColors;
-    std::vector<int> randomColorList;
+    SegmentationContext &ctx = get_context();
+    randomColorList.clear();
 
     for (long unsigned int i = 0; i < size; ++i) {
         int colorValue;
@@ -284,23 +1226,24 @@ std::vector<int> GrowAndMerge::generate_random_unique_BGR(size_t size) {
 
             // Convert RGB to a single integer for uniqueness check
             colorValue = bgr_to_hex(color);
-        } while (usedColors.count(colorValue) > 0);
+        } while (!ctx.use_color(colorValue));
 
-        usedColors.insert(colorValue);
         randomColorList.push_back(colorValue);
     }
 
-    return randomColorList;
+    end_colors(randomColorList);
 }
 
-uchar GrowAndMerge::check_bounds(uchar value) {
+template <class Predicate, class Connectivity>
+uchar BasicGrowAndMerge<Predicate, Connectivity>::check_bounds(uchar value) {
     return (value + 10 > 255) ? ((value - 10 < 0) ? value + 10 : value - 10) : value - 10;
 }
 
-std::vector<int> GrowAndMerge::generate_unique_BGR(cv::Mat const& img, std::vector<cv::Point> const& seeds) {
-    std::unordered_set<int> usedColors;
-    std::vector<int> colorList;
-    colorList.reserve(seeds.size());
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::generate_unique_BGR(cv::Mat const& img, std::vector<cv::Point> const& seeds,
+                                                                     std::vector<int> & colorList) {
+    SegmentationContext &ctx = get_context();
+    colorList.clear();
 
     for (auto seed : seeds) {
         cv::Vec3b color = img.at<cv::Vec3b>(seed);
@@ -315,7 +1258,7 @@ std::vector<int> GrowAndMerge::generate_unique_BGR(cv::Mat const& img, std::vect
         }
 
         int cpt = 0;
-        while (usedColors.count(hexColor) > 0) {
+        while (!ctx.use_color(hexColor)) {
             ++cpt;
             uchar bValue = check_bounds(color[0]);
             uchar gValue = check_bounds(color[1]);
@@ -324,94 +1267,636 @@ std::vector<int> GrowAndMerge::generate_unique_BGR(cv::Mat const& img, std::vect
             hexColor = bgr_to_hex(color);
         }
 
-        usedColors.insert(hexColor);
         colorList.push_back(hexColor);
     }
 
-    return colorList;
+    end_colors(colorList);
 }
 
-void GrowAndMerge::fill_mask(cv::Mat const& buffer, cv::Mat & mask) {
-    for (int i = 0; i < buffer.rows; ++i) {
-        for (int j = 0; j < buffer.cols; ++j) {
-            mask.at<cv::Vec3b>(i, j) = hex_to_bgr(buffer.at<int>(i, j));
-        }
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::end_colors(std::vector<int> const& colorList) {
+    if (holdColors) {
+        heldColors.insert(heldColors.end(), colorList.begin(), colorList.end());
+    } else {
+        get_context().release_colors(colorList);
     }
 }
 
-bool GrowAndMerge::is_edge(cv::Mat const& buffer, cv::Point const& pixel) {
-    if (pixel.x-1 >= 0 && buffer.at<int>(pixel.y, pixel.x-1) != buffer.at<int>(pixel)) {
-        return true;
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::release_held_colors() {
+    get_context().release_colors(heldColors);
+    heldColors.clear();
+    holdColors = false;
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::pack_features(cv::Mat const& src, cv::Mat & packed) {
+    SegmentationContext &ctx = get_context();
+    cv::Mat features;
+    if (!sharedFeatures.empty() && sharedFeatures.size() == src.size() && sharedFeatures.type() == CV_8UC3) {
+        features = sharedFeatures;
+    } else {
+        features = ctx.features_for(src.size());
+        Predicate::convert(src, features);
     }
-    if (pixel.x+1 < buffer.cols && buffer.at<int>(pixel.y, pixel.x+1) != buffer.at<int>(pixel)) {
-        return true;
+    sharedFeatures.release();
+    neighborKernel.pack_hsv(features, packed, ctx.get_packed_storage());
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::build_palette(region_container const& regions, std::vector<cv::Vec3b> & palette) {
+    palette.resize(regions.size());
+    for (int id = 0; id < (int)regions.size(); ++id) {
+        palette[id] = hex_to_bgr(regions.get_color(id));
     }
-    if (pixel.y-1 >= 0 && buffer.at<int>(pixel.y-1, pixel.x) != buffer.at<int>(pixel)) {
-        return true;    
+}
+
+template <class Predicate, class Connectivity>
+int BasicGrowAndMerge<Predicate, Connectivity>::row_grain(int cols) {
+    // About 64K pixels per task
+    return std::max(1, (1 << 16) / std::max(1, cols));
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::edge_row(cv::Mat const& buffer, int i, uchar* flags) {
+    const int* row = buffer.ptr<int>(i);
+    // Out of the image the row itself stands in, it never differs
+    const int* above = buffer.ptr<int>(i > 0 ? i - 1 : i);
+    const int* below = buffer.ptr<int>(i + 1 < buffer.rows ? i + 1 : i);
+    int cols = buffer.cols;
+    if (cols == 1) {
+        flags[0] = (uchar)((row[0] != above[0]) | (row[0] != below[0]));
+        return;
     }
-    if (pixel.y+1 < buffer.rows && buffer.at<int>(pixel.y+1, pixel.x) != buffer.at<int>(pixel)) {
-        return true;
+
+    // Shifted compares without branches, so that the compiler can vectorize the interior
+    flags[0] = (uchar)((row[0] != above[0]) | (row[0] != below[0]) | (row[0] != row[1]));
+    for (int j = 1; j + 1 < cols; ++j) {
+        flags[j] = (uchar)((row[j] != above[j]) | (row[j] != below[j]) | (row[j] != row[j - 1]) | (row[j] != row[j + 1]));
     }
-    return false;
+    int last = cols - 1;
+    flags[last] = (uchar)((row[last] != above[last]) | (row[last] != below[last]) | (row[last] != row[last - 1]));
 }
 
-void GrowAndMerge::edge_mask(cv::Mat const& buffer, cv::Mat & mask) {
-    for (int i = 0; i < buffer.rows; ++i) {
-        for (int j = 0; j < buffer.cols; ++j) {
-            cv::Point pixel(j, i);
-            if (is_edge(buffer, pixel)) {
-                mask.at<cv::Vec3b>(i, j) = hex_to_bgr(buffer.at<int>(i, j));
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::fill_mask(region_container const& regions, cv::Mat const& buffer, cv::Mat & mask) {
+    std::vector<cv::Vec3b> &palette = get_context().get_palette();
+    build_palette(regions, palette);
+
+    get_thread_pool().parallel_for(0, buffer.rows, row_grain(buffer.cols), [&](int first, int last) {
+        for (int i = first; i < last; ++i) {
+            const int* row = buffer.ptr<int>(i);
+            cv::Vec3b* out = mask.ptr<cv::Vec3b>(i);
+            for (int j = 0; j < buffer.cols; ++j) {
+                out[j] = palette[row[j]];
             }
         }
+    });
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::edge_mask(region_container const& regions, cv::Mat const& buffer, cv::Mat & mask) {
+    SegmentationContext &ctx = get_context();
+    std::vector<cv::Vec3b> &palette = ctx.get_palette();
+    build_palette(regions, palette);
+
+    // The pixels away from the boundaries are written black, the mask does not need to be cleared first
+    ThreadPool &pool = get_thread_pool();
+    ctx.reserve_scratch(pool.get_num_workers());
+    // Sized up front: which workers take a chunk changes from call to call
+    for (int worker = -1; worker < pool.get_num_workers(); ++worker) {
+        ctx.scratch_for(worker).flags.resize(buffer.cols);
     }
+    pool.parallel_for(0, buffer.rows, row_grain(buffer.cols), [&](int first, int last) {
+        std::vector<uchar> &flags = ctx.scratch_for(pool.current_worker()).flags;
+        for (int i = first; i < last; ++i) {
+            edge_row(buffer, i, flags.data());
+            const int* row = buffer.ptr<int>(i);
+            cv::Vec3b* out = mask.ptr<cv::Vec3b>(i);
+            for (int j = 0; j < buffer.cols; ++j) {
+                // Region 0 is black: the flag selects the index, not the color, so there is no branch
+                out[j] = palette[row[j] & -(int)flags[j]];
+            }
+        }
+    });
 }
 
-double GrowAndMerge::coverage(region_container const& regions, uint32_t cols, uint32_t rows) {
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::trace_contour(cv::Mat const& buffer, Contour & contour) {
+    static const int dx[8] = {1, 1, 0, -1, -1, -1, 0, 1};
+    static const int dy[8] = {0, -1, -1, -1, 0, 1, 1, 1};
+
+    // Boundary following of the 8-connected region from its top-left pixel, the neighbors searched
+    // counterclockwise from (dir + 7) % 8 after an even move and (dir + 6) % 8 after an odd one. It stops
+    // when the first move is about to be repeated; an isolated pixel has an empty chain.
+    cv::Rect image(0, 0, buffer.cols, buffer.rows);
+    cv::Point current = contour.start;
+    cv::Point second;
+    int dir = 7;
+    contour.codes.clear();
+    while (true) {
+        int from = (dir % 2 == 0) ? (dir + 7) % 8 : (dir + 6) % 8;
+        int found = -1;
+        for (int k = 0; k < 8 && found < 0; ++k) {
+            int d = (from + k) % 8;
+            cv::Point neighbor(current.x + dx[d], current.y + dy[d]);
+            if (image.contains(neighbor) && buffer.at<int>(neighbor) == contour.region) {
+                found = d;
+            }
+        }
+        if (found < 0) {
+            return;
+        }
+
+        cv::Point next(current.x + dx[found], current.y + dy[found]);
+        if (contour.codes.empty()) {
+            second = next;
+        } else if (current == contour.start && next == second) {
+            return;
+        }
+        contour.codes.push_back((uchar)found);
+        dir = found;
+        current = next;
+    }
+}
+
+template <class Predicate, class Connectivity>
+double BasicGrowAndMerge<Predicate, Connectivity>::coverage(region_container const& regions, uint32_t cols, uint32_t rows) {
     size_t count = 0;
-    for (auto const& [key, value]: regions) {
-        count += value.first.size();
+    for (int key = 1; key < (int)regions.size(); ++key) {
+        if (regions.is_root(key)) {
+            count += regions.get_pixel_count(key);
+        }
     }
 
     return (double)count / ((double)cols*(double)rows);
 }
 
-void GrowAndMerge::seg(cv::Mat const& src, cv::Mat & dst, std::vector<cv::Point> const& seeds,
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::seg(cv::Mat const& src, cv::Mat & dst, std::vector<cv::Point> const& seeds,
                        region_container & regions, bool randColorization) {
-    cv::Mat hsvImg;
-    cv::cvtColor(src, hsvImg, cv::COLOR_BGR2HSV);
-
-    std::vector<cv::Mat> hsvChannels;
-    cv::split(hsvImg, hsvChannels);
+    cv::Mat packed;
+    pack_features(src, packed);
 
     size_t numSeeds = seeds.size();
 
-    std::vector<int> colorList;
+    std::vector<int> &colorList = get_context().get_colors();
     if (randColorization) {
-        colorList = generate_random_unique_BGR(numSeeds);
+        generate_random_unique_BGR(numSeeds, colorList);
     } else {
-        colorList = generate_unique_BGR(src, seeds);
+        generate_unique_BGR(src, seeds, colorList);
     }
 
+    regions.clear();
+    regions.reserve(numSeeds + 1);
+    regions.add_region(cv::Point(-1, -1), 0); // background
     for (size_t i = 0; i < numSeeds; ++i) {
+        regions.add_region(seeds[i], colorList[i]);
+    }
+
+    get_context().reserve_scratch(get_thread_pool().get_num_workers());
+    get_context().clear_contacts();
+    // dst is the label plane of a new generation, see SegmentationContext::labels_for()
+    stamps = get_context().stamps_for(dst.size());
+    stamp = get_context().get_generation();
+    if (!tileSize.empty()) {
+        grow_tiles(regions, packed, dst, seeds);
+    } else {
+        cv::Rect area(0, 0, dst.cols, dst.rows);
+        for (size_t i = 0; i < numSeeds; ++i) {
+            if (label_at(dst, seeds[i].x, seeds[i].y) == 0) {
+                growing(regions, packed, dst, seeds[i], area, (int)i + 1);
+            }
+        }
+    }
+    if (mergeStrategy == MergeStrategy::Graph) {
+        merge_graph(regions);
+    }
+
+    flatten_labels(regions, dst);
+    if (fillGaps) {
+        fill_gaps(regions, packed, dst);
+    }
+}
+
+/**
+ * @brief Incremental counterpart of seg() for video streams.
+ *
+ * The dirty pixels are unlabeled, the statistics of every region are rebuilt from the new frame,
+ * and the regions left without pixels are recycled. The seeds then grow over the unlabeled
+ * pixels only and merge with the surrounding regions under the usual test; in those merges a
+ * region carried over from the previous frame always survives, so the unchanged parts of the
+ * image keep their IDs and colors.
+ */
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::update(cv::Mat const& src, cv::Mat & dst, cv::Mat const& dirty, std::vector<cv::Point> const& seeds,
+                          region_container & regions, bool randColorization) {
+    cv::Mat packed;
+    pack_features(src, packed);
+
+    // Every label of the plane is current; a seg() that threw may have left the stamps set
+    stamps.release();
+    dst.setTo(0, dirty);
+
+    regions.reset_statistics();
+    for (int i = 0; i < dst.rows; ++i) {
+        const int* row = dst.ptr<int>(i);
+        for (int j = 0; j < dst.cols; ++j) {
+            if (row[j] != 0) {
+                update_mean(regions, row[j], cv::Point(j, i), packed.at<cv::Vec4b>(i, j));
+            }
+        }
+    }
+    regions.release_empty();
+
+    carriedRegions.assign(regions.size() + seeds.size(), 0);
+    carriedColors.clear();
+    for (int key = 1; key < (int)regions.size(); ++key) {
+        carriedRegions[key] = regions.get_pixel_count(key) > 0;
+        // A carried root keeps its color: no new seed may get it
+        if (carriedRegions[key] && regions.is_root(key) && get_context().use_color(regions.get_color(key))) {
+            carriedColors.push_back(regions.get_color(key));
+        }
+    }
+
+    std::vector<int> &colorList = get_context().get_colors();
+    if (randColorization) {
+        generate_random_unique_BGR(seeds.size(), colorList);
+    } else {
+        generate_unique_BGR(src, seeds, colorList);
+    }
+    get_context().release_colors(carriedColors);
+
+    get_context().reserve_scratch(get_thread_pool().get_num_workers());
+    get_context().clear_contacts();
+    cv::Rect area(0, 0, dst.cols, dst.rows);
+    for (size_t i = 0; i < seeds.size(); ++i) {
         if (dst.at<int>(seeds[i]) == 0) {
-            growing(regions, hsvChannels, dst, seeds[i], colorList[i]);
+            int key = regions.add_region(seeds[i], colorList[i]);
+            growing(regions, packed, dst, seeds[i], area, key);
         }
     }
+    if (mergeStrategy == MergeStrategy::Graph) {
+        merge_graph(regions);
+    }
+    carriedRegions.clear();
+
+    flatten_labels(regions, dst);
+    if (fillGaps) {
+        fill_gaps(regions, packed, dst);
+    }
 }
 
 // Public method implementation :
 
-void GrowAndMerge::rg_seg(cv::Mat const& src, cv::Mat & dst, std::vector<cv::Point> & seeds,
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::rg_seg(cv::Mat const& src, cv::Mat & dst, std::vector<cv::Point> & seeds,
                           bool randColorization, bool onlyEdge)
 {
-    cv::Mat buffer = cv::Mat::zeros(src.size(), CV_32S);
+    RG_STAGE("rg_seg");
+    // Starts a new generation of the plane of the context instead of allocating and zeroing a new one
+    labels = get_context().labels_for(src.size());
+    labelArea = cv::Rect(0, 0, src.cols, src.rows);
+
+    seg(src, labels, seeds, regions, randColorization);
+
+    render_mask(dst, onlyEdge);
+    if (!quiet) {
+        std::cout << "Coverage percentage: " << coverage(regions, src.cols, src.rows) * 100 << "%" << std::endl;
+    }
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::rg_seg_update(cv::Mat const& src, cv::Mat & dst, cv::Mat const& dirty, std::vector<cv::Point> & seeds,
+                                 bool randColorization, bool onlyEdge)
+{
+    if (labels.size() != src.size() || regions.size() == 0) {
+        rg_seg(src, dst, seeds, randColorization, onlyEdge);
+        return;
+    }
+
+    RG_STAGE("rg_seg_update");
+    update(src, labels, dirty, seeds, regions, randColorization);
+
+    render_mask(dst, onlyEdge);
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::rg_seg_roi(cv::Mat const& src, cv::Mat & dst, cv::Mat const& roi, std::vector<cv::Point> & seeds,
+                              bool randColorization, bool onlyEdge)
+{
+    CV_Assert(roi.size() == src.size() && roi.type() == CV_8U);
+    cv::Rect area = cv::boundingRect(roi);
+    seg_roi(src, dst, area, roi(area), seeds, randColorization, onlyEdge);
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::rg_seg_roi(cv::Mat const& src, cv::Mat & dst, std::vector<cv::Rect> const& rects,
+                              std::vector<cv::Point> & seeds, bool randColorization, bool onlyEdge)
+{
+    cv::Rect image(0, 0, src.cols, src.rows);
+    cv::Rect area;
+    for (const cv::Rect &rect : rects) {
+        area |= rect & image;
+    }
+
+    // A single rectangle is its own bounding box, every pixel of the area is in
+    cv::Mat areaMask;
+    if (rects.size() > 1 && !area.empty()) {
+        areaMask = cv::Mat::zeros(area.size(), CV_8U);
+        for (const cv::Rect &rect : rects) {
+            areaMask((rect & image) - area.tl()).setTo(255);
+        }
+    }
+    seg_roi(src, dst, area, areaMask, seeds, randColorization, onlyEdge);
+}
+
+/**
+ * @brief Common part of the rg_seg_roi() overloads.
+ *
+ * The image, the seeds and any features given by set_features() are translated to the area, so
+ * the scratch planes of the context, the region statistics and the merge stage only see the area.
+ * The mask, if any, is checked wherever a pixel is claimed (growing and gap filling); the pixels of
+ * the area out of it stay unlabeled. Region bounding boxes and seeds are in area coordinates.
+ */
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::seg_roi(cv::Mat const& src, cv::Mat & dst, cv::Rect const& area, cv::Mat const& areaMask,
+                           std::vector<cv::Point> const& seeds, bool randColorization, bool onlyEdge)
+{
+    RG_STAGE("rg_seg_roi");
+    if (dst.size() != src.size() || dst.type() != CV_8UC3) {
+        dst = cv::Mat::zeros(src.size(), CV_8UC3);
+    }
+    labelArea = area;
+    if (area.empty()) {
+        regions.clear();
+        regions.add_region(cv::Point(-1, -1), 0); // background
+        labels = get_context().labels_for(cv::Size(0, 0));
+        return;
+    }
+
+    std::vector<cv::Point> areaSeeds;
+    for (const cv::Point &seed : seeds) {
+        cv::Point local = seed - area.tl();
+        if (area.contains(seed) && (areaMask.empty() || areaMask.at<uchar>(local))) {
+            areaSeeds.push_back(local);
+        }
+    }
+    if (!sharedFeatures.empty() && sharedFeatures.size() == src.size()) {
+        sharedFeatures = sharedFeatures(area);
+    }
+
+    labels = get_context().labels_for(area.size());
+    roiMask = areaMask;
+    seg(src(area), labels, areaSeeds, regions, randColorization);
+    roiMask.release();
+
+    cv::Mat target = dst(area);
+    if (areaMask.empty()) {
+        render_mask(target, onlyEdge);
+    } else {
+        cv::Mat rendered;
+        render_mask(rendered, onlyEdge);
+        rendered.copyTo(target, areaMask);
+    }
+    if (!quiet) {
+        double roiPixels = areaMask.empty() ? (double)area.area() : (double)cv::countNonZero(areaMask);
+        std::cout << "Coverage percentage: " << coverage(regions, 1, (uint32_t)roiPixels) * 100 << "% of the ROI" << std::endl;
+    }
+}
+
+/**
+ * The upsampling pass is linear but cheap (a lookup and the running sums per pixel); the growing
+ * itself, predicate tests, queue and merge tests, only runs over the boundary band, so on large
+ * smooth areas it scales with the boundary length rather than the area.
+ */
+template <class Predicate, class Connectivity>
+size_t BasicGrowAndMerge<Predicate, Connectivity>::rg_seg_refine(cv::Mat const& src, cv::Mat & dst, BasicGrowAndMerge const& coarse,
+                                                                 int levels, int margin, bool onlyEdge)
+{
+    RG_STAGE("rg_seg_refine");
+    cv::Mat const& coarseLabels = coarse.get_labels();
+    int scale = 1 << levels;
+
+    // Coarse pixels within margin of a boundary, same 4-neighbor test as edge_mask()
+    cv::Mat band(coarseLabels.size(), CV_8U);
+    for (int i = 0; i < coarseLabels.rows; ++i) {
+        edge_row(coarseLabels, i, band.ptr<uchar>(i));
+    }
+    if (margin > 0) {
+        cv::dilate(band, band, cv::Mat::ones(2 * margin + 1, 2 * margin + 1, CV_8U));
+    }
+
+    cv::Mat packed;
+    pack_features(src, packed);
+
+    // Same IDs, colors and intervals; the statistics are those of the full resolution pixels
+    regions = coarse.regions;
+    regions.reset_statistics();
+    for (int key = 1; key < (int)regions.size(); ++key) {
+        cv::Point seed = regions.get_seed(key);
+        if (seed.x >= 0) {
+            regions.set_seed(key, seed * scale);
+        }
+    }
+
+    // Nearest upsampling, the band left unlabeled. Every pixel is written: the plane is of a new generation, but
+    // the growth below reads its labels without the stamps
+    stamps.release();
+    labels = get_context().labels_for(src.size());
+    labelArea = cv::Rect(0, 0, src.cols, src.rows);
+    size_t unlabeled = 0;
+    for (int y = 0; y < labels.rows; ++y) {
+        int cy = std::min(y >> levels, coarseLabels.rows - 1);
+        const int* coarseRow = coarseLabels.ptr<int>(cy);
+        const uchar* bandRow = band.ptr<uchar>(cy);
+        const cv::Vec4b* packedRow = packed.ptr<cv::Vec4b>(y);
+        int* row = labels.ptr<int>(y);
+        for (int x = 0; x < labels.cols; ++x) {
+            int cx = std::min(x >> levels, coarseLabels.cols - 1);
+            row[x] = bandRow[cx] ? 0 : coarseRow[cx];
+            if (bandRow[cx]) {
+                unlabeled++;
+            } else if (row[x] != 0) {
+                update_mean(regions, row[x], cv::Point(x, y), packedRow[x]);
+            }
+        }
+    }
+
+    // Every region is carried: merge() keeps them apart
+    carriedRegions.assign(regions.size(), 1);
+    get_context().reserve_scratch(get_thread_pool().get_num_workers());
+    get_context().clear_contacts();
+    Scratch &scratch = get_context().scratch_for(get_thread_pool().current_worker());
+    cv::Rect area(0, 0, labels.cols, labels.rows);
+
+    // Each unlabeled band pixel is offered to its labeled neighbors, which grow from there
+    RG_TRACE("refine_band");
+    for (int cy = 0; cy < band.rows; ++cy) {
+        const uchar* bandRow = band.ptr<uchar>(cy);
+        for (int cx = 0; cx < band.cols; ++cx) {
+            if (!bandRow[cx]) {
+                continue;
+            }
+            cv::Rect block = cv::Rect(cx * scale, cy * scale, scale, scale) & area;
+            for (int y = block.y; y < block.y + block.height; ++y) {
+                int* row = labels.ptr<int>(y);
+                for (int x = block.x; x < block.x + block.width; ++x) {
+                    for (int n = 0; n < Connectivity::size && row[x] == 0; ++n) {
+                        cv::Point neighbor(x + Connectivity::dx[n], y + Connectivity::dy[n]);
+                        if (area.contains(neighbor) && labels.at<int>(neighbor) != 0) {
+                            grow_queue(regions, packed, labels, scratch, neighbor, area, regions.find(labels.at<int>(neighbor)));
+                        }
+                    }
+                }
+            }
+        }
+    }
+    carriedRegions.clear();
 
-    seg(src, buffer, seeds, regions, randColorization);
+    render_mask(dst, onlyEdge);
+    return unlabeled;
+}
 
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::render_mask(cv::Mat & dst, bool onlyEdge) {
+    RG_STAGE("render_mask");
+    dst.create(labels.size(), CV_8UC3);
     if (onlyEdge) {
-        edge_mask(buffer, dst);
+        edge_mask(regions, labels, dst);
     } else {
-        fill_mask(buffer, dst);
+        fill_mask(regions, labels, dst);
+    }
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::boundary_pixels(std::vector<cv::Point> & pixels) {
+    int grain = row_grain(labels.cols);
+    std::vector<std::vector<cv::Point>> chunks((labels.rows + grain - 1) / grain);
+
+    get_thread_pool().parallel_for(0, labels.rows, grain, [&](int first, int last) {
+        std::vector<uchar> flags(labels.cols);
+        std::vector<cv::Point> &chunk = chunks[first / grain];
+        for (int i = first; i < last; ++i) {
+            edge_row(labels, i, flags.data());
+            const int* row = labels.ptr<int>(i);
+            for (int j = 0; j < labels.cols; ++j) {
+                if (flags[j] && row[j] != 0) {
+                    chunk.emplace_back(j, i);
+                }
+            }
+        }
+    });
+
+    pixels.clear();
+    for (const std::vector<cv::Point> &chunk : chunks) {
+        pixels.insert(pixels.end(), chunk.begin(), chunk.end());
+    }
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::chain_codes(std::vector<Contour> & contours) {
+    // Top-left pixel of every region: the first one in raster order
+    std::vector<cv::Point> first(regions.size(), cv::Point(-1, -1));
+    for (int i = 0; i < labels.rows; ++i) {
+        const int* row = labels.ptr<int>(i);
+        for (int j = 0; j < labels.cols; ++j) {
+            if (first[row[j]].x < 0) {
+                first[row[j]] = cv::Point(j, i);
+            }
+        }
+    }
+
+    contours.clear();
+    for (int id = 1; id < (int)first.size(); ++id) {
+        if (first[id].x >= 0) {
+            contours.push_back({id, first[id], {}});
+        }
     }
-    std::cout << "Coverage percentage: " << coverage(regions, src.cols, src.rows) * 100 << "%" << std::endl;
-}
\ No newline at end of file
+
+    get_thread_pool().parallel_for(0, (int)contours.size(), 16, [&](int begin, int end) {
+        for (int c = begin; c < end; ++c) {
+            trace_contour(labels, contours[c]);
+        }
+    });
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::begin_bands() {
+    // Colors of a previous image that was not ended by region_roots()
+    release_held_colors();
+    holdColors = true;
+    regions.clear();
+    regions.add_region(cv::Point(-1, -1), 0); // background
+    labels.release();
+    labelArea = cv::Rect();
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::grow_band(cv::Mat const& band, int bandY, cv::Mat & bandLabels, std::vector<cv::Point> const& seeds,
+                             cv::Mat const& aboveRow, bool randColorization) {
+    RG_STAGE("grow_band");
+    cv::Mat packed;
+    pack_features(band, packed);
+
+    std::vector<int> &colorList = get_context().get_colors();
+    if (randColorization) {
+        generate_random_unique_BGR(seeds.size(), colorList);
+    } else {
+        generate_unique_BGR(band, seeds, colorList);
+    }
+
+    bandLabels = cv::Mat::zeros(band.size(), CV_32S);
+    stamps.release();
+    get_context().reserve_scratch(get_thread_pool().get_num_workers());
+    get_context().clear_contacts();
+    origin = cv::Point(0, bandY);
+    cv::Rect area(0, 0, band.cols, band.rows);
+    for (size_t i = 0; i < seeds.size(); ++i) {
+        if (bandLabels.at<int>(seeds[i]) == 0) {
+            int key = regions.add_region(seeds[i] + origin, colorList[i]);
+            growing(regions, packed, bandLabels, seeds[i], area, key);
+        }
+    }
+    origin = cv::Point(0, 0);
+
+    // Same border test as stitch_tiles(), against the band above: three neighbors when 8-connected
+    if (!aboveRow.empty()) {
+        Scratch &scratch = get_context().scratch_for(get_thread_pool().current_worker());
+        const int* above = aboveRow.ptr<int>(0);
+        const int* first = bandLabels.ptr<int>(0);
+        int reach = Connectivity::diagonal ? 1 : 0;
+        for (int x = 0; x < band.cols; ++x) {
+            for (int dx = -reach; dx <= reach; ++dx) {
+                if (x + dx >= 0 && x + dx < band.cols) {
+                    stitch_pair(regions, scratch, above[x], first[x + dx]);
+                }
+            }
+        }
+    }
+    if (mergeStrategy == MergeStrategy::Graph) {
+        merge_graph(regions);
+    }
+
+    // Roots change along runs only, so one find() per run is enough
+    for (int i = 0; i < bandLabels.rows; ++i) {
+        int* row = bandLabels.ptr<int>(i);
+        int last = -1, lastRoot = 0;
+        for (int j = 0; j < bandLabels.cols; ++j) {
+            if (row[j] != last) {
+                last = row[j];
+                lastRoot = regions.find(last);
+            }
+            row[j] = lastRoot;
+        }
+    }
+}
+
+template <class Predicate, class Connectivity>
+void BasicGrowAndMerge<Predicate, Connectivity>::region_roots(std::vector<int> & roots) {
+    release_held_colors();
+    roots.resize(regions.size());
+    for (int id = 0; id < (int)regions.size(); ++id) {
+        roots[id] = regions.find(id);
+    }
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include "opencv2/imgproc.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+/**
+ * @brief Compile-time homogeneity and connectivity policies of BasicGrowAndMerge.
+ *
+ * A predicate policy works in a 3-channel 8-bit feature space (convert()), packed to 4 lanes per
+ * pixel. Every region owns two packed words, lowerb and upperb, set from its seed by seed_bounds();
+ * their meaning is up to the policy:
+ * - an interval policy (interval = true) accepts the values with lowerb <= value <= upperb on every
+ *   lane, which lets the NeighborKernel test the 8 neighbors of a pixel at once, and a merge keeps
+ *   the union of the two intervals;
+ * - any other policy implements accepts() per pixel, and a merge keeps the words of the survivor.
+ * accepts_mean() is the merge test, the mean of a region (integer sums over its pixel count) against
+ * the words of the other one; two regions merge when it holds both ways. Every per-pixel test is
+ * integer arithmetic.
+ *
+ * A connectivity policy lists the neighbor offsets in the order process() visits them, each with its
+ * bit in the NeighborKernel mask, and whether diagonal neighbors touch.
+ */
+
+// Common part of the interval policies: lanes 0 to 2 tested against [lowerb, upperb]
+struct IntervalPredicate {
+    static constexpr bool interval = true;
+
+    // O(1)
+    static bool accepts(cv::Vec4b const&, cv::Vec4b const&, cv::Vec4b const&);
+
+    // O(1) - lowerb <= sum / count <= upperb, as lowerb * count <= sum <= upperb * count
+    static bool accepts_mean(cv::Vec4b const&, cv::Vec4b const&, const uint64_t*, uint64_t);
+};
+
+bool IntervalPredicate::accepts(cv::Vec4b const& lowerb, cv::Vec4b const& upperb, cv::Vec4b const& value) {
+    return value[0] >= lowerb[0] && value[0] <= upperb[0] &&
+           value[1] >= lowerb[1] && value[1] <= upperb[1] &&
+           value[2] >= lowerb[2] && value[2] <= upperb[2];
+}
+
+bool IntervalPredicate::accepts_mean(cv::Vec4b const& lowerb, cv::Vec4b const& upperb, const uint64_t* sum, uint64_t count) {
+    for (int c = 0; c < 3; ++c) {
+        // The mean of an empty region is 0
+        if ((uint64_t)lowerb[c] * count > sum[c] || sum[c] > (uint64_t)upperb[c] * count ||
+            (count == 0 && lowerb[c] > 0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// HSV windows picked from the seed: black, gray, white, or a hue band for saturated colors
+struct HsvIntervalPredicate : IntervalPredicate {
+    static void convert(cv::Mat const&, cv::Mat &);
+
+    static void seed_bounds(cv::Vec4b const&, cv::Vec4b &, cv::Vec4b &);
+};
+
+void HsvIntervalPredicate::convert(cv::Mat const& bgr, cv::Mat & features) {
+    cv::cvtColor(bgr, features, cv::COLOR_BGR2HSV);
+}
+
+void HsvIntervalPredicate::seed_bounds(cv::Vec4b const& hsv, cv::Vec4b & lowerb, cv::Vec4b & upperb) {
+    int h = hsv[0], s = hsv[1], v = hsv[2];
+    if (v <= 25) { // Black
+        lowerb = cv::Vec4b(0, 0, (uchar)std::max(0, v - 30), 0);
+        upperb = cv::Vec4b(180, 255, (uchar)(v + 30), 255);
+    } else if (s <= 70) {
+        if (v <= 175) { // Gray
+            lowerb = cv::Vec4b(0, 0, (uchar)std::max(0, v - 40), 0);
+            upperb = cv::Vec4b(180, 45, (uchar)(v + 40), 255);
+        } else { // White
+            lowerb = cv::Vec4b(0, 0, (uchar)(v - 40), 0);
+            upperb = cv::Vec4b(180, 70, (uchar)std::min(255, v + 40), 255);
+        }
+    } else {
+        lowerb = cv::Vec4b((uchar)std::max(0, h - 10), 70, 50, 0);
+        upperb = cv::Vec4b((uchar)std::min(180, h + 10), 255, 255, 255);
+    }
+}
+
+// Gray level within +/- Threshold of the seed
+template <int Threshold = 20>
+struct GrayThresholdPredicate : IntervalPredicate {
+    static void convert(cv::Mat const&, cv::Mat &);
+
+    static void seed_bounds(cv::Vec4b const&, cv::Vec4b &, cv::Vec4b &);
+};
+
+template <int Threshold>
+void GrayThresholdPredicate<Threshold>::convert(cv::Mat const& bgr, cv::Mat & features) {
+    // The gray level is repeated on the three lanes. The gray plane is kept per thread, so that a
+    // stream of images of the same size converts without allocating
+    thread_local cv::Mat gray;
+    cv::cvtColor(bgr, gray, cv::COLOR_BGR2GRAY);
+    cv::cvtColor(gray, features, cv::COLOR_GRAY2BGR);
+}
+
+template <int Threshold>
+void GrayThresholdPredicate<Threshold>::seed_bounds(cv::Vec4b const& value, cv::Vec4b & lowerb, cv::Vec4b & upperb) {
+    uchar lower = (uchar)std::max(0, value[0] - Threshold);
+    uchar upper = (uchar)std::min(255, value[0] + Threshold);
+    lowerb = cv::Vec4b(lower, lower, lower, 0);
+    upperb = cv::Vec4b(upper, upper, upper, 255);
+}
+
+// CIE Lab color (8-bit OpenCV scaling) within Euclidean distance Radius of the seed, held in lowerb
+template <int Radius = 20>
+struct LabDistancePredicate {
+    static constexpr bool interval = false;
+
+    static void convert(cv::Mat const&, cv::Mat &);
+
+    static void seed_bounds(cv::Vec4b const&, cv::Vec4b &, cv::Vec4b &);
+
+    // O(1)
+    static bool accepts(cv::Vec4b const&, cv::Vec4b const&, cv::Vec4b const&);
+
+    // O(1)
+    static bool accepts_mean(cv::Vec4b const&, cv::Vec4b const&, const uint64_t*, uint64_t);
+};
+
+template <int Radius>
+void LabDistancePredicate<Radius>::convert(cv::Mat const& bgr, cv::Mat & features) {
+    cv::cvtColor(bgr, features, cv::COLOR_BGR2Lab);
+}
+
+template <int Radius>
+void LabDistancePredicate<Radius>::seed_bounds(cv::Vec4b const& value, cv::Vec4b & lowerb, cv::Vec4b & upperb) {
+    lowerb = cv::Vec4b(value[0], value[1], value[2], 0);
+    upperb = lowerb;
+}
+
+template <int Radius>
+bool LabDistancePredicate<Radius>::accepts(cv::Vec4b const& center, cv::Vec4b const&, cv::Vec4b const& value) {
+    int d0 = value[0] - center[0], d1 = value[1] - center[1], d2 = value[2] - center[2];
+    return d0 * d0 + d1 * d1 + d2 * d2 <= Radius * Radius;
+}
+
+template <int Radius>
+bool LabDistancePredicate<Radius>::accepts_mean(cv::Vec4b const& center, cv::Vec4b const&, const uint64_t* sum, uint64_t count) {
+    // Once per region contact, not per pixel: the squared sums overflow 64 bits on large regions
+    double distance = 0;
+    for (int c = 0; c < 3; ++c) {
+        double d = (count ? (double)sum[c] / (double)count : 0.0) - center[c];
+        distance += d * d;
+    }
+    return distance <= (double)(Radius * Radius);
+}
+
+// Neighbors in the order of the NeighborKernel mask: dx = -1..1 in the outer loop, dy = -1..1 inside
+struct EightConnected {
+    static constexpr int size = 8;
+    static constexpr bool diagonal = true;
+    static constexpr int dx[8] = {-1, -1, -1, 0, 0, 1, 1, 1};
+    static constexpr int dy[8] = {-1, 0, 1, -1, 1, -1, 0, 1};
+    static constexpr unsigned bit[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+};
+
+struct FourConnected {
+    static constexpr int size = 4;
+    static constexpr bool diagonal = false;
+    static constexpr int dx[4] = {-1, 0, 0, 1};
+    static constexpr int dy[4] = {0, -1, 1, 0};
+    static constexpr unsigned bit[4] = {1, 3, 4, 6};
+};
+
+// Volume neighbors of BasicVolumeSegmenter: the 6 voxels sharing a face
+struct SixConnected {
+    static constexpr int size = 6;
+    static constexpr int dx[6] = {-1, 1, 0, 0, 0, 0};
+    static constexpr int dy[6] = {0, 0, -1, 1, 0, 0};
+    static constexpr int dz[6] = {0, 0, 0, 0, -1, 1};
+};
+
+// Every other voxel of the 3x3x3 cube: dz = -1..1 in the outer loop, then dy, then dx
+struct TwentySixConnected {
+    static constexpr int size = 26;
+    static constexpr int dx[26] = {-1, 0, 1, -1, 0, 1, -1, 0, 1,  -1, 0, 1, -1, 1, -1, 0, 1,  -1, 0, 1, -1, 0, 1, -1, 0, 1};
+    static constexpr int dy[26] = {-1, -1, -1, 0, 0, 0, 1, 1, 1,  -1, -1, -1, 0, 0, 1, 1, 1,  -1, -1, -1, 0, 0, 0, 1, 1, 1};
+    static constexpr int dz[26] = {-1, -1, -1, -1, -1, -1, -1, -1, -1,  0, 0, 0, 0, 0, 0, 0, 0,  1, 1, 1, 1, 1, 1, 1, 1, 1};
+};
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "IntegralImage.hpp"
+
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
@@ -7,26 +9,58 @@
 #include <iostream>
 #include <cmath>
 
+/**
+ * @brief Preprocessed views of one image, each computed on its first request and kept until the next image.
+ *
+ * The blurred BGR image is the input of the seeding and growing stages; the HSV and gray planes and
+ * the HSV summed-area tables are derived from it, so a stage handed one of them gets the pixels it
+ * would have converted itself. The getters return references to the cached views, nothing is copied,
+ * and their buffers are reused by the next image of the same size.
+ *
+ * The original image and the views given to the setters are owned by the caller: they are neither
+ * cloned nor written into, and are dropped from the cache when the image changes.
+ */
 class ImageProcessor {
-public:
+private:
+    // Bits of the ready and borrowed masks
+    static constexpr unsigned RGB = 1, HSV = 2, GRAY = 4, INTEGRAL = 8;
+
     cv::Mat originalImage;
     cv::Mat imageRgb;
     cv::Mat imageHsv;
     cv::Mat imageGray;
+    IntegralImage integralImage;
+
+    int kernelSize = 5;
+
+    unsigned ready = 0;    // views computed or set for the current image
+    unsigned borrowed = 0; // views set by the caller
+
+    // Drops the listed views; borrowed ones are released so that they are never overwritten
+    void invalidate(unsigned);
 
+public:
     ImageProcessor();
     ~ImageProcessor() = default;
 
-    cv::Mat get_image_original() const;
+    const cv::Mat& get_image_original() const;
+
+    // O(pixels) on the first call for the image: Gaussian blur of the original image
+    const cv::Mat& get_image_rgb();
 
-    cv::Mat get_image_rgb() const;
+    // O(pixels) on the first call for the image: HSV of get_image_rgb()
+    const cv::Mat& get_image_hsv();
 
-    cv::Mat get_image_hsv() const;
+    // O(pixels) on the first call for the image: gray level of get_image_rgb()
+    const cv::Mat& get_image_gray();
 
-    cv::Mat get_image_gray() const;
+    // O(pixels) on the first call for the image: summed-area tables of get_image_hsv()
+    const IntegralImage& get_integral_image();
 
+    // Same as process_image()
     void set_image_original(const cv::Mat &);
 
+    // Caller-owned views of the current image, used as they are; the views derived from them are computed again
     void set_image_rgb(const cv::Mat &);
 
     void set_image_hsv(const cv::Mat &);
@@ -35,68 +69,111 @@ public:
 
     void process_image(const char* );
 
-    cv::Mat get_part_of_image(const cv::Point &, const cv::Point &) const;
+    // Same preprocessing for an image that is already decoded (BGR), kept without a copy
+    void process_image(const cv::Mat &);
+
+    cv::Mat get_part_of_image(const cv::Point &, const cv::Point &);
 
+    // Kernel size of the blur of get_image_rgb(), 3 or 5 are good values; the views are computed again
     void filter_image_noise(int kernelSize);
 
 };
 
 ImageProcessor::ImageProcessor() : originalImage(cv::Mat()), imageRgb(cv::Mat()), imageHsv(cv::Mat()), imageGray(cv::Mat()) { }
 
-cv::Mat ImageProcessor::get_image_original() const {
+void ImageProcessor::invalidate(unsigned views) {
+    if (borrowed & views & RGB) {
+        imageRgb.release();
+    }
+    if (borrowed & views & HSV) {
+        imageHsv.release();
+    }
+    if (borrowed & views & GRAY) {
+        imageGray.release();
+    }
+    ready &= ~views;
+    borrowed &= ~views;
+}
+
+const cv::Mat& ImageProcessor::get_image_original() const {
     return originalImage;
 }
 
-cv::Mat ImageProcessor::get_image_rgb() const {
+const cv::Mat& ImageProcessor::get_image_rgb() {
+    if (!(ready & RGB) && !originalImage.empty()) {
+        cv::GaussianBlur(originalImage, imageRgb, cv::Size(kernelSize, kernelSize), 0, 0);
+        ready |= RGB;
+    }
     return imageRgb;
 }
 
-cv::Mat ImageProcessor::get_image_hsv() const {
+const cv::Mat& ImageProcessor::get_image_hsv() {
+    if (!(ready & HSV) && !get_image_rgb().empty()) {
+        cv::cvtColor(imageRgb, imageHsv, cv::COLOR_BGR2HSV);
+        ready |= HSV;
+    }
     return imageHsv;
 }
 
-cv::Mat ImageProcessor::get_image_gray() const {
+const cv::Mat& ImageProcessor::get_image_gray() {
+    if (!(ready & GRAY) && !get_image_rgb().empty()) {
+        cv::cvtColor(imageRgb, imageGray, cv::COLOR_BGR2GRAY);
+        ready |= GRAY;
+    }
     return imageGray;
 }
 
+const IntegralImage& ImageProcessor::get_integral_image() {
+    if (!(ready & INTEGRAL) && !get_image_hsv().empty()) {
+        integralImage.compute_from_hsv(imageHsv);
+        ready |= INTEGRAL;
+    }
+    return integralImage;
+}
+
 void ImageProcessor::set_image_original(const cv::Mat &image) {
-    originalImage = image;
+    process_image(image);
 }
 
 void ImageProcessor::set_image_rgb(const cv::Mat &image) {
+    invalidate(RGB | HSV | GRAY | INTEGRAL);
     imageRgb = image;
+    ready |= RGB;
+    borrowed |= RGB;
 }
 
 void ImageProcessor::set_image_hsv(const cv::Mat &image) {
+    invalidate(HSV | INTEGRAL);
     imageHsv = image;
+    ready |= HSV;
+    borrowed |= HSV;
 }
 
 void ImageProcessor::set_image_gray(const cv::Mat &image) {
+    invalidate(GRAY);
     imageGray = image;
+    ready |= GRAY;
+    borrowed |= GRAY;
 }
 
-// For the Kernel Size : 3 or 5 is a good values
-void ImageProcessor::filter_image_noise(int kernelSize) {
-    cv::GaussianBlur(imageRgb, imageRgb, cv::Size(kernelSize, kernelSize), 0, 0);
-    cv::GaussianBlur(imageHsv, imageHsv, cv::Size(kernelSize, kernelSize), 0, 0);
-    cv::GaussianBlur(imageGray, imageGray, cv::Size(kernelSize, kernelSize), 0, 0);
+void ImageProcessor::filter_image_noise(int size) {
+    kernelSize = size;
+    invalidate(RGB | HSV | GRAY | INTEGRAL);
 }
 
 void ImageProcessor::process_image(const char* imagePath) {
-    originalImage = cv::imread(imagePath, cv::IMREAD_COLOR);
+    process_image(cv::imread(imagePath, cv::IMREAD_COLOR));
 
     if (!originalImage.data) {
         printf("No image data\n");
-        return;
     }
+}
 
-    set_image_rgb(originalImage.clone());
-    cv::cvtColor(originalImage, imageHsv, cv::COLOR_BGR2HSV);
-    cv::cvtColor(originalImage, imageGray, cv::COLOR_BGR2GRAY);
-
-    filter_image_noise(5);
+void ImageProcessor::process_image(const cv::Mat &image) {
+    invalidate(RGB | HSV | GRAY | INTEGRAL);
+    originalImage = image;
 }
 
-cv::Mat ImageProcessor::get_part_of_image(const cv::Point &top_left, const cv::Point &bottom_right) const {
-   return imageRgb(cv::Rect(top_left, bottom_right));
+cv::Mat ImageProcessor::get_part_of_image(const cv::Point &top_left, const cv::Point &bottom_right) {
+   return get_image_rgb()(cv::Rect(top_left, bottom_right));
 }
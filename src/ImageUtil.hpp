@@ -1,8 +1,7 @@
 #pragma once
 
 #include "GermsPositioning.hpp"
-
-#include <list>
+#include "LinearQuadtree.hpp"
 
 
 class ImageUtil {
@@ -13,12 +12,18 @@ public:
 
     double get_hsv_variance(const cv::Mat &);
 
+    // Same as get_hsv_variance, for an image already converted to HSV (see ImageProcessor::get_image_hsv)
+    double get_hsv_plane_variance(const cv::Mat &);
+
     double get_grayscale_variance(const cv::Mat &);
 
     double calculate_variance(const cv::Mat &, const bool &);
 
     double calculate_region_variance(const cv::Mat &, const cv::Point &, const cv::Point &);
 
+    // Same as calculate_region_variance, on a view of the HSV plane instead of converting the region
+    double calculate_hsv_region_variance(const cv::Mat &, const cv::Point &, const cv::Point &);
+
     float pixel_surface(cv::Point, cv::Point) const;
 
     cv::Point calculate_middle_point(const cv::Point&, const cv::Point&);
@@ -59,6 +64,8 @@ double ImageUtil::calculate_channel_variance(const cv::Mat & hsvImage, int chann
 
     cv::Mat channel;
     cv::extractChannel(hsvImage, channel, channelIndex);
+    // On CV_8U, absdiff rounds the mean and mul saturates every squared deviation at 255, as
+    // IntegralImage::region_variance reproduces
 
     cv::Scalar meanIntensity = cv::mean(channel);
     cv::Mat diff;
@@ -73,6 +80,10 @@ double ImageUtil::calculate_channel_variance(const cv::Mat & hsvImage, int chann
 double ImageUtil::get_hsv_variance(const cv::Mat &imageRgb) {
     cv::Mat hsvImage;
     cv::cvtColor(imageRgb, hsvImage, cv::COLOR_BGR2HSV);
+    return get_hsv_plane_variance(hsvImage);
+}
+
+double ImageUtil::get_hsv_plane_variance(const cv::Mat &hsvImage) {
     double varianceHue = calculate_channel_variance(hsvImage, 0);
     double varianceSaturation = calculate_channel_variance(hsvImage, 1);
     double varianceValue = calculate_channel_variance(hsvImage, 2);
@@ -117,6 +128,16 @@ double ImageUtil::calculate_region_variance(const cv::Mat& image, const cv::Poin
     return calculate_variance(roi, 1);
 }
 
+double ImageUtil::calculate_hsv_region_variance(const cv::Mat& hsvImage, const cv::Point & topLeft, const cv::Point & bottomRight) {
+    if (topLeft.x < 0 || topLeft.y < 0 || bottomRight.x > hsvImage.cols || bottomRight.y > hsvImage.rows) {
+
+        std::cerr << "Points de région invalides. TopLeft: " << topLeft << ", BottomRight: " << bottomRight << "\n Car :" << hsvImage.cols << "--" << hsvImage.rows << std::endl;
+        return -1.0;
+    }
+
+    return get_hsv_plane_variance(hsvImage(cv::Rect(topLeft, bottomRight)));
+}
+
 float ImageUtil::pixel_surface(cv::Point point1, cv::Point point2) const {
     float dX = std::abs(point1.x - point2.x);
     float dY = std::abs(point1.y - point2.y);
@@ -132,7 +153,7 @@ class GermsDisplay {
 public:
     void draw_framing(cv::Mat &, int, cv::Scalar);
     void display_germs(cv::Mat const &, cv::Mat &, std::vector<cv::Point> const &);
-    void display_segmented_regions(cv::Mat const &, cv::Mat const &, const std::list<SegmentedRegion> &, cv::Scalar);
+    void display_segmented_regions(cv::Mat const &, cv::Mat const &, const LinearQuadtree &, cv::Scalar);
 };
 
 // Implementation :
@@ -173,8 +194,8 @@ void GermsDisplay::display_germs(cv::Mat const & src, cv::Mat & dst, std::vector
     }
 }
 
-void GermsDisplay::display_segmented_regions(cv::Mat const & src, cv::Mat const & dst, const std::list<SegmentedRegion> & segmentedRegions, cv::Scalar color) {
-    for (const auto& region : segmentedRegions) {
-        cv::rectangle(dst, region.getTopLeftPoint(), region.getBottomRightPoint(), color);
+void GermsDisplay::display_segmented_regions(cv::Mat const & src, cv::Mat const & dst, const LinearQuadtree & quadtree, cv::Scalar color) {
+    for (int leaf = 0; leaf < (int)quadtree.size(); ++leaf) {
+        cv::rectangle(dst, quadtree.get_top_left(leaf), quadtree.get_bottom_right(leaf), color);
     }
 }
\ No newline at end of file
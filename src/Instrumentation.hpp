@@ -0,0 +1,474 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+/**
+ * @brief Hot-path counters and per-thread timeline, compiled out unless RG_INSTRUMENTATION is defined.
+ *
+ * The code under measurement only uses the RG_COUNT, RG_HIGH_WATER, RG_TRACE and RG_STAGE macros,
+ * which expand to nothing in a normal build. With the flag (cmake -DRG_INSTRUMENTATION=ON):
+ * - every thread bumps its own counters, summed (or maxed for high-water marks) on read;
+ * - RG_TRACE(name) records a begin / end event of the enclosing scope in the timeline of the thread;
+ * - RG_STAGE(name) does the same and adds the counter deltas of the scope to the totals of the
+ *   stage, together with the peak of the heap allocated through operator new during the stage.
+ *   The deltas are global, so they are exact when stages do not overlap in time (single image,
+ *   seg_bench), not in the overlapped stages of the batch mode.
+ *
+ * write_json() exports the stage totals, write_chrome_trace() the timeline in the Trace Event
+ * format of chrome://tracing and Perfetto. Both should be called once the measured work is done.
+ */
+class Instrumentation {
+public:
+    enum Counter {
+        PixelsDequeued,       // pixels taken from the growing queue, or covered by the runs of the span engine
+        PredicateEvaluations, // pixel tests against a region interval
+        MergesAttempted,      // merge tests between two different regions
+        MergesPerformed,
+        ContactsRecorded,     // region pairs appended to the adjacency graph of MergeStrategy::Graph
+        PixelsRelabeled,      // pixels rewritten to their root ID by flatten_labels()
+        QueueHighWater,       // longest growing queue (pixels) or run list (runs)
+        QuadtreeNodes,        // quads visited by the seeding
+        NUM_COUNTERS
+    };
+
+    class Scope {
+    private:
+        const char* name;
+        int64_t start;
+
+    public:
+        explicit Scope(const char*);
+
+        ~Scope();
+    };
+
+    class Stage {
+    private:
+        const char* name;
+        int64_t start;
+        std::array<uint64_t, NUM_COUNTERS> before;
+        size_t heapBefore;
+        size_t savedPeak;
+
+    public:
+        explicit Stage(const char*);
+
+        ~Stage();
+    };
+
+private:
+    struct Event {
+        const char* name;
+        int64_t start; // us since the epoch
+        int64_t end;
+    };
+
+    // Written by its thread only; the counters are atomics so that they can be read at any time
+    struct ThreadLog {
+        int index;
+        std::array<std::atomic<uint64_t>, NUM_COUNTERS> counters;
+        std::mutex eventMutex;
+        std::vector<Event> events;
+    };
+
+    struct StageTotals {
+        uint64_t calls = 0;
+        double totalMs = 0;
+        std::array<uint64_t, NUM_COUNTERS> counters{};
+        size_t peakHeapBytes = 0;
+        long maxRssKb = 0;
+    };
+
+    std::mutex mutex;
+    std::vector<std::unique_ptr<ThreadLog>> logs; // kept after their thread exits
+    std::vector<std::string> stageOrder;
+    std::map<std::string, StageTotals> stages;
+    std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    static std::atomic<size_t> &heap_in_use();
+
+    static std::atomic<size_t> &heap_peak();
+
+    static std::atomic<uint64_t> &heap_allocation_count();
+
+    static bool is_high_water(int);
+
+    static const char* counter_name(int);
+
+    static long max_rss_kb();
+
+    ThreadLog &local();
+
+    void snapshot(std::array<uint64_t, NUM_COUNTERS> &);
+
+    void reset_high_water();
+
+    void record(const char*, int64_t, int64_t);
+
+    void add_stage(const char*, double, std::array<uint64_t, NUM_COUNTERS> const&, size_t);
+
+public:
+    static Instrumentation &global();
+
+    // True when the build records anything
+    static constexpr bool enabled();
+
+    void count(Counter, uint64_t);
+
+    void high_water(Counter, uint64_t);
+
+    // Microseconds since the creation of the instrumentation
+    int64_t now() const;
+
+    // Forgets the stage totals, keeps the timeline
+    void reset_stages();
+
+    void write_json(std::ostream &);
+
+    void write_chrome_trace(std::ostream &);
+
+    static void on_allocate(size_t);
+
+    static void on_free(size_t);
+
+    // Calls to operator new so far. A new cv::Mat buffer counts once, for its UMatData header (allocated
+    // with new); its data comes from cv::fastMalloc and is not counted. Always 0 unless the heap is
+    // accounted: RG_INSTRUMENTATION or RG_HEAP_ACCOUNTING
+    static uint64_t heap_allocations();
+};
+
+#define RG_INSTRUMENTATION_CONCAT_(a, b) a##b
+#define RG_INSTRUMENTATION_CONCAT(a, b) RG_INSTRUMENTATION_CONCAT_(a, b)
+
+#if defined(RG_INSTRUMENTATION)
+#define RG_COUNT(counter, n) Instrumentation::global().count(Instrumentation::counter, (uint64_t)(n))
+#define RG_HIGH_WATER(counter, n) Instrumentation::global().high_water(Instrumentation::counter, (uint64_t)(n))
+#define RG_TRACE(name) Instrumentation::Scope RG_INSTRUMENTATION_CONCAT(rgTraceScope, __LINE__)(name)
+#define RG_STAGE(name) Instrumentation::Stage RG_INSTRUMENTATION_CONCAT(rgStage, __LINE__)(name)
+#else
+#define RG_COUNT(counter, n) ((void)0)
+#define RG_HIGH_WATER(counter, n) ((void)0)
+#define RG_TRACE(name) ((void)0)
+#define RG_STAGE(name) ((void)0)
+#endif
+
+Instrumentation &Instrumentation::global() {
+    static Instrumentation instance;
+    return instance;
+}
+
+constexpr bool Instrumentation::enabled() {
+#if defined(RG_INSTRUMENTATION)
+    return true;
+#else
+    return false;
+#endif
+}
+
+std::atomic<size_t> &Instrumentation::heap_in_use() {
+    // Constant-initialized, usable by operator new before main()
+    static std::atomic<size_t> bytes{0};
+    return bytes;
+}
+
+std::atomic<size_t> &Instrumentation::heap_peak() {
+    static std::atomic<size_t> bytes{0};
+    return bytes;
+}
+
+std::atomic<uint64_t> &Instrumentation::heap_allocation_count() {
+    static std::atomic<uint64_t> count{0};
+    return count;
+}
+
+uint64_t Instrumentation::heap_allocations() {
+    return heap_allocation_count().load(std::memory_order_relaxed);
+}
+
+void Instrumentation::on_allocate(size_t size) {
+    heap_allocation_count().fetch_add(1, std::memory_order_relaxed);
+    size_t inUse = heap_in_use().fetch_add(size, std::memory_order_relaxed) + size;
+    size_t peak = heap_peak().load(std::memory_order_relaxed);
+    while (inUse > peak && !heap_peak().compare_exchange_weak(peak, inUse, std::memory_order_relaxed)) {
+    }
+}
+
+void Instrumentation::on_free(size_t size) {
+    heap_in_use().fetch_sub(size, std::memory_order_relaxed);
+}
+
+bool Instrumentation::is_high_water(int counter) {
+    return counter == QueueHighWater;
+}
+
+const char* Instrumentation::counter_name(int counter) {
+    static const char* names[NUM_COUNTERS] = {"pixels_dequeued", "predicate_evaluations", "merges_attempted",
+                                              "merges_performed", "contacts_recorded", "pixels_relabeled",
+                                              "queue_high_water", "quadtree_nodes"};
+    return names[counter];
+}
+
+long Instrumentation::max_rss_kb() {
+#if defined(__unix__) || defined(__APPLE__)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+#if defined(__APPLE__)
+        return usage.ru_maxrss / 1024; // bytes on macOS
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+#endif
+    return 0;
+}
+
+Instrumentation::ThreadLog &Instrumentation::local() {
+    thread_local ThreadLog* log = nullptr;
+    if (!log) {
+        std::lock_guard<std::mutex> guard(mutex);
+        logs.emplace_back(new ThreadLog());
+        log = logs.back().get();
+        log->index = (int)logs.size() - 1;
+        for (auto &counter : log->counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+    }
+    return *log;
+}
+
+void Instrumentation::count(Counter counter, uint64_t n) {
+    // Only this thread writes its counter: a load and a store are enough
+    std::atomic<uint64_t> &value = local().counters[counter];
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void Instrumentation::high_water(Counter counter, uint64_t n) {
+    // Reset by other threads at the start of a stage, hence the compare-exchange
+    std::atomic<uint64_t> &value = local().counters[counter];
+    uint64_t current = value.load(std::memory_order_relaxed);
+    while (n > current && !value.compare_exchange_weak(current, n, std::memory_order_relaxed)) {
+    }
+}
+
+int64_t Instrumentation::now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Instrumentation::snapshot(std::array<uint64_t, NUM_COUNTERS> &totals) {
+    totals.fill(0);
+    std::lock_guard<std::mutex> guard(mutex);
+    for (const auto &log : logs) {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            uint64_t value = log->counters[c].load(std::memory_order_relaxed);
+            totals[c] = is_high_water(c) ? std::max(totals[c], value) : totals[c] + value;
+        }
+    }
+}
+
+void Instrumentation::reset_high_water() {
+    std::lock_guard<std::mutex> guard(mutex);
+    for (const auto &log : logs) {
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            if (is_high_water(c)) {
+                log->counters[c].store(0, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+void Instrumentation::record(const char* name, int64_t start, int64_t end) {
+    ThreadLog &log = local();
+    std::lock_guard<std::mutex> guard(log.eventMutex);
+    log.events.push_back({name, start, end});
+}
+
+void Instrumentation::add_stage(const char* name, double ms, std::array<uint64_t, NUM_COUNTERS> const& delta,
+                                size_t peakHeapBytes) {
+    long rss = max_rss_kb();
+    std::lock_guard<std::mutex> guard(mutex);
+    auto it = stages.find(name);
+    if (it == stages.end()) {
+        stageOrder.push_back(name);
+        it = stages.emplace(name, StageTotals()).first;
+    }
+    StageTotals &totals = it->second;
+    totals.calls++;
+    totals.totalMs += ms;
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        totals.counters[c] = is_high_water(c) ? std::max(totals.counters[c], delta[c]) : totals.counters[c] + delta[c];
+    }
+    totals.peakHeapBytes = std::max(totals.peakHeapBytes, peakHeapBytes);
+    totals.maxRssKb = std::max(totals.maxRssKb, rss);
+}
+
+void Instrumentation::reset_stages() {
+    std::lock_guard<std::mutex> guard(mutex);
+    stages.clear();
+    stageOrder.clear();
+}
+
+void Instrumentation::write_json(std::ostream &os) {
+    std::lock_guard<std::mutex> guard(mutex);
+    os << "{\n  \"enabled\": " << (enabled() ? "true" : "false") << ",\n  \"stages\": [";
+    for (size_t s = 0; s < stageOrder.size(); ++s) {
+        const StageTotals &totals = stages[stageOrder[s]];
+        os << (s ? "," : "") << "\n    {\"name\": \"" << stageOrder[s] << "\", \"calls\": " << totals.calls
+           << ", \"total_ms\": " << totals.totalMs << ", \"counters\": {";
+        for (int c = 0; c < NUM_COUNTERS; ++c) {
+            os << (c ? ", " : "") << "\"" << counter_name(c) << "\": " << totals.counters[c];
+        }
+        os << "}, \"peak_heap_bytes\": " << totals.peakHeapBytes << ", \"max_rss_kb\": " << totals.maxRssKb << "}";
+    }
+    os << "\n  ]\n}\n";
+}
+
+void Instrumentation::write_chrome_trace(std::ostream &os) {
+    std::lock_guard<std::mutex> guard(mutex);
+    os << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for (const auto &log : logs) {
+        os << (first ? "" : ",") << "\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": " << log->index
+           << ", \"args\": {\"name\": \"thread " << log->index << "\"}}";
+        first = false;
+
+        std::lock_guard<std::mutex> eventGuard(log->eventMutex);
+        for (const Event &event : log->events) {
+            os << ",\n{\"name\": \"" << event.name << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << log->index
+               << ", \"ts\": " << event.start << ", \"dur\": " << (event.end - event.start) << "}";
+        }
+    }
+    os << "\n]}\n";
+}
+
+Instrumentation::Scope::Scope(const char* name) : name(name), start(Instrumentation::global().now()) {
+}
+
+Instrumentation::Scope::~Scope() {
+    Instrumentation &instrumentation = Instrumentation::global();
+    instrumentation.record(name, start, instrumentation.now());
+}
+
+Instrumentation::Stage::Stage(const char* name) : name(name) {
+    Instrumentation &instrumentation = Instrumentation::global();
+    instrumentation.snapshot(before);
+    instrumentation.reset_high_water();
+    heapBefore = heap_in_use().load(std::memory_order_relaxed);
+    savedPeak = heap_peak().exchange(heapBefore, std::memory_order_relaxed);
+    start = instrumentation.now();
+}
+
+Instrumentation::Stage::~Stage() {
+    Instrumentation &instrumentation = Instrumentation::global();
+    int64_t end = instrumentation.now();
+
+    std::array<uint64_t, NUM_COUNTERS> after;
+    instrumentation.snapshot(after);
+    for (int c = 0; c < NUM_COUNTERS; ++c) {
+        if (is_high_water(c)) {
+            // Put back the mark of an enclosing stage, reset at the start of this one
+            instrumentation.high_water((Counter)c, std::max(before[c], after[c]));
+        } else {
+            after[c] -= before[c];
+        }
+    }
+
+    // The peak of an enclosing stage must survive this one
+    size_t peak = heap_peak().load(std::memory_order_relaxed);
+    size_t stagePeak = peak > heapBefore ? peak - heapBefore : 0;
+    size_t restored = std::max(peak, savedPeak);
+    heap_peak().store(restored, std::memory_order_relaxed);
+
+    instrumentation.record(name, start, end);
+    instrumentation.add_stage(name, (double)(end - start) / 1000.0, after, stagePeak);
+}
+
+#if defined(RG_INSTRUMENTATION) || defined(RG_HEAP_ACCOUNTING)
+
+// Heap accounting: the size is kept in front of the block. RG_HEAP_ACCOUNTING enables it alone, without
+// the counters and timelines, for the allocation counts of seg_bench. Every non-aligned form is replaced,
+// not only the two the others default to, since sanitizers replace them all. The data of a cv::Mat comes
+// from cv::fastMalloc and is not seen, max_rss_kb covers it; its UMatData header is allocated with new and
+// counts as one allocation, so a new Mat buffer still shows up in the count.
+static constexpr size_t RG_HEAP_HEADER = alignof(std::max_align_t);
+
+void* rg_heap_allocate(size_t size) noexcept {
+    void* block = std::malloc(size + RG_HEAP_HEADER);
+    if (!block) {
+        return nullptr;
+    }
+    *(size_t*)block = size;
+    Instrumentation::on_allocate(size);
+    return (char*)block + RG_HEAP_HEADER;
+}
+
+void rg_heap_free(void* pointer) noexcept {
+    if (!pointer) {
+        return;
+    }
+    char* block = (char*)pointer - RG_HEAP_HEADER;
+    Instrumentation::on_free(*(size_t*)block);
+    std::free(block);
+}
+
+void* operator new(size_t size) {
+    void* pointer = rg_heap_allocate(size);
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t &) noexcept {
+    return rg_heap_allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t &) noexcept {
+    return rg_heap_allocate(size);
+}
+
+void operator delete(void* pointer) noexcept {
+    rg_heap_free(pointer);
+}
+
+void operator delete[](void* pointer) noexcept {
+    rg_heap_free(pointer);
+}
+
+void operator delete(void* pointer, size_t) noexcept {
+    rg_heap_free(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept {
+    rg_heap_free(pointer);
+}
+
+void operator delete(void* pointer, const std::nothrow_t &) noexcept {
+    rg_heap_free(pointer);
+}
+
+void operator delete[](void* pointer, const std::nothrow_t &) noexcept {
+    rg_heap_free(pointer);
+}
+
+#endif
@@ -0,0 +1,159 @@
+#pragma once
+
+#include "opencv2/imgproc.hpp"
+
+#include <iostream>
+
+/**
+ * @brief Summed-area tables of the HSV channels and of their squares.
+ *
+ * Built once per image in O(pixels); afterwards the mean and the population variance of any
+ * axis-aligned rectangle are four lookups per channel. Both tables are CV_64F, which holds the
+ * sums exactly for images up to 2^53 / 255^2 pixels.
+ *
+ * region_variance() is the variance of ImageUtil::calculate_region_variance, which is not the
+ * population one: on CV_8U, absdiff rounds the mean and mul saturates every squared deviation at
+ * 255. No sum reproduces that saturation, so only its mean comes from the tables and the
+ * deviations are summed over the HSV plane, kept with the tables.
+ */
+class IntegralImage {
+private:
+    cv::Mat hsv; // the plane of compute_from_hsv() is kept without a copy
+    cv::Mat sum;
+    cv::Mat sqSum;
+
+    cv::Vec3d rect_sum(const cv::Mat &, const cv::Point &, const cv::Point &) const;
+
+public:
+    // O(pixels)
+    void compute(const cv::Mat &);
+
+    // O(pixels), for an image already converted to HSV, kept without a copy: it must not change while queried
+    void compute_from_hsv(const cv::Mat &);
+
+    bool empty() const;
+
+    cv::Size size() const;
+
+    // O(region area)
+    double region_variance(const cv::Point &, const cv::Point &) const;
+
+    // O(1) - mean of the population variances of the three channels
+    double region_population_variance(const cv::Point &, const cv::Point &) const;
+
+    // O(1) - per channel sums of the values and of their squares over [topLeft, bottomRight)
+    void region_sums(const cv::Point &, const cv::Point &, cv::Vec3d &, cv::Vec3d &) const;
+
+    // O(1)
+    cv::Vec3d region_mean(const cv::Point &, const cv::Point &) const;
+};
+
+void IntegralImage::compute(const cv::Mat &imageRgb) {
+    cv::cvtColor(imageRgb, hsv, cv::COLOR_BGR2HSV);
+    cv::integral(hsv, sum, sqSum, CV_64F, CV_64F);
+}
+
+void IntegralImage::compute_from_hsv(const cv::Mat &hsvImage) {
+    hsv = hsvImage;
+    cv::integral(hsvImage, sum, sqSum, CV_64F, CV_64F);
+}
+
+bool IntegralImage::empty() const {
+    return sum.empty();
+}
+
+cv::Size IntegralImage::size() const {
+    return sum.empty() ? cv::Size() : cv::Size(sum.cols - 1, sum.rows - 1);
+}
+
+cv::Vec3d IntegralImage::rect_sum(const cv::Mat &table, const cv::Point &topLeft, const cv::Point &bottomRight) const {
+    const cv::Vec3d &a = table.at<cv::Vec3d>(topLeft.y, topLeft.x);
+    const cv::Vec3d &b = table.at<cv::Vec3d>(topLeft.y, bottomRight.x);
+    const cv::Vec3d &c = table.at<cv::Vec3d>(bottomRight.y, topLeft.x);
+    const cv::Vec3d &d = table.at<cv::Vec3d>(bottomRight.y, bottomRight.x);
+    return {d[0] - b[0] - c[0] + a[0], d[1] - b[1] - c[1] + a[1], d[2] - b[2] - c[2] + a[2]};
+}
+
+void IntegralImage::region_sums(const cv::Point &topLeft, const cv::Point &bottomRight, cv::Vec3d &values,
+                                cv::Vec3d &squares) const {
+    values = rect_sum(sum, topLeft, bottomRight);
+    squares = rect_sum(sqSum, topLeft, bottomRight);
+}
+
+cv::Vec3d IntegralImage::region_mean(const cv::Point &topLeft, const cv::Point &bottomRight) const {
+    double count = (double)(bottomRight.x - topLeft.x) * (bottomRight.y - topLeft.y);
+    if (count <= 0) {
+        return {0, 0, 0};
+    }
+    cv::Vec3d s = rect_sum(sum, topLeft, bottomRight);
+    return {s[0] / count, s[1] / count, s[2] / count};
+}
+
+/**
+ * @brief Mean of the three HSV channel variances over the region [topLeft, bottomRight).
+ *
+ * Bit for bit ImageUtil::calculate_region_variance, with the same invalid-region handling (-1.0):
+ * per channel, the mean of min((v - m)², 255) where m is the channel mean rounded to an integer,
+ * cv::mean's sum times the inverse of the count taken for both means. One pass over the region
+ * instead of the conversion, channel extraction and three temporaries per channel.
+ */
+double IntegralImage::region_variance(const cv::Point &topLeft, const cv::Point &bottomRight) const {
+    cv::Size imageSize = size();
+    if (topLeft.x < 0 || topLeft.y < 0 || bottomRight.x > imageSize.width || bottomRight.y > imageSize.height) {
+        std::cerr << "Points de région invalides. TopLeft: " << topLeft << ", BottomRight: " << bottomRight << "\n Car :" << imageSize.width << "--" << imageSize.height << std::endl;
+        return -1.0;
+    }
+
+    cv::Rect region(topLeft, bottomRight);
+    double count = (double)region.area();
+    if (count <= 0) {
+        return 0.0;
+    }
+    double scale = 1.0 / count;
+
+    cv::Vec3d s = rect_sum(sum, region.tl(), region.br());
+    int means[3];
+    for (int c = 0; c < 3; ++c) {
+        means[c] = cvRound(s[c] * scale);
+    }
+    uint64_t deviations[3] = {0, 0, 0};
+    for (int y = region.y; y < region.y + region.height; ++y) {
+        const cv::Vec3b* row = hsv.ptr<cv::Vec3b>(y);
+        for (int x = region.x; x < region.x + region.width; ++x) {
+            for (int c = 0; c < 3; ++c) {
+                int d = row[x][c] - means[c];
+                deviations[c] += (uint64_t)std::min(d * d, 255);
+            }
+        }
+    }
+    return ((double)deviations[0] * scale + (double)deviations[1] * scale + (double)deviations[2] * scale) / 3.0;
+}
+
+/**
+ * @brief Mean of the three HSV channel population variances over the region [topLeft, bottomRight).
+ *
+ * E[x²] - E[x]² from the tables, same region convention and invalid-region handling as
+ * region_variance(). Larger than region_variance() wherever deviations saturate there.
+ */
+double IntegralImage::region_population_variance(const cv::Point &topLeft, const cv::Point &bottomRight) const {
+    cv::Size imageSize = size();
+    if (topLeft.x < 0 || topLeft.y < 0 || bottomRight.x > imageSize.width || bottomRight.y > imageSize.height) {
+        std::cerr << "Points de région invalides. TopLeft: " << topLeft << ", BottomRight: " << bottomRight << "\n Car :" << imageSize.width << "--" << imageSize.height << std::endl;
+        return -1.0;
+    }
+
+    cv::Point tl(std::min(topLeft.x, bottomRight.x), std::min(topLeft.y, bottomRight.y));
+    cv::Point br(std::max(topLeft.x, bottomRight.x), std::max(topLeft.y, bottomRight.y));
+    double count = (double)(br.x - tl.x) * (br.y - tl.y);
+    if (count <= 0) {
+        return 0.0;
+    }
+
+    cv::Vec3d s = rect_sum(sum, tl, br);
+    cv::Vec3d sq = rect_sum(sqSum, tl, br);
+    double variance = 0.0;
+    for (int c = 0; c < 3; ++c) {
+        variance += std::max(0.0, count * sq[c] - s[c] * s[c]) / (count * count);
+    }
+    return variance / 3.0;
+}
@@ -0,0 +1,417 @@
+#pragma once
+
+#include "opencv2/core.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <istream>
+#include <numeric>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief Leaves of a quadtree over an image, stored as a structure of arrays in Morton order.
+ *
+ * A quad is split at the midpoints of its sides into the top-left, top-right, bottom-left and
+ * bottom-right quadrants, numbered 0 to 3 ((y bit << 1) | x bit). Its location code holds the
+ * quadrant of every level from the root down, two bits per level, which is also the Morton code
+ * (interleaved x and y bits) of the quad in the 2^level x 2^level grid of its level. Parent and
+ * children are shifts of the code. Only the leaves are stored; sorted by their code scaled to
+ * MAX_LEVEL, a sweep of the arrays visits the image in Z order and any part of the image is a
+ * contiguous range of leaves.
+ *
+ * The pixel bounds of a leaf are the ones the subdivision computed, so the quads of an image
+ * whose sides are not powers of two keep their exact (uneven) sizes.
+ */
+class LinearQuadtree {
+public:
+    static constexpr int MAX_LEVEL = 30;
+
+private:
+    cv::Rect root;
+
+    std::vector<uint64_t> codes;
+    std::vector<uint8_t> levels;
+    std::vector<double> variances; // -1: leaf forced by the depth limit
+    std::vector<cv::Point> topLeft;
+    std::vector<cv::Point> bottomRight; // exclusive
+
+    // Position of the leaf in the grid of MAX_LEVEL, the sort key
+    uint64_t key(int) const;
+
+    // Number of MAX_LEVEL cells covered by a quad of the level
+    static uint64_t span(int);
+
+    static uint64_t spread(uint32_t);
+
+    static uint32_t compact(uint64_t);
+
+    // O(log(leaves)) - first leaf whose key is at least the given one, size() when there is none
+    int lower_leaf(uint64_t) const;
+
+public:
+    // O(1) - Morton code of the cell (x, y)
+    static uint64_t encode(uint32_t, uint32_t);
+
+    // O(1) - cell of the Morton code
+    static cv::Point decode(uint64_t);
+
+    // O(1)
+    static uint64_t parent_code(uint64_t);
+
+    // O(1) - child in the quadrant 0 (top-left) to 3 (bottom-right)
+    static uint64_t child_code(uint64_t, int);
+
+    // O(1)
+    static int quadrant_of(uint64_t);
+
+    // Empties the tree of the image area
+    void clear(cv::Rect const&);
+
+    void reserve(size_t);
+
+    cv::Rect get_root() const;
+
+    // O(1) amortized - leaves may be added in any order, then sort()
+    void add_leaf(uint64_t, int, cv::Point const&, cv::Point const&, double);
+
+    // O(leaves of the other tree) - leaves of a tree of the same root, e.g. built by another thread
+    void append(LinearQuadtree const&);
+
+    // O(level) - same, the code and level found by splitting the root down to the quad
+    bool add_leaf(cv::Point const&, cv::Point const&, double);
+
+    // O(leaves log(leaves)) - Morton order
+    void sort();
+
+    size_t size() const;
+
+    bool empty() const;
+
+    uint64_t get_code(int) const;
+
+    int get_level(int) const;
+
+    double get_variance(int) const;
+
+    cv::Point get_top_left(int) const;
+
+    cv::Point get_bottom_right(int) const;
+
+    // O(1) - seed position of the leaf
+    cv::Point get_center(int) const;
+
+    // O(log(leaves)) - leaf covering the quad of the code and level (itself or an ancestor), -1 when none
+    int find(uint64_t, int) const;
+
+    // O(log(leaves) + neighbors) - leaves sharing a side with the leaf, in Morton order
+    void neighbors(int, std::vector<int> &) const;
+
+    // O(leaves) - raw arrays, little-endian hosts only
+    void write(std::ostream &) const;
+
+    // O(leaves) - false, leaving the tree empty, when the stream does not hold a whole tree: a leaf count larger
+    // than the area or than the bytes left, a short array or a level past MAX_LEVEL
+    bool read(std::istream &);
+};
+
+uint64_t LinearQuadtree::key(int leaf) const {
+    return codes[leaf] << (2 * (MAX_LEVEL - levels[leaf]));
+}
+
+uint64_t LinearQuadtree::span(int level) {
+    return (uint64_t)1 << (2 * (MAX_LEVEL - level));
+}
+
+uint64_t LinearQuadtree::spread(uint32_t value) {
+    uint64_t x = value;
+    x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x << 2)) & 0x3333333333333333ull;
+    x = (x | (x << 1)) & 0x5555555555555555ull;
+    return x;
+}
+
+uint32_t LinearQuadtree::compact(uint64_t value) {
+    uint64_t x = value & 0x5555555555555555ull;
+    x = (x | (x >> 1)) & 0x3333333333333333ull;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0Full;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFull;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFull;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFull;
+    return (uint32_t)x;
+}
+
+uint64_t LinearQuadtree::encode(uint32_t x, uint32_t y) {
+    return spread(x) | (spread(y) << 1);
+}
+
+cv::Point LinearQuadtree::decode(uint64_t code) {
+    return {(int)compact(code), (int)compact(code >> 1)};
+}
+
+uint64_t LinearQuadtree::parent_code(uint64_t code) {
+    return code >> 2;
+}
+
+uint64_t LinearQuadtree::child_code(uint64_t code, int quadrant) {
+    return (code << 2) | (uint64_t)quadrant;
+}
+
+int LinearQuadtree::quadrant_of(uint64_t code) {
+    return (int)(code & 3);
+}
+
+void LinearQuadtree::clear(cv::Rect const& area) {
+    root = area;
+    codes.clear();
+    levels.clear();
+    variances.clear();
+    topLeft.clear();
+    bottomRight.clear();
+}
+
+void LinearQuadtree::reserve(size_t n) {
+    codes.reserve(n);
+    levels.reserve(n);
+    variances.reserve(n);
+    topLeft.reserve(n);
+    bottomRight.reserve(n);
+}
+
+cv::Rect LinearQuadtree::get_root() const {
+    return root;
+}
+
+void LinearQuadtree::add_leaf(uint64_t code, int level, cv::Point const& quadTopLeft, cv::Point const& quadBottomRight,
+                              double variance) {
+    CV_Assert(level >= 0 && level <= MAX_LEVEL);
+    codes.push_back(code);
+    levels.push_back((uint8_t)level);
+    variances.push_back(variance);
+    topLeft.push_back(quadTopLeft);
+    bottomRight.push_back(quadBottomRight);
+}
+
+bool LinearQuadtree::add_leaf(cv::Point const& quadTopLeft, cv::Point const& quadBottomRight, double variance) {
+    // Same midpoints as GermsPositioningV2::quadrants
+    cv::Point tl = root.tl(), br = root.br();
+    uint64_t code = 0;
+    int level = 0;
+    while (tl != quadTopLeft || br != quadBottomRight) {
+        if (level == MAX_LEVEL) {
+            return false;
+        }
+        int midX = (tl.x + br.x) / 2;
+        int midY = (tl.y + br.y) / 2;
+        // The bottom-right corner tells the halves apart when one of them is empty
+        int xBit = quadTopLeft.x >= midX && quadBottomRight.x > midX ? 1 : 0;
+        int yBit = quadTopLeft.y >= midY && quadBottomRight.y > midY ? 1 : 0;
+        if (xBit) {
+            tl.x = midX;
+        } else {
+            br.x = midX;
+        }
+        if (yBit) {
+            tl.y = midY;
+        } else {
+            br.y = midY;
+        }
+        code = child_code(code, (yBit << 1) | xBit);
+        level++;
+    }
+    add_leaf(code, level, quadTopLeft, quadBottomRight, variance);
+    return true;
+}
+
+void LinearQuadtree::append(LinearQuadtree const& other) {
+    codes.insert(codes.end(), other.codes.begin(), other.codes.end());
+    levels.insert(levels.end(), other.levels.begin(), other.levels.end());
+    variances.insert(variances.end(), other.variances.begin(), other.variances.end());
+    topLeft.insert(topLeft.end(), other.topLeft.begin(), other.topLeft.end());
+    bottomRight.insert(bottomRight.end(), other.bottomRight.begin(), other.bottomRight.end());
+}
+
+void LinearQuadtree::sort() {
+    std::vector<int> order(size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](int a, int b) {
+        uint64_t keyA = key(a), keyB = key(b);
+        return keyA != keyB ? keyA < keyB : levels[a] < levels[b];
+    });
+
+    auto permute = [&order](auto &values) {
+        typename std::decay<decltype(values)>::type sorted(values.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            sorted[i] = values[order[i]];
+        }
+        values.swap(sorted);
+    };
+    permute(codes);
+    permute(levels);
+    permute(variances);
+    permute(topLeft);
+    permute(bottomRight);
+}
+
+size_t LinearQuadtree::size() const {
+    return codes.size();
+}
+
+bool LinearQuadtree::empty() const {
+    return codes.empty();
+}
+
+uint64_t LinearQuadtree::get_code(int leaf) const {
+    return codes[leaf];
+}
+
+int LinearQuadtree::get_level(int leaf) const {
+    return levels[leaf];
+}
+
+double LinearQuadtree::get_variance(int leaf) const {
+    return variances[leaf];
+}
+
+cv::Point LinearQuadtree::get_top_left(int leaf) const {
+    return topLeft[leaf];
+}
+
+cv::Point LinearQuadtree::get_bottom_right(int leaf) const {
+    return bottomRight[leaf];
+}
+
+cv::Point LinearQuadtree::get_center(int leaf) const {
+    return {(topLeft[leaf].x + bottomRight[leaf].x) / 2, (topLeft[leaf].y + bottomRight[leaf].y) / 2};
+}
+
+int LinearQuadtree::lower_leaf(uint64_t target) const {
+    int low = 0, high = (int)size();
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (key(middle) < target) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+int LinearQuadtree::find(uint64_t code, int level) const {
+    uint64_t target = code << (2 * (MAX_LEVEL - level));
+    // Last leaf starting at or before the quad
+    int leaf = lower_leaf(target + 1) - 1;
+    if (leaf >= 0 && levels[leaf] <= level && target < key(leaf) + span(levels[leaf])) {
+        return leaf;
+    }
+    return -1;
+}
+
+/**
+ * The neighbor quad of the same size on each side is either covered by one leaf (the same size
+ * or larger), found by find(), or subdivided: its leaves are then a contiguous range of the
+ * arrays, of which only the ones along the shared side are kept.
+ */
+void LinearQuadtree::neighbors(int leaf, std::vector<int> & result) const {
+    result.clear();
+    int level = levels[leaf];
+    cv::Point cell = decode(codes[leaf]);
+    int64_t cells = (int64_t)1 << level;
+    int64_t scale = (int64_t)1 << (MAX_LEVEL - level); // MAX_LEVEL cells per cell of the level
+
+    static const int dx[4] = {-1, 1, 0, 0};
+    static const int dy[4] = {0, 0, -1, 1};
+    for (int side = 0; side < 4; ++side) {
+        int64_t nx = cell.x + dx[side], ny = cell.y + dy[side];
+        if (nx < 0 || ny < 0 || nx >= cells || ny >= cells) {
+            continue;
+        }
+        uint64_t code = encode((uint32_t)nx, (uint32_t)ny);
+        int covering = find(code, level);
+        if (covering >= 0) {
+            result.push_back(covering);
+            continue;
+        }
+
+        // Border of the leaf in MAX_LEVEL cells, the one the neighbors touch
+        int64_t left = cell.x * scale, top = cell.y * scale;
+        uint64_t first = code << (2 * (MAX_LEVEL - level));
+        for (int other = lower_leaf(first); other < (int)size() && key(other) < first + span(level); ++other) {
+            cv::Point otherCell = decode(codes[other]);
+            int64_t otherScale = (int64_t)1 << (MAX_LEVEL - levels[other]);
+            int64_t otherLeft = otherCell.x * otherScale, otherTop = otherCell.y * otherScale;
+            bool touches = (side == 0 && otherLeft + otherScale == left) ||
+                           (side == 1 && otherLeft == left + scale) ||
+                           (side == 2 && otherTop + otherScale == top) ||
+                           (side == 3 && otherTop == top + scale);
+            if (touches) {
+                result.push_back(other);
+            }
+        }
+    }
+    std::sort(result.begin(), result.end());
+}
+
+void LinearQuadtree::write(std::ostream & os) const {
+    uint64_t count = size();
+    int32_t area[4] = {root.x, root.y, root.width, root.height};
+    os.write(reinterpret_cast<const char*>(area), sizeof(area));
+    os.write(reinterpret_cast<const char*>(&count), sizeof(count));
+    os.write(reinterpret_cast<const char*>(codes.data()), count * sizeof(uint64_t));
+    os.write(reinterpret_cast<const char*>(levels.data()), count * sizeof(uint8_t));
+    os.write(reinterpret_cast<const char*>(variances.data()), count * sizeof(double));
+    os.write(reinterpret_cast<const char*>(topLeft.data()), count * sizeof(cv::Point));
+    os.write(reinterpret_cast<const char*>(bottomRight.data()), count * sizeof(cv::Point));
+}
+
+bool LinearQuadtree::read(std::istream & is) {
+    clear(cv::Rect());
+    int32_t area[4];
+    uint64_t count = 0;
+    if (!is.read(reinterpret_cast<char*>(area), sizeof(area)) || !is.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+        return false;
+    }
+
+    // The count is checked before anything is allocated for it: every leaf covers a pixel at least, and when the
+    // stream can seek, its arrays must fit in the bytes left
+    if (area[2] < 0 || area[3] < 0 || count > (uint64_t)area[2] * (uint64_t)area[3]) {
+        return false;
+    }
+    std::streampos start = is.tellg();
+    if (start != std::streampos(-1)) {
+        is.seekg(0, std::ios::end);
+        std::streampos end = is.tellg();
+        is.seekg(start);
+        uint64_t leafBytes = sizeof(uint64_t) + sizeof(uint8_t) + sizeof(double) + 2 * sizeof(cv::Point);
+        if (!is || end < start || count > (uint64_t)(end - start) / leafBytes) {
+            return false;
+        }
+    }
+
+    codes.resize(count);
+    levels.resize(count);
+    variances.resize(count);
+    topLeft.resize(count);
+    bottomRight.resize(count);
+    if (!is.read(reinterpret_cast<char*>(codes.data()), count * sizeof(uint64_t)) ||
+        !is.read(reinterpret_cast<char*>(levels.data()), count * sizeof(uint8_t)) ||
+        !is.read(reinterpret_cast<char*>(variances.data()), count * sizeof(double)) ||
+        !is.read(reinterpret_cast<char*>(topLeft.data()), count * sizeof(cv::Point)) ||
+        !is.read(reinterpret_cast<char*>(bottomRight.data()), count * sizeof(cv::Point))) {
+        clear(cv::Rect());
+        return false;
+    }
+    // key() shifts by the levels under MAX_LEVEL
+    for (uint8_t level : levels) {
+        if (level > MAX_LEVEL) {
+            clear(cv::Rect());
+            return false;
+        }
+    }
+    root = cv::Rect(area[0], area[1], area[2], area[3]);
+    return true;
+}
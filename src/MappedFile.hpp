@@ -0,0 +1,186 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Read-only memory mapping of a whole file (mmap, or a file mapping on Windows).
+ *
+ * Pages are loaded on first access and can be dropped by the OS at any time, so mapping a file
+ * larger than the memory is fine as long as it is read in order.
+ */
+class MappedFile {
+private:
+    const unsigned char* address = nullptr;
+    size_t length = 0;
+
+#if defined(_WIN32)
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#endif
+
+public:
+    MappedFile() = default;
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // Fails on missing or empty files
+    bool open(const std::string &);
+
+    // Same for a named shared memory object (shm_open, or a named file mapping on Windows)
+    bool open_shared(const std::string &);
+
+    void close();
+
+    bool is_open() const;
+
+    const unsigned char* data() const;
+
+    size_t size() const;
+};
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::is_open() const {
+    return address != nullptr;
+}
+
+const unsigned char* MappedFile::data() const {
+    return address;
+}
+
+size_t MappedFile::size() const {
+    return length;
+}
+
+#if defined(_WIN32)
+
+bool MappedFile::open(const std::string &path) {
+    close();
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        close();
+        return false;
+    }
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        close();
+        return false;
+    }
+    address = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!address) {
+        close();
+        return false;
+    }
+    length = (size_t)fileSize.QuadPart;
+    return true;
+}
+
+bool MappedFile::open_shared(const std::string &name) {
+    close();
+    mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+    if (!mapping) {
+        return false;
+    }
+    address = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    MEMORY_BASIC_INFORMATION region;
+    if (!address || VirtualQuery(address, &region, sizeof(region)) == 0) {
+        close();
+        return false;
+    }
+    // Whole pages: the size of the view, not of the object
+    length = (size_t)region.RegionSize;
+    return true;
+}
+
+void MappedFile::close() {
+    if (address) {
+        UnmapViewOfFile(address);
+    }
+    if (mapping) {
+        CloseHandle(mapping);
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+        CloseHandle(file);
+    }
+    address = nullptr;
+    length = 0;
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+}
+
+#else
+
+bool MappedFile::open(const std::string &path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    address = (const unsigned char*)mapped;
+    length = (size_t)status.st_size;
+    return true;
+}
+
+bool MappedFile::open_shared(const std::string &name) {
+    close();
+    int fd = shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat status;
+    if (fstat(fd, &status) != 0 || status.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+    void* mapped = mmap(nullptr, (size_t)status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+    address = (const unsigned char*)mapped;
+    length = (size_t)status.st_size;
+    return true;
+}
+
+void MappedFile::close() {
+    if (address) {
+        munmap((void*)address, length);
+    }
+    address = nullptr;
+    length = 0;
+}
+
+#endif
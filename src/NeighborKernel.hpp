@@ -0,0 +1,259 @@
+#pragma once
+
+#include "opencv2/imgproc.hpp"
+
+#include "Instrumentation.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RG_KERNEL_X86
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(RG_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+#define RG_TARGET_SSE2 __attribute__((target("sse2")))
+#define RG_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RG_TARGET_SSE2
+#define RG_TARGET_AVX2
+#endif
+
+/**
+ * @brief Tests the 8 neighbors of a pixel against a region interval in one call.
+ *
+ * Works on a packed HSV plane (CV_8UC4, one 32-bit word per pixel, lane 3 is padding) and returns
+ * a bitmask where bit k is set when neighbor k lies in [lowerb, upperb] on every lane. Neighbors
+ * are numbered in the order of GrowAndMerge::process: dx = -1..1 in the outer loop, dy = -1..1 in
+ * the inner loop, skipping the center.
+ *
+ * The SIMD paths load each of the three rows as 4 pixels starting at x-1, so the caller must only
+ * use mask() for pixels whose 3x3 neighborhood is inside the image, and the plane must have one
+ * readable pixel after the end of each row (pack_hsv() allocates it).
+ * The implementation is chosen once at construction from the CPU features (AVX2, then SSE2, then
+ * scalar) and can be forced with set_isa().
+ */
+class NeighborKernel {
+public:
+    enum class Isa { Scalar, SSE2, AVX2 };
+
+private:
+    using kernel_type = unsigned (*)(const uint32_t*, size_t, uint32_t, uint32_t);
+
+    Isa isa;
+    kernel_type kernel;
+
+    static bool in_range(uint32_t, uint32_t, uint32_t);
+
+    static unsigned interleave_rows(unsigned, unsigned, unsigned);
+
+    static unsigned mask_scalar(const uint32_t*, size_t, uint32_t, uint32_t);
+
+    static unsigned mask_sse2(const uint32_t*, size_t, uint32_t, uint32_t);
+
+    static unsigned mask_avx2(const uint32_t*, size_t, uint32_t, uint32_t);
+
+    static uint32_t pack(cv::Vec4b const&);
+
+public:
+    NeighborKernel();
+
+    static Isa best_isa();
+
+    static bool is_supported(Isa);
+
+    Isa get_isa() const;
+
+    // Falls back to the best supported implementation when the requested one is not available
+    void set_isa(Isa);
+
+    void pack_hsv(cv::Mat const&, cv::Mat &) const;
+
+    // Same, packed into the top-left corner of the storage, which only grows: a caller keeping the
+    // storage packs images of the same size again without allocating
+    void pack_hsv(cv::Mat const&, cv::Mat &, cv::Mat &) const;
+
+    // O(1)
+    unsigned mask(cv::Mat const&, cv::Point const&, cv::Vec4b const&, cv::Vec4b const&) const;
+
+    // O(1) - single pixel test, usable anywhere in the image
+    bool contains(cv::Vec4b const&, cv::Vec4b const&, cv::Vec4b const&) const;
+};
+
+NeighborKernel::NeighborKernel() : isa(Isa::Scalar), kernel(&NeighborKernel::mask_scalar) {
+    set_isa(best_isa());
+}
+
+NeighborKernel::Isa NeighborKernel::best_isa() {
+    if (is_supported(Isa::AVX2)) {
+        return Isa::AVX2;
+    }
+    if (is_supported(Isa::SSE2)) {
+        return Isa::SSE2;
+    }
+    return Isa::Scalar;
+}
+
+bool NeighborKernel::is_supported(Isa requested) {
+    switch (requested) {
+        case Isa::Scalar:
+            return true;
+#if defined(RG_KERNEL_X86) && (defined(__GNUC__) || defined(__clang__))
+        case Isa::SSE2:
+            return __builtin_cpu_supports("sse2");
+        case Isa::AVX2:
+            return __builtin_cpu_supports("avx2");
+#elif defined(RG_KERNEL_X86) && defined(_MSC_VER)
+        case Isa::SSE2: {
+            int info[4];
+            __cpuid(info, 1);
+            return (info[3] & (1 << 26)) != 0;
+        }
+        case Isa::AVX2: {
+            int info[4];
+            __cpuid(info, 1);
+            bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+            __cpuidex(info, 7, 0);
+            return osSavesYmm && (info[1] & (1 << 5)) != 0;
+        }
+#endif
+        default:
+            return false;
+    }
+}
+
+NeighborKernel::Isa NeighborKernel::get_isa() const {
+    return isa;
+}
+
+void NeighborKernel::set_isa(Isa requested) {
+    isa = is_supported(requested) ? requested : best_isa();
+    switch (isa) {
+        case Isa::AVX2:
+            kernel = &NeighborKernel::mask_avx2;
+            break;
+        case Isa::SSE2:
+            kernel = &NeighborKernel::mask_sse2;
+            break;
+        default:
+            kernel = &NeighborKernel::mask_scalar;
+            break;
+    }
+}
+
+void NeighborKernel::pack_hsv(cv::Mat const& hsv, cv::Mat & packed) const {
+    cv::Mat storage;
+    pack_hsv(hsv, packed, storage);
+}
+
+void NeighborKernel::pack_hsv(cv::Mat const& hsv, cv::Mat & packed, cv::Mat & storage) const {
+    // One spare column so that the 4-pixel row loads of the SIMD paths stay inside the allocation
+    if (storage.type() != CV_8UC4 || storage.rows < hsv.rows || storage.cols < hsv.cols + 1) {
+        storage.create(std::max(storage.rows, hsv.rows), std::max(storage.cols, hsv.cols + 1), CV_8UC4);
+    }
+    packed = storage(cv::Rect(0, 0, hsv.cols, hsv.rows));
+    cv::cvtColor(hsv, packed, cv::COLOR_BGR2BGRA); // channel order is kept, lane 3 = 255
+}
+
+unsigned NeighborKernel::mask(cv::Mat const& packed, cv::Point const& center,
+                              cv::Vec4b const& lowerb, cv::Vec4b const& upperb) const {
+    RG_COUNT(PredicateEvaluations, 8);
+    const uint32_t* p = packed.ptr<uint32_t>(center.y) + center.x;
+    return kernel(p, packed.step / sizeof(uint32_t), pack(lowerb), pack(upperb));
+}
+
+bool NeighborKernel::contains(cv::Vec4b const& lowerb, cv::Vec4b const& upperb, cv::Vec4b const& value) const {
+    RG_COUNT(PredicateEvaluations, 1);
+    return in_range(pack(value), pack(lowerb), pack(upperb));
+}
+
+uint32_t NeighborKernel::pack(cv::Vec4b const& value) {
+    uint32_t word;
+    std::memcpy(&word, value.val, sizeof(word));
+    return word;
+}
+
+bool NeighborKernel::in_range(uint32_t value, uint32_t lowerb, uint32_t upperb) {
+    for (int lane = 0; lane < 32; lane += 8) {
+        uint32_t v = (value >> lane) & 0xFF;
+        if (v < ((lowerb >> lane) & 0xFF) || v > ((upperb >> lane) & 0xFF)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bits 0-2 of each row mask are the pixels x-1, x, x+1 of that row
+unsigned NeighborKernel::interleave_rows(unsigned up, unsigned mid, unsigned down) {
+    return  (up & 1)               | ((mid & 1) << 1)        | ((down & 1) << 2) |
+            (((up >> 1) & 1) << 3) | (((down >> 1) & 1) << 4) |
+            (((up >> 2) & 1) << 5) | (((mid >> 2) & 1) << 6) | (((down >> 2) & 1) << 7);
+}
+
+unsigned NeighborKernel::mask_scalar(const uint32_t* p, size_t stride, uint32_t lowerb, uint32_t upperb) {
+    const ptrdiff_t s = (ptrdiff_t)stride;
+    const ptrdiff_t offsets[8] = {-s - 1, -1, s - 1, -s, s, -s + 1, 1, s + 1};
+    unsigned bits = 0;
+    for (int k = 0; k < 8; ++k) {
+        if (in_range(p[offsets[k]], lowerb, upperb)) {
+            bits |= 1u << k;
+        }
+    }
+    return bits;
+}
+
+#if defined(RG_KERNEL_X86)
+
+RG_TARGET_SSE2 unsigned NeighborKernel::mask_sse2(const uint32_t* p, size_t stride, uint32_t lowerb, uint32_t upperb) {
+    const __m128i lo = _mm_set1_epi32((int)lowerb);
+    const __m128i hi = _mm_set1_epi32((int)upperb);
+    const __m128i ones = _mm_set1_epi32(-1);
+
+    auto row_bits = [&](const uint32_t* row) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(row - 1));
+        __m128i in = _mm_and_si128(_mm_cmpeq_epi8(_mm_max_epu8(v, lo), v),
+                                   _mm_cmpeq_epi8(_mm_min_epu8(v, hi), v));
+        return (unsigned)_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(in, ones)));
+    };
+
+    return interleave_rows(row_bits(p - stride), row_bits(p), row_bits(p + stride));
+}
+
+RG_TARGET_AVX2 unsigned NeighborKernel::mask_avx2(const uint32_t* p, size_t stride, uint32_t lowerb, uint32_t upperb) {
+    const __m256i lo = _mm256_set1_epi32((int)lowerb);
+    const __m256i hi = _mm256_set1_epi32((int)upperb);
+
+    // Upper row in the low half, current row in the high half, lower row in a second register
+    __m256i v = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p - stride - 1))),
+            _mm_loadu_si128((const __m128i*)(p - 1)), 1);
+    __m256i w = _mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)(p + stride - 1)));
+
+    __m256i inV = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v, lo), v),
+                                   _mm256_cmpeq_epi8(_mm256_min_epu8(v, hi), v));
+    __m256i inW = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(w, lo), w),
+                                   _mm256_cmpeq_epi8(_mm256_min_epu8(w, hi), w));
+
+    const __m256i ones = _mm256_set1_epi32(-1);
+    unsigned bitsV = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(inV, ones)));
+    unsigned bitsW = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(inW, ones)));
+
+    return interleave_rows(bitsV & 0xF, bitsV >> 4, bitsW & 0xF);
+}
+
+#else
+
+unsigned NeighborKernel::mask_sse2(const uint32_t* p, size_t stride, uint32_t lowerb, uint32_t upperb) {
+    return mask_scalar(p, stride, lowerb, upperb);
+}
+
+unsigned NeighborKernel::mask_avx2(const uint32_t* p, size_t stride, uint32_t lowerb, uint32_t upperb) {
+    return mask_scalar(p, stride, lowerb, upperb);
+}
+
+#endif
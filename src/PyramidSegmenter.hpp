@@ -0,0 +1,163 @@
+#pragma once
+
+#include "GermsPositioning.hpp"
+#include "GrowAndMerge.hpp"
+
+#include "opencv2/imgproc.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Coarse-to-fine segmentation on an image pyramid.
+ *
+ * The image is reduced `levels` times with cv::pyrDown (1/4 of the pixels per level), then seeded
+ * and grown at that scale. The coarse labels are upsampled to the full resolution and only the
+ * pixels within `margin` coarse pixels of a region boundary are grown again at full resolution,
+ * with the same predicate, see GrowAndMerge::rg_seg_refine(). Region IDs and colors are the ones
+ * of the coarse run.
+ *
+ * agreement() compares the result with a full resolution segmentation of the same image.
+ */
+class PyramidSegmenter {
+private:
+    GrowAndMerge coarse;
+    GrowAndMerge fine;
+
+    int levels = 1;
+    int margin = 1;
+    int maxDivision = 5;
+    bool randColorization = false;
+    bool onlyEdge = false;
+
+    std::vector<cv::Point> coarseSeeds;
+    size_t refinedPixels = 0;
+
+public:
+    // Segments the preprocessed BGR image (see ImageProcessor::get_image_rgb) and renders it into mask
+    void process(const cv::Mat &, cv::Mat &);
+
+    const cv::Mat& get_labels() const;
+
+    const RegionTable& get_regions() const;
+
+    // Seeds of the last image, in coarse coordinates
+    const std::vector<cv::Point>& get_coarse_seeds() const;
+
+    // Fraction of the pixels of the last image grown again at full resolution
+    double get_refined_ratio() const;
+
+    // Number of cv::pyrDown reductions: 1 for 1/4 of the pixels, 2 for 1/16
+    void set_levels(int);
+
+    // Width, in coarse pixels, of the band refined on each side of a boundary
+    void set_margin(int);
+
+    void set_max_division(int);
+
+    void set_rand_colorization(bool);
+
+    void set_only_edge(bool);
+
+    void set_thread_pool(ThreadPool &);
+
+    // O(pixels) - every region of a is matched with the region of b it overlaps most; fraction of
+    // the pixels of a whose match is their own region in b (1 for the same partition)
+    static double agreement(const cv::Mat &, const cv::Mat &);
+};
+
+void PyramidSegmenter::process(const cv::Mat &image, cv::Mat &mask) {
+    cv::Mat coarseImage = image;
+    for (int level = 0; level < levels; ++level) {
+        cv::Mat reduced;
+        cv::pyrDown(coarseImage, reduced);
+        coarseImage = reduced;
+    }
+
+    coarseSeeds.clear();
+    GermsPositioningV2 positioningV2;
+    positioningV2.set_thread_pool(coarse.get_thread_pool());
+    positioningV2.position_germs(coarseImage, maxDivision, coarseSeeds);
+
+    cv::Mat coarseMask;
+    coarse.rg_seg(coarseImage, coarseMask, coarseSeeds, randColorization, false);
+
+    refinedPixels = fine.rg_seg_refine(image, mask, coarse, levels, margin, onlyEdge);
+}
+
+const cv::Mat& PyramidSegmenter::get_labels() const {
+    return fine.get_labels();
+}
+
+const RegionTable& PyramidSegmenter::get_regions() const {
+    return fine.get_regions();
+}
+
+const std::vector<cv::Point>& PyramidSegmenter::get_coarse_seeds() const {
+    return coarseSeeds;
+}
+
+double PyramidSegmenter::get_refined_ratio() const {
+    const cv::Mat &labels = fine.get_labels();
+    return labels.empty() ? 0.0 : (double)refinedPixels / (double)labels.total();
+}
+
+void PyramidSegmenter::set_levels(int value) {
+    levels = std::max(0, value);
+}
+
+void PyramidSegmenter::set_margin(int value) {
+    margin = std::max(0, value);
+}
+
+void PyramidSegmenter::set_max_division(int division) {
+    maxDivision = division;
+}
+
+void PyramidSegmenter::set_rand_colorization(bool value) {
+    randColorization = value;
+}
+
+void PyramidSegmenter::set_only_edge(bool value) {
+    onlyEdge = value;
+}
+
+void PyramidSegmenter::set_thread_pool(ThreadPool &pool) {
+    coarse.set_thread_pool(pool);
+    fine.set_thread_pool(pool);
+}
+
+double PyramidSegmenter::agreement(const cv::Mat &a, const cv::Mat &b) {
+    CV_Assert(a.size() == b.size() && a.type() == CV_32S && b.type() == CV_32S);
+    if (a.empty()) {
+        return 1.0;
+    }
+
+    // Overlap of every (label in a, label in b) pair, one lookup per run of the same pair
+    std::unordered_map<uint64_t, uint64_t> overlaps;
+    for (int i = 0; i < a.rows; ++i) {
+        const int* rowA = a.ptr<int>(i);
+        const int* rowB = b.ptr<int>(i);
+        int start = 0;
+        for (int j = 1; j <= a.cols; ++j) {
+            if (j == a.cols || rowA[j] != rowA[start] || rowB[j] != rowB[start]) {
+                overlaps[((uint64_t)(uint32_t)rowA[start] << 32) | (uint32_t)rowB[start]] += j - start;
+                start = j;
+            }
+        }
+    }
+
+    std::unordered_map<uint32_t, uint64_t> bestOverlap;
+    for (const auto &overlap : overlaps) {
+        uint64_t &best = bestOverlap[(uint32_t)(overlap.first >> 32)];
+        best = std::max(best, overlap.second);
+    }
+
+    uint64_t matched = 0;
+    for (const auto &best : bestOverlap) {
+        matched += best.second;
+    }
+    return (double)matched / (double)a.total();
+}
@@ -0,0 +1,145 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Region adjacency graph and merge queue of the graph merge stage.
+ *
+ * While growing, every contact between two regions is appended to a per-thread list as a packed
+ * pair, see pack(). build() gathers the lists into one sorted edge list without duplicates, so a
+ * region pair shared by a long border is one edge.
+ *
+ * The merge stage pops the candidates by increasing distance between the region means. A merge
+ * changes the mean of the survivor, so every region carries a stamp, bumped when it absorbs
+ * another one: a candidate popped with an outdated stamp is pushed again with its new distance
+ * instead of being tested. Candidates are ordered by distance, then by region IDs and stamps, a
+ * total order, so the merges do not depend on the order in which the contacts were recorded.
+ *
+ * Every buffer only grows, like the ones of SegmentationContext which owns the graph.
+ */
+class RegionGraph {
+public:
+    struct Candidate {
+        double distance;
+        int region1;
+        int region2;
+        uint32_t stamp1;
+        uint32_t stamp2;
+    };
+
+private:
+    std::vector<uint64_t> edges;
+    std::vector<Candidate> heap;
+    std::vector<uint32_t> stamps;
+
+    // Heap order: the smallest candidate on top
+    static bool later(Candidate const&, Candidate const&);
+
+public:
+    // O(1) - the same key whatever the order of the two regions
+    static uint64_t pack(int, int);
+
+    static int first(uint64_t);
+
+    static int second(uint64_t);
+
+    // O(edges) - empties the graph and the queue, with room for the given number of region IDs
+    void clear(size_t);
+
+    // O(contacts)
+    void add_contacts(std::vector<uint64_t> const&);
+
+    // O(edges log(edges)) - sorts the edges and drops the duplicates
+    void build();
+
+    std::vector<uint64_t> const& get_edges() const;
+
+    // O(log(candidates))
+    void push(Candidate const&);
+
+    // O(log(candidates))
+    Candidate pop();
+
+    bool empty() const;
+
+    uint32_t get_stamp(int) const;
+
+    // O(1) - outdates the candidates pushed with the previous stamp of the region
+    void bump(int);
+};
+
+bool RegionGraph::later(Candidate const& a, Candidate const& b) {
+    if (a.distance != b.distance) {
+        return a.distance > b.distance;
+    }
+    if (a.region1 != b.region1) {
+        return a.region1 > b.region1;
+    }
+    if (a.region2 != b.region2) {
+        return a.region2 > b.region2;
+    }
+    if (a.stamp1 != b.stamp1) {
+        return a.stamp1 > b.stamp1;
+    }
+    return a.stamp2 > b.stamp2;
+}
+
+uint64_t RegionGraph::pack(int a, int b) {
+    if (a > b) {
+        std::swap(a, b);
+    }
+    return ((uint64_t)(uint32_t)a << 32) | (uint32_t)b;
+}
+
+int RegionGraph::first(uint64_t edge) {
+    return (int)(edge >> 32);
+}
+
+int RegionGraph::second(uint64_t edge) {
+    return (int)(uint32_t)edge;
+}
+
+void RegionGraph::clear(size_t numRegions) {
+    edges.clear();
+    heap.clear();
+    stamps.assign(numRegions, 0);
+}
+
+void RegionGraph::add_contacts(std::vector<uint64_t> const& contacts) {
+    edges.insert(edges.end(), contacts.begin(), contacts.end());
+}
+
+void RegionGraph::build() {
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+}
+
+std::vector<uint64_t> const& RegionGraph::get_edges() const {
+    return edges;
+}
+
+void RegionGraph::push(Candidate const& candidate) {
+    heap.push_back(candidate);
+    std::push_heap(heap.begin(), heap.end(), later);
+}
+
+RegionGraph::Candidate RegionGraph::pop() {
+    std::pop_heap(heap.begin(), heap.end(), later);
+    Candidate candidate = heap.back();
+    heap.pop_back();
+    return candidate;
+}
+
+bool RegionGraph::empty() const {
+    return heap.empty();
+}
+
+uint32_t RegionGraph::get_stamp(int region) const {
+    return stamps[region];
+}
+
+void RegionGraph::bump(int region) {
+    stamps[region]++;
+}
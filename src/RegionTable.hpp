@@ -0,0 +1,359 @@
+#pragma once
+
+#include "DisjointSet.hpp"
+
+#include "opencv2/imgproc.hpp"
+
+#include <array>
+#include <climits>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Statistics of the grown regions, stored as a structure of arrays indexed by region ID.
+ *
+ * Row 0 is the unlabeled background. Pixel counts and merge ancestry live in the embedded
+ * DisjointSet and only root rows hold up-to-date statistics. Pixels themselves are not stored:
+ * region_pixels() enumerates them on demand by scanning the label image inside the bounding box.
+ */
+class RegionTable {
+private:
+    DisjointSet sets;
+
+    // Per channel (H, S, V with the default predicate) integer sums and sums of squares
+    std::array<std::vector<uint64_t>, 3> sum;
+    std::array<std::vector<uint64_t>, 3> sqSum;
+
+    // Homogeneity interval, clamped to [0, 255] and padded to 4 lanes (lane 3 accepts anything).
+    // Predicates that are not intervals give these words their own meaning, see GrowthPolicies.hpp
+    std::vector<cv::Vec4b> lowerBound;
+    std::vector<cv::Vec4b> upperBound;
+
+    // Bounding box, bottomRight is exclusive
+    std::vector<cv::Point> topLeft;
+    std::vector<cv::Point> bottomRight;
+
+    std::vector<cv::Point> seed;
+    std::vector<int> color;
+
+    // Rows given back by release_empty(), reused by add_region()
+    std::vector<int> freeIds;
+
+    void combine(int, int);
+
+public:
+    void clear();
+
+    void reserve(size_t);
+
+    size_t size() const;
+
+    // O(1) - reuses a released row when there is one
+    int add_region(cv::Point const&, int);
+
+    // O(rows of the other table) - appends its rows from the given one on (1: all but the background);
+    // returns the new ID of that row, the others follow in order
+    int append(RegionTable const&, int);
+
+    // O(regions) - empties the pixel statistics of every row, keeping IDs, bounds, seeds and colors
+    void reset_statistics();
+
+    // O(regions) - frees every row that is merged away or holds no pixel (the background excepted),
+    // so it must only be called when the label image holds root IDs only
+    void release_empty();
+
+    // O(1)
+    void set_bounds(int, cv::Scalar const&, cv::Scalar const&);
+
+    // O(1)
+    void set_packed_bounds(int, cv::Vec4b const&, cv::Vec4b const&);
+
+    // O(1)
+    void add_pixel(int, cv::Point const&, cv::Vec4b const&);
+
+    // O(α(n))
+    int find(int);
+
+    // O(α(n)) - returns the surviving root
+    int merge(int, int);
+
+    // O(α(n)) - the root of the first region survives whatever the sizes
+    int merge_into(int, int);
+
+    bool is_root(int) const;
+
+    uint32_t get_pixel_count(int) const;
+
+    uint64_t get_sum(int, int) const;
+
+    cv::Scalar get_mean(int) const;
+
+    cv::Scalar get_variance(int) const;
+
+    cv::Scalar get_lower_bound(int) const;
+
+    cv::Scalar get_upper_bound(int) const;
+
+    cv::Vec4b const& get_packed_lower_bound(int) const;
+
+    cv::Vec4b const& get_packed_upper_bound(int) const;
+
+    cv::Rect get_bounding_box(int) const;
+
+    cv::Point get_seed(int) const;
+
+    void set_seed(int, cv::Point const&);
+
+    int get_color(int) const;
+
+    // O(bounding box area), expects a flattened label image (root IDs only)
+    void region_pixels(cv::Mat const&, int, std::vector<cv::Point> &) const;
+};
+
+void RegionTable::clear() {
+    sets.clear();
+    for (int c = 0; c < 3; ++c) {
+        sum[c].clear();
+        sqSum[c].clear();
+    }
+    lowerBound.clear();
+    upperBound.clear();
+    topLeft.clear();
+    bottomRight.clear();
+    seed.clear();
+    color.clear();
+    freeIds.clear();
+}
+
+void RegionTable::reserve(size_t n) {
+    sets.reserve(n);
+    for (int c = 0; c < 3; ++c) {
+        sum[c].reserve(n);
+        sqSum[c].reserve(n);
+    }
+    lowerBound.reserve(n);
+    upperBound.reserve(n);
+    topLeft.reserve(n);
+    bottomRight.reserve(n);
+    seed.reserve(n);
+    color.reserve(n);
+}
+
+size_t RegionTable::size() const {
+    return sets.count();
+}
+
+int RegionTable::add_region(cv::Point const& regionSeed, int regionColor) {
+    if (!freeIds.empty()) {
+        int id = freeIds.back();
+        freeIds.pop_back();
+        seed[id] = regionSeed;
+        color[id] = regionColor;
+        return id;
+    }
+
+    int id = sets.make_set(0);
+    for (int c = 0; c < 3; ++c) {
+        sum[c].push_back(0);
+        sqSum[c].push_back(0);
+    }
+    lowerBound.emplace_back(0, 0, 0, 0);
+    upperBound.emplace_back(255, 255, 255, 255);
+    topLeft.emplace_back(INT_MAX, INT_MAX);
+    bottomRight.emplace_back(INT_MIN, INT_MIN);
+    seed.push_back(regionSeed);
+    color.push_back(regionColor);
+    return id;
+}
+
+void RegionTable::reset_statistics() {
+    for (int id = 0; id < (int)size(); ++id) {
+        if (sets.is_root(id)) {
+            sets.reset(id, 0);
+        }
+        for (int c = 0; c < 3; ++c) {
+            sum[c][id] = 0;
+            sqSum[c][id] = 0;
+        }
+        topLeft[id] = cv::Point(INT_MAX, INT_MAX);
+        bottomRight[id] = cv::Point(INT_MIN, INT_MIN);
+    }
+}
+
+void RegionTable::release_empty() {
+    freeIds.clear();
+    for (int id = (int)size() - 1; id > 0; --id) {
+        if (!sets.is_root(id) || sets.get_size(id) == 0) {
+            sets.reset(id, 0);
+            for (int c = 0; c < 3; ++c) {
+                sum[c][id] = 0;
+                sqSum[c][id] = 0;
+            }
+            lowerBound[id] = cv::Vec4b(0, 0, 0, 0);
+            upperBound[id] = cv::Vec4b(255, 255, 255, 255);
+            topLeft[id] = cv::Point(INT_MAX, INT_MAX);
+            bottomRight[id] = cv::Point(INT_MIN, INT_MIN);
+            seed[id] = cv::Point(-1, -1);
+            color[id] = 0;
+            freeIds.push_back(id);
+        }
+    }
+}
+
+int RegionTable::append(RegionTable const& other, int first) {
+    int base = (int)size();
+    sets.append(other.sets, first);
+    for (int c = 0; c < 3; ++c) {
+        sum[c].insert(sum[c].end(), other.sum[c].begin() + first, other.sum[c].end());
+        sqSum[c].insert(sqSum[c].end(), other.sqSum[c].begin() + first, other.sqSum[c].end());
+    }
+    lowerBound.insert(lowerBound.end(), other.lowerBound.begin() + first, other.lowerBound.end());
+    upperBound.insert(upperBound.end(), other.upperBound.begin() + first, other.upperBound.end());
+    topLeft.insert(topLeft.end(), other.topLeft.begin() + first, other.topLeft.end());
+    bottomRight.insert(bottomRight.end(), other.bottomRight.begin() + first, other.bottomRight.end());
+    seed.insert(seed.end(), other.seed.begin() + first, other.seed.end());
+    color.insert(color.end(), other.color.begin() + first, other.color.end());
+    return base;
+}
+
+void RegionTable::set_bounds(int id, cv::Scalar const& lowerb, cv::Scalar const& upperb) {
+    // Pixel values and means live in [0, 255], so clamping the interval does not change any test
+    for (int c = 0; c < 3; ++c) {
+        lowerBound[id][c] = cv::saturate_cast<uchar>(lowerb[c]);
+        upperBound[id][c] = cv::saturate_cast<uchar>(upperb[c]);
+    }
+}
+
+void RegionTable::set_packed_bounds(int id, cv::Vec4b const& lowerb, cv::Vec4b const& upperb) {
+    lowerBound[id] = lowerb;
+    upperBound[id] = upperb;
+}
+
+void RegionTable::add_pixel(int id, cv::Point const& pixel, cv::Vec4b const& hsv) {
+    sets.add_weight(id, 1);
+    for (int c = 0; c < 3; ++c) {
+        sum[c][id] += hsv[c];
+        sqSum[c][id] += (uint64_t)hsv[c] * hsv[c];
+    }
+    topLeft[id].x = std::min(topLeft[id].x, pixel.x);
+    topLeft[id].y = std::min(topLeft[id].y, pixel.y);
+    bottomRight[id].x = std::max(bottomRight[id].x, pixel.x + 1);
+    bottomRight[id].y = std::max(bottomRight[id].y, pixel.y + 1);
+}
+
+int RegionTable::find(int id) {
+    return sets.find(id);
+}
+
+int RegionTable::merge(int r1, int r2) {
+    r1 = sets.find(r1);
+    r2 = sets.find(r2);
+    int survivor = sets.unite(r1, r2);
+    combine(survivor, (survivor == r1) ? r2 : r1);
+    return survivor;
+}
+
+int RegionTable::merge_into(int r1, int r2) {
+    r1 = sets.find(r1);
+    r2 = sets.find(r2);
+    sets.unite_into(r1, r2);
+    combine(r1, r2);
+    return r1;
+}
+
+void RegionTable::combine(int survivor, int absorbed) {
+    if (survivor == absorbed) {
+        return;
+    }
+
+    for (int c = 0; c < 3; ++c) {
+        sum[c][survivor] += sum[c][absorbed];
+        sqSum[c][survivor] += sqSum[c][absorbed];
+        lowerBound[survivor][c] = std::min(lowerBound[survivor][c], lowerBound[absorbed][c]);
+        upperBound[survivor][c] = std::max(upperBound[survivor][c], upperBound[absorbed][c]);
+    }
+    topLeft[survivor].x = std::min(topLeft[survivor].x, topLeft[absorbed].x);
+    topLeft[survivor].y = std::min(topLeft[survivor].y, topLeft[absorbed].y);
+    bottomRight[survivor].x = std::max(bottomRight[survivor].x, bottomRight[absorbed].x);
+    bottomRight[survivor].y = std::max(bottomRight[survivor].y, bottomRight[absorbed].y);
+}
+
+bool RegionTable::is_root(int id) const {
+    return sets.is_root(id);
+}
+
+uint32_t RegionTable::get_pixel_count(int id) const {
+    return sets.get_size(id);
+}
+
+uint64_t RegionTable::get_sum(int id, int channel) const {
+    return sum[channel][id];
+}
+
+cv::Scalar RegionTable::get_mean(int id) const {
+    double count = get_pixel_count(id);
+    if (count == 0) {
+        return {0, 0, 0};
+    }
+    return {sum[0][id] / count, sum[1][id] / count, sum[2][id] / count};
+}
+
+cv::Scalar RegionTable::get_variance(int id) const {
+    double count = get_pixel_count(id);
+    if (count == 0) {
+        return {0, 0, 0};
+    }
+    cv::Scalar variance;
+    for (int c = 0; c < 3; ++c) {
+        double mean = sum[c][id] / count;
+        variance[c] = sqSum[c][id] / count - mean * mean;
+    }
+    return variance;
+}
+
+cv::Scalar RegionTable::get_lower_bound(int id) const {
+    return {(double)lowerBound[id][0], (double)lowerBound[id][1], (double)lowerBound[id][2]};
+}
+
+cv::Scalar RegionTable::get_upper_bound(int id) const {
+    return {(double)upperBound[id][0], (double)upperBound[id][1], (double)upperBound[id][2]};
+}
+
+cv::Vec4b const& RegionTable::get_packed_lower_bound(int id) const {
+    return lowerBound[id];
+}
+
+cv::Vec4b const& RegionTable::get_packed_upper_bound(int id) const {
+    return upperBound[id];
+}
+
+cv::Rect RegionTable::get_bounding_box(int id) const {
+    if (get_pixel_count(id) == 0) {
+        return {};
+    }
+    return {topLeft[id], bottomRight[id]};
+}
+
+cv::Point RegionTable::get_seed(int id) const {
+    return seed[id];
+}
+
+void RegionTable::set_seed(int id, cv::Point const& regionSeed) {
+    seed[id] = regionSeed;
+}
+
+int RegionTable::get_color(int id) const {
+    return color[id];
+}
+
+void RegionTable::region_pixels(cv::Mat const& labels, int id, std::vector<cv::Point> & pixels) const {
+    cv::Rect box = get_bounding_box(id);
+    for (int i = box.y; i < box.y + box.height; ++i) {
+        const int* row = labels.ptr<int>(i);
+        for (int j = box.x; j < box.x + box.width; ++j) {
+            if (row[j] == id) {
+                pixels.emplace_back(j, i);
+            }
+        }
+    }
+}
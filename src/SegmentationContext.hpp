@@ -0,0 +1,325 @@
+#pragma once
+
+#include "RegionGraph.hpp"
+
+#include "opencv2/core.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Scratch buffers of BasicGrowAndMerge, kept from one segmentation to the next.
+ *
+ * Every buffer only grows, to the largest image and seed count seen, so once a context has
+ * segmented an image, segmenting images of that size or smaller allocates nothing. Images are
+ * views into the top-left corner of their storage.
+ *
+ * The label plane is not cleared between calls: a CV_16U plane stamps every label with the
+ * generation of the call that wrote it, and labels_for() starts a new generation in O(1), after
+ * which the labels of the earlier calls read as 0 (BasicGrowAndMerge::label_at). The pass that
+ * resolves the labels to their roots writes 0 over them, so the plane a call leaves is clean. Only
+ * when the 16-bit generation wraps, once in 65535 calls, are the stamps zeroed.
+ *
+ * A context serves one segmentation at a time. The labels of BasicGrowAndMerge::get_labels() live
+ * in it and are overwritten by the next call; clone them to keep them.
+ */
+class SegmentationContext {
+public:
+    // Horizontal run [xLeft, xRight] of row y, claimed by the region being grown
+    struct Span {
+        int y;
+        int xLeft;
+        int xRight;
+    };
+
+    // First in, first out ring of pixels, twice as large whenever it is full
+    class PointQueue {
+    private:
+        std::vector<cv::Point> ring; // power of two size
+        size_t head = 0;
+        size_t count = 0;
+
+        void grow();
+
+    public:
+        void clear();
+
+        bool empty() const;
+
+        size_t size() const;
+
+        // O(1) amortized
+        void push(cv::Point const&);
+
+        // O(1)
+        cv::Point pop();
+    };
+
+    // Growing and rendering scratch of one thread
+    struct Scratch {
+        PointQueue queue;
+        std::vector<Span> runs;
+        std::vector<uchar> flags;
+        std::vector<uint64_t> contacts; // region pairs met while growing, see RegionGraph::pack
+    };
+
+    // Work of one tile of BasicGrowAndMerge::grow_tiles()
+    struct TileScratch {
+        std::vector<int> seeds;         // indices of the seeds in the tile, in seed order
+        std::vector<cv::Vec3i> offers;  // (x, y, label): unlabeled border pixel, label next to it in another tile
+        std::vector<cv::Vec3i> starts;  // (x, y, ID): accepted offer, region continuing into the tile from there
+        std::vector<uint64_t> contacts; // label pairs across the right and bottom borders, see RegionGraph::pack
+    };
+
+    // Breadth-first layers of the gap filling, see BasicGrowAndMerge::fill_gaps()
+    struct GapScratch {
+        std::vector<cv::Point> frontier;
+        std::vector<cv::Point> next;
+        std::vector<int> choices;
+        std::vector<cv::Vec3f> means;
+    };
+
+private:
+    cv::Mat labelStorage;
+    cv::Mat stampStorage;
+    cv::Mat featureStorage;
+    cv::Mat packedStorage;
+    cv::Mat gapFlagStorage;
+
+    // Generation of the last labels_for(), 0 before the first one: the stamps are never 0 after it
+    uint16_t generation = 0;
+
+    // One bit per 24-bit BGR color, set for the colors handed out by the current call
+    std::vector<uint64_t> usedColors;
+
+    std::vector<int> colors;
+    std::vector<int> roots;
+    std::vector<cv::Vec3b> palette;
+    std::vector<TileScratch> tiles;
+
+    // (region, continuation) ID pairs of grow_tiles(), merged once the tiles are grown
+    std::vector<cv::Vec2i> continuations;
+
+    RegionGraph graph;
+
+    GapScratch gaps;
+
+    // Index 0 is the calling thread, index w + 1 the worker w of the thread pool
+    std::vector<Scratch> scratch;
+
+    // Grows the storage to rows x cols of the type at least and returns its top-left rows x cols
+    static cv::Mat view(cv::Mat &, int, int, int);
+
+public:
+    // O(1), O(pixels) when the storage grows or the generation wraps - CV_32S label plane of the size, of a new
+    // generation: its labels only hold on the pixels stamped with get_generation()
+    cv::Mat labels_for(cv::Size);
+
+    // CV_16U generation stamps of the label plane of the size
+    cv::Mat stamps_for(cv::Size);
+
+    uint16_t get_generation() const;
+
+    // O(1) - forgets what a call that did not complete (an exception) left behind: the colors it handed out are
+    // free again (its labels are of an old generation for the next labels_for())
+    void discard();
+
+    // CV_8UC3 feature plane of the size, see GrowthPolicies.hpp
+    cv::Mat features_for(cv::Size);
+
+    // Storage of the packed plane, see NeighborKernel::pack_hsv
+    cv::Mat &get_packed_storage();
+
+    // CV_8U plane of the size, not cleared
+    cv::Mat gap_flags_for(cv::Size);
+
+    GapScratch &get_gap_scratch();
+
+    // O(1) - false when the color was already handed out since the last release_colors()
+    bool use_color(int);
+
+    // O(colors) - clears the bits of the listed colors
+    void release_colors(std::vector<int> const&);
+
+    std::vector<int> &get_colors();
+
+    std::vector<int> &get_roots();
+
+    std::vector<cv::Vec3b> &get_palette();
+
+    // The scratch of every tile, at least numTiles of them
+    std::vector<TileScratch> &tiles_for(int);
+
+    std::vector<cv::Vec2i> &get_continuations();
+
+    RegionGraph &get_graph();
+
+    // O(threads) - empties the contact list of every scratch
+    void clear_contacts();
+
+    // O(contacts) - adds the contact lists of every scratch to the graph
+    void gather_contacts(RegionGraph &);
+
+    // Makes room for the calling thread and numWorkers workers, before any of them calls scratch_for()
+    void reserve_scratch(int);
+
+    // The scratch of the worker (-1: the calling thread, see ThreadPool::current_worker)
+    Scratch &scratch_for(int);
+};
+
+void SegmentationContext::PointQueue::grow() {
+    std::vector<cv::Point> larger(std::max<size_t>(64, ring.size() * 2));
+    for (size_t i = 0; i < count; ++i) {
+        larger[i] = ring[(head + i) & (ring.size() - 1)];
+    }
+    ring.swap(larger);
+    head = 0;
+}
+
+void SegmentationContext::PointQueue::clear() {
+    head = 0;
+    count = 0;
+}
+
+bool SegmentationContext::PointQueue::empty() const {
+    return count == 0;
+}
+
+size_t SegmentationContext::PointQueue::size() const {
+    return count;
+}
+
+void SegmentationContext::PointQueue::push(cv::Point const& point) {
+    if (count == ring.size()) {
+        grow();
+    }
+    ring[(head + count) & (ring.size() - 1)] = point;
+    count++;
+}
+
+cv::Point SegmentationContext::PointQueue::pop() {
+    cv::Point point = ring[head];
+    head = (head + 1) & (ring.size() - 1);
+    count--;
+    return point;
+}
+
+cv::Mat SegmentationContext::view(cv::Mat & storage, int rows, int cols, int type) {
+    if (storage.type() != type || storage.rows < rows || storage.cols < cols) {
+        storage.create(std::max(storage.rows, rows), std::max(storage.cols, cols), type);
+    }
+    return storage(cv::Rect(0, 0, cols, rows));
+}
+
+cv::Mat SegmentationContext::labels_for(cv::Size size) {
+    bool grown = labelStorage.rows < size.height || labelStorage.cols < size.width;
+    view(labelStorage, size.height, size.width, CV_32S);
+    view(stampStorage, size.height, size.width, CV_16U);
+    // New storage holds garbage, and after a wrap the stamps of 65535 calls ago would be current again
+    if (grown || ++generation == 0) {
+        stampStorage.setTo(0);
+        generation = 1;
+    }
+    return labelStorage(cv::Rect(0, 0, size.width, size.height));
+}
+
+cv::Mat SegmentationContext::stamps_for(cv::Size size) {
+    return stampStorage(cv::Rect(0, 0, size.width, size.height));
+}
+
+uint16_t SegmentationContext::get_generation() const {
+    return generation;
+}
+
+void SegmentationContext::discard() {
+    usedColors.clear();
+}
+
+cv::Mat SegmentationContext::features_for(cv::Size size) {
+    return view(featureStorage, size.height, size.width, CV_8UC3);
+}
+
+cv::Mat &SegmentationContext::get_packed_storage() {
+    return packedStorage;
+}
+
+cv::Mat SegmentationContext::gap_flags_for(cv::Size size) {
+    return view(gapFlagStorage, size.height, size.width, CV_8U);
+}
+
+SegmentationContext::GapScratch &SegmentationContext::get_gap_scratch() {
+    return gaps;
+}
+
+bool SegmentationContext::use_color(int color) {
+    if (usedColors.empty()) {
+        usedColors.assign((1 << 24) / 64, 0);
+    }
+    uint64_t bit = (uint64_t)1 << (color & 63);
+    uint64_t &word = usedColors[(color & 0xFFFFFF) >> 6];
+    if (word & bit) {
+        return false;
+    }
+    word |= bit;
+    return true;
+}
+
+void SegmentationContext::release_colors(std::vector<int> const& released) {
+    if (usedColors.empty()) {
+        return;
+    }
+    for (int color : released) {
+        usedColors[(color & 0xFFFFFF) >> 6] &= ~((uint64_t)1 << (color & 63));
+    }
+}
+
+std::vector<int> &SegmentationContext::get_colors() {
+    return colors;
+}
+
+std::vector<int> &SegmentationContext::get_roots() {
+    return roots;
+}
+
+std::vector<cv::Vec3b> &SegmentationContext::get_palette() {
+    return palette;
+}
+
+std::vector<SegmentationContext::TileScratch> &SegmentationContext::tiles_for(int numTiles) {
+    // Only grows, so that the lists of the tiles keep their capacity
+    if ((int)tiles.size() < numTiles) {
+        tiles.resize(numTiles);
+    }
+    return tiles;
+}
+
+std::vector<cv::Vec2i> &SegmentationContext::get_continuations() {
+    return continuations;
+}
+
+RegionGraph &SegmentationContext::get_graph() {
+    return graph;
+}
+
+void SegmentationContext::clear_contacts() {
+    for (Scratch &threadScratch : scratch) {
+        threadScratch.contacts.clear();
+    }
+}
+
+void SegmentationContext::gather_contacts(RegionGraph &target) {
+    for (Scratch const& threadScratch : scratch) {
+        target.add_contacts(threadScratch.contacts);
+    }
+}
+
+void SegmentationContext::reserve_scratch(int numWorkers) {
+    if ((int)scratch.size() < numWorkers + 1) {
+        scratch.resize(numWorkers + 1);
+    }
+}
+
+SegmentationContext::Scratch &SegmentationContext::scratch_for(int worker) {
+    return scratch[worker + 1];
+}
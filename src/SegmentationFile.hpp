@@ -0,0 +1,389 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include "RegionTable.hpp"
+
+#include "opencv2/core.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Compact, memory-mappable segmentation result (.rgs).
+ *
+ * Layout (native little-endian, every section 8-byte aligned, offsets from the start of the file):
+ *   Header
+ *   Region   regions[numRegions]        region 0 is the unlabeled background
+ *   uint64_t rowIndex[height + 1]       runs of row y are runs[rowIndex[y], rowIndex[y + 1])
+ *   Run      runs[numRuns]              run-length-encoded label image, row-major
+ *   uint64_t regionRunIndex[numRegions + 1]
+ *   uint32_t regionRuns[numRuns]        indices into runs, grouped by region, row-major in a group
+ *
+ * A run only stores its first column and its region; its length is implied by the next run of the
+ * same row (or the image width). A file holds at most 2^32 runs. Region IDs are compacted: the
+ * writer keeps the roots that own at least one pixel, in increasing key order, so an ID is an
+ * index into regions[].
+ *
+ * Reading maps the file and hands out pointers into the mapping, nothing is decoded up front:
+ * pixel -> region is a binary search in the runs of one row, region -> runs is a slice of
+ * regionRuns and run -> row is a binary search in rowIndex.
+ */
+class SegmentationFile {
+public:
+    struct Header {
+        char magic[8];
+        uint32_t width;
+        uint32_t height;
+        uint32_t numRegions;
+        uint32_t flags;
+        uint64_t numRuns;
+        uint64_t regionOffset;
+        uint64_t rowIndexOffset;
+        uint64_t runOffset;
+        uint64_t regionRunIndexOffset;
+        uint64_t regionRunOffset;
+    };
+
+    struct Region {
+        uint64_t pixelCount;
+        float mean[3];          // H, S, V
+        uint32_t color;         // 0xRRGGBB, as rendered by fill_mask
+        int32_t topLeft[2];     // x, y
+        int32_t bottomRight[2]; // x, y, exclusive
+        int32_t seed[2];        // x, y, (-1, -1) for the background
+    };
+
+    struct Run {
+        uint32_t x;
+        uint32_t region;
+    };
+
+    template <typename T>
+    struct Range {
+        const T* first = nullptr;
+        const T* last = nullptr;
+
+        const T* begin() const { return first; }
+        const T* end() const { return last; }
+        size_t size() const { return (size_t)(last - first); }
+        bool empty() const { return first == last; }
+        const T& operator[](size_t i) const { return first[i]; }
+    };
+
+private:
+    static constexpr char MAGIC[8] = {'R', 'G', 'S', 'E', 'G', '0', '0', '1'};
+
+    MappedFile file;
+
+    const Header* header = nullptr;
+    const Region* regions = nullptr;
+    const uint64_t* rowIndex = nullptr;
+    const Run* runs = nullptr;
+    const uint64_t* regionRunIndex = nullptr;
+    const uint32_t* regionRuns = nullptr;
+
+    bool validate();
+
+public:
+    SegmentationFile() = default;
+
+    ~SegmentationFile();
+
+    SegmentationFile(const SegmentationFile &) = delete;
+
+    SegmentationFile &operator=(const SegmentationFile &) = delete;
+
+    // O(pixels) - compact ID of every key of the flattened label image (CV_32S root IDs, see
+    // GrowAndMerge::get_labels) and the record of every compact ID, as stored in the file
+    static void compact_regions(const cv::Mat &, const RegionTable &, std::vector<uint32_t> &, std::vector<Region> &);
+
+    // O(pixels) - labels is a flattened label image (CV_32S root IDs, see GrowAndMerge::get_labels)
+    static bool write(const std::string &, const cv::Mat &, const RegionTable &);
+
+    bool open(const std::string &);
+
+    void close();
+
+    bool is_open() const;
+
+    int width() const;
+
+    int height() const;
+
+    uint32_t num_regions() const;
+
+    uint64_t num_runs() const;
+
+    const Region& region(uint32_t) const;
+
+    // O(log runs in the row)
+    uint32_t region_at(int, int) const;
+
+    // O(1)
+    Range<Run> row_runs(int) const;
+
+    // O(1) - indices of the runs of a region, in row-major order
+    Range<uint32_t> region_runs(uint32_t) const;
+
+    const Run& run(uint64_t) const;
+
+    // O(log height)
+    int run_row(uint64_t) const;
+
+    // O(1)
+    uint32_t run_length(uint64_t) const;
+
+    // O(pixels) - rebuilds the compact label image (CV_32S)
+    void decode(cv::Mat &) const;
+};
+
+SegmentationFile::~SegmentationFile() {
+    close();
+}
+
+void SegmentationFile::compact_regions(const cv::Mat &labels, const RegionTable &table, std::vector<uint32_t> &compactId,
+                                       std::vector<Region> &regionRecords) {
+    CV_Assert(labels.type() == CV_32S);
+
+    // Compact IDs: background first, then every key that still labels a pixel. The background has
+    // no pixel statistics in the table, its bounding box is rebuilt here
+    std::vector<uint64_t> pixelCount(table.size(), 0);
+    int32_t backgroundTopLeft[2] = {INT32_MAX, INT32_MAX};
+    int32_t backgroundBottomRight[2] = {INT32_MIN, INT32_MIN};
+    for (int i = 0; i < labels.rows; ++i) {
+        const int* row = labels.ptr<int>(i);
+        for (int j = 0; j < labels.cols; ++j) {
+            pixelCount[row[j]]++;
+            if (row[j] == 0) {
+                backgroundTopLeft[0] = std::min(backgroundTopLeft[0], (int32_t)j);
+                backgroundTopLeft[1] = std::min(backgroundTopLeft[1], (int32_t)i);
+                backgroundBottomRight[0] = std::max(backgroundBottomRight[0], (int32_t)j + 1);
+                backgroundBottomRight[1] = std::max(backgroundBottomRight[1], (int32_t)i + 1);
+            }
+        }
+    }
+    compactId.assign(table.size(), 0);
+    std::vector<int> keys = {0};
+    for (size_t key = 1; key < table.size(); ++key) {
+        if (pixelCount[key] > 0) {
+            compactId[key] = (uint32_t)keys.size();
+            keys.push_back((int)key);
+        }
+    }
+
+    regionRecords.resize(keys.size());
+    for (size_t id = 0; id < keys.size(); ++id) {
+        Region &record = regionRecords[id];
+        int key = keys[id];
+        record.pixelCount = pixelCount[key];
+        record.color = (uint32_t)table.get_color(key);
+        if (key == 0) {
+            std::fill(record.mean, record.mean + 3, 0.0f);
+            if (record.pixelCount > 0) {
+                std::copy(backgroundTopLeft, backgroundTopLeft + 2, record.topLeft);
+                std::copy(backgroundBottomRight, backgroundBottomRight + 2, record.bottomRight);
+            } else {
+                std::fill(record.topLeft, record.topLeft + 2, 0);
+                std::fill(record.bottomRight, record.bottomRight + 2, 0);
+            }
+            record.seed[0] = record.seed[1] = -1;
+        } else {
+            cv::Scalar mean = table.get_mean(key);
+            cv::Rect box = table.get_bounding_box(key);
+            cv::Point seed = table.get_seed(key);
+            for (int c = 0; c < 3; ++c) {
+                record.mean[c] = (float)mean[c];
+            }
+            record.topLeft[0] = box.x;
+            record.topLeft[1] = box.y;
+            record.bottomRight[0] = box.x + box.width;
+            record.bottomRight[1] = box.y + box.height;
+            record.seed[0] = seed.x;
+            record.seed[1] = seed.y;
+        }
+    }
+}
+
+bool SegmentationFile::write(const std::string &path, const cv::Mat &labels, const RegionTable &table) {
+    std::vector<uint32_t> compactId;
+    std::vector<Region> regionRecords;
+    compact_regions(labels, table, compactId, regionRecords);
+    size_t numRegions = regionRecords.size();
+
+    std::vector<uint64_t> rowIndex(labels.rows + 1, 0);
+    std::vector<Run> runs;
+    std::vector<uint64_t> runsPerRegion(numRegions + 1, 0);
+    for (int i = 0; i < labels.rows; ++i) {
+        rowIndex[i] = runs.size();
+        const int* row = labels.ptr<int>(i);
+        for (int j = 0; j < labels.cols; ++j) {
+            if (j == 0 || row[j] != row[j - 1]) {
+                uint32_t id = compactId[row[j]];
+                runs.push_back({(uint32_t)j, id});
+                runsPerRegion[id + 1]++;
+            }
+        }
+    }
+    rowIndex[labels.rows] = runs.size();
+    if (runs.size() > UINT32_MAX) {
+        return false;
+    }
+
+    // Counting sort of the run indices by region keeps them row-major inside each group
+    std::vector<uint64_t> regionRunIndex(numRegions + 1, 0);
+    for (size_t id = 0; id < numRegions; ++id) {
+        regionRunIndex[id + 1] = regionRunIndex[id] + runsPerRegion[id + 1];
+    }
+    std::vector<uint32_t> regionRuns(runs.size());
+    std::vector<uint64_t> cursor(regionRunIndex.begin(), regionRunIndex.end() - 1);
+    for (uint64_t r = 0; r < runs.size(); ++r) {
+        regionRuns[cursor[runs[r].region]++] = (uint32_t)r;
+    }
+
+    Header fileHeader{};
+    std::memcpy(fileHeader.magic, MAGIC, sizeof(MAGIC));
+    fileHeader.width = (uint32_t)labels.cols;
+    fileHeader.height = (uint32_t)labels.rows;
+    fileHeader.numRegions = (uint32_t)numRegions;
+    fileHeader.numRuns = runs.size();
+    fileHeader.regionOffset = sizeof(Header);
+    fileHeader.rowIndexOffset = fileHeader.regionOffset + regionRecords.size() * sizeof(Region);
+    fileHeader.runOffset = fileHeader.rowIndexOffset + rowIndex.size() * sizeof(uint64_t);
+    fileHeader.regionRunIndexOffset = fileHeader.runOffset + runs.size() * sizeof(Run);
+    fileHeader.regionRunOffset = fileHeader.regionRunIndexOffset + regionRunIndex.size() * sizeof(uint64_t);
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return false;
+    }
+    out.write((const char*)&fileHeader, sizeof(Header));
+    out.write((const char*)regionRecords.data(), regionRecords.size() * sizeof(Region));
+    out.write((const char*)rowIndex.data(), rowIndex.size() * sizeof(uint64_t));
+    out.write((const char*)runs.data(), runs.size() * sizeof(Run));
+    out.write((const char*)regionRunIndex.data(), regionRunIndex.size() * sizeof(uint64_t));
+    out.write((const char*)regionRuns.data(), regionRuns.size() * sizeof(uint32_t));
+    return (bool)out;
+}
+
+bool SegmentationFile::open(const std::string &path) {
+    close();
+    if (!file.open(path) || !validate()) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SegmentationFile::close() {
+    file.close();
+    header = nullptr;
+    regions = nullptr;
+    rowIndex = nullptr;
+    runs = nullptr;
+    regionRunIndex = nullptr;
+    regionRuns = nullptr;
+}
+
+bool SegmentationFile::is_open() const {
+    return header != nullptr;
+}
+
+bool SegmentationFile::validate() {
+    const unsigned char* data = file.data();
+    size_t length = file.size();
+    if (length < sizeof(Header)) {
+        return false;
+    }
+    const Header* h = (const Header*)data;
+    if (std::memcmp(h->magic, MAGIC, sizeof(MAGIC)) != 0 || h->numRegions == 0) {
+        return false;
+    }
+
+    auto section_fits = [length](uint64_t offset, uint64_t count, size_t itemSize) {
+        return offset % 8 == 0 && offset <= length && count <= (length - offset) / itemSize;
+    };
+    if (!section_fits(h->regionOffset, h->numRegions, sizeof(Region)) ||
+        !section_fits(h->rowIndexOffset, (uint64_t)h->height + 1, sizeof(uint64_t)) ||
+        !section_fits(h->runOffset, h->numRuns, sizeof(Run)) ||
+        !section_fits(h->regionRunIndexOffset, (uint64_t)h->numRegions + 1, sizeof(uint64_t)) ||
+        !section_fits(h->regionRunOffset, h->numRuns, sizeof(uint32_t))) {
+        return false;
+    }
+
+    header = h;
+    regions = (const Region*)(data + h->regionOffset);
+    rowIndex = (const uint64_t*)(data + h->rowIndexOffset);
+    runs = (const Run*)(data + h->runOffset);
+    regionRunIndex = (const uint64_t*)(data + h->regionRunIndexOffset);
+    regionRuns = (const uint32_t*)(data + h->regionRunOffset);
+
+    // The indices are trusted by the lookups, only their end points are checked here
+    return rowIndex[h->height] == h->numRuns && regionRunIndex[h->numRegions] == h->numRuns;
+}
+
+int SegmentationFile::width() const {
+    return (int)header->width;
+}
+
+int SegmentationFile::height() const {
+    return (int)header->height;
+}
+
+uint32_t SegmentationFile::num_regions() const {
+    return header->numRegions;
+}
+
+uint64_t SegmentationFile::num_runs() const {
+    return header->numRuns;
+}
+
+const SegmentationFile::Region& SegmentationFile::region(uint32_t id) const {
+    return regions[id];
+}
+
+uint32_t SegmentationFile::region_at(int x, int y) const {
+    Range<Run> row = row_runs(y);
+    // Last run starting at or before x
+    const Run* it = std::upper_bound(row.begin(), row.end(), (uint32_t)x,
+                                     [](uint32_t value, const Run &r) { return value < r.x; });
+    return (it - 1)->region;
+}
+
+SegmentationFile::Range<SegmentationFile::Run> SegmentationFile::row_runs(int y) const {
+    return {runs + rowIndex[y], runs + rowIndex[y + 1]};
+}
+
+SegmentationFile::Range<uint32_t> SegmentationFile::region_runs(uint32_t id) const {
+    return {regionRuns + regionRunIndex[id], regionRuns + regionRunIndex[id + 1]};
+}
+
+const SegmentationFile::Run& SegmentationFile::run(uint64_t index) const {
+    return runs[index];
+}
+
+int SegmentationFile::run_row(uint64_t index) const {
+    const uint64_t* it = std::upper_bound(rowIndex, rowIndex + header->height + 1, index);
+    return (int)(it - rowIndex) - 1;
+}
+
+uint32_t SegmentationFile::run_length(uint64_t index) const {
+    bool lastOfRow = (index + 1 == header->numRuns) || runs[index + 1].x == 0;
+    uint32_t end = lastOfRow ? header->width : runs[index + 1].x;
+    return end - runs[index].x;
+}
+
+void SegmentationFile::decode(cv::Mat &labels) const {
+    labels.create(height(), width(), CV_32S);
+    for (int i = 0; i < height(); ++i) {
+        int* row = labels.ptr<int>(i);
+        Range<Run> rowRuns = row_runs(i);
+        for (size_t r = 0; r < rowRuns.size(); ++r) {
+            uint32_t end = (r + 1 < rowRuns.size()) ? rowRuns[r + 1].x : header->width;
+            std::fill(row + rowRuns[r].x, row + end, (int)rowRuns[r].region);
+        }
+    }
+}
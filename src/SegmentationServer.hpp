@@ -0,0 +1,756 @@
+#pragma once
+
+#include "ImageProcessor.hpp"
+#include "GermsPositioning.hpp"
+#include "GrowAndMerge.hpp"
+#include "MappedFile.hpp"
+#include "SegmentationFile.hpp"
+#include "ThreadPool.hpp"
+
+#include "opencv2/imgcodecs.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <csignal>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/**
+ * @brief Long-running segmentation service on a Unix domain socket (seg --daemon).
+ *
+ * Clients keep a connection open and send requests one after the other: a RequestHeader followed
+ * by payloadSize bytes, answered by a ReplyHeader followed by payloadSize bytes (native endianness,
+ * both sides run on the same host). The image of a request is either an encoded file (PNG, JPEG...),
+ * raw BGR rows of width x height, or the name of a shared memory object holding such rows, mapped
+ * read-only and never copied. The reply holds one SegmentationFile::Region per compact region ID
+ * (0 is the unlabeled background) and, when asked, the compact label image (uint32, row-major).
+ *
+ * One thread per connection reads the requests and queues them; a single segmentation thread takes
+ * every queued request (up to the batch size) at once, decodes and preprocesses the batch in parallel
+ * on the pool, then seeds and grows the images one after the other with the whole pool. The pool,
+ * the seeding quadtree, the SegmentationContext and the preprocessing buffers are created and warmed
+ * up before the socket accepts connections and are reused by every request.
+ *
+ * Latency is measured from the end of the request to its reply being ready; the percentiles over
+ * the last LATENCY_WINDOW requests are printed on shutdown and returned by a Report request.
+ */
+class SegmentationServer {
+public:
+    enum Source : uint32_t {
+        Encoded = 0, // payload: the bytes of an image file, see cv::imdecode
+        Raw = 1,     // payload: width * height * 3 bytes, BGR rows
+        Shared = 2,  // payload: the name of a shared memory object whose first bytes are BGR rows
+        Report = 3   // no payload, the reply payload is the JSON latency report
+    };
+
+    enum ReplyContent : uint32_t {
+        Statistics = 0, // region records
+        Labels = 1      // region records, then the label image
+    };
+
+    enum Status : int32_t {
+        Ok = 0,
+        BadRequest = 1,
+        BadImage = 2,
+        ShuttingDown = 3,
+        InternalError = 4 // the segmentation threw (out of memory...), the daemon goes on
+    };
+
+    struct RequestHeader {
+        uint32_t magic;       // REQUEST_MAGIC
+        uint32_t source;      // Source
+        uint32_t content;     // ReplyContent
+        int32_t width;        // Raw and Shared
+        int32_t height;       // Raw and Shared
+        int32_t maxDivision;  // <= 0: the server setting
+        uint32_t flags;       // FILL_GAPS
+        uint32_t reserved;
+        uint64_t payloadSize;
+    };
+
+    struct ReplyHeader {
+        uint32_t magic;       // REPLY_MAGIC
+        int32_t status;       // Status
+        int32_t width;
+        int32_t height;
+        uint32_t numRegions;
+        uint32_t batchSize;   // requests segmented with this one
+        double queueMs;       // from the end of the request to the start of its batch
+        double segmentMs;     // preprocessing, seeding and growing
+        uint64_t payloadSize;
+    };
+
+    static constexpr uint32_t REQUEST_MAGIC = 0x51534752; // "RGSQ"
+    static constexpr uint32_t REPLY_MAGIC = 0x52534752;   // "RGSR"
+    static constexpr uint32_t FILL_GAPS = 1;
+    static constexpr uint64_t MAX_PAYLOAD = (uint64_t)1 << 30;
+    static constexpr size_t LATENCY_WINDOW = 1 << 16;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Job {
+        RequestHeader request{};
+        std::vector<uchar> payload;
+        MappedFile shared;
+        cv::Mat image;
+        Clock::time_point received;
+
+        ReplyHeader reply{};
+        std::vector<uchar> replyPayload;
+        std::promise<void> done;
+    };
+
+    struct Connection {
+        int fd = -1;
+        std::thread thread;
+        std::atomic<bool> finished{false};
+    };
+
+    std::string socketPath;
+    int listenFd = -1;
+
+    size_t maxBatch = 8;
+    int maxDivision = 5;
+    bool fillGaps = false;
+
+    ThreadPool *threadPool = nullptr; // nullptr: ThreadPool::shared()
+
+    std::atomic<bool> stopping{false};
+
+    // Queue of the segmentation thread; closed once stopping
+    std::deque<std::shared_ptr<Job>> jobs;
+    bool closed = false;
+    std::mutex jobMutex;
+    std::condition_variable jobReady;
+
+    std::list<Connection> connections;
+
+    // Reused by every batch, only touched by the segmentation thread
+    GrowAndMerge growAndMerge;
+    GermsPositioningV2 positioningV2;
+    std::vector<ImageProcessor> processors;
+    std::vector<cv::Point> seeds;
+    cv::Mat mask;
+    std::vector<uint32_t> compactId;
+    std::vector<SegmentationFile::Region> records;
+
+    // Latencies in ms of the last LATENCY_WINDOW requests, a ring once full
+    std::vector<double> latencies;
+    size_t numRequests = 0;
+    size_t numFailures = 0;
+    size_t numBatches = 0;
+    double segmentSeconds = 0.0;
+    mutable std::mutex statsMutex;
+
+    ThreadPool &get_thread_pool();
+
+    static bool read_all(int, void*, size_t);
+
+    static bool write_all(int, const void*, size_t);
+
+    void serve(Connection &);
+
+    // Reads the payload of the request; false when the connection cannot be trusted anymore
+    bool receive(int, Job &);
+
+    void segmentation_loop();
+
+    void segment_batch(std::vector<std::shared_ptr<Job>> &);
+
+    // O(pixels) - region records (and labels) of the last rg_seg into the reply of the job
+    void build_reply(Job &);
+
+    void record(Job const&, double);
+
+    void warm_up();
+
+    static double percentile(const std::vector<double> &, double);
+
+    friend class SegmentationClient;
+
+public:
+    explicit SegmentationServer(const std::string &);
+
+    ~SegmentationServer();
+
+    SegmentationServer(const SegmentationServer &) = delete;
+
+    SegmentationServer &operator=(const SegmentationServer &) = delete;
+
+    // Most requests taken from the queue at once
+    void set_max_batch(size_t);
+
+    void set_max_division(int);
+
+    void set_fill_gaps(bool);
+
+    void set_thread_pool(ThreadPool &);
+
+    // Listens until stop() and serves the last queued requests; false when the socket cannot be opened
+    bool run();
+
+    // Only sets a flag: callable from a signal handler
+    void stop();
+
+    // Request count, failures, mean batch size and latency percentiles, as JSON
+    std::string report_json() const;
+
+    void print_report(std::ostream &) const;
+};
+
+/**
+ * @brief Blocking client of SegmentationServer, one request at a time on a kept-open connection.
+ */
+class SegmentationClient {
+private:
+    int fd = -1;
+
+public:
+    SegmentationClient() = default;
+
+    ~SegmentationClient();
+
+    SegmentationClient(const SegmentationClient &) = delete;
+
+    SegmentationClient &operator=(const SegmentationClient &) = delete;
+
+    bool connect(const std::string &);
+
+    void close();
+
+    // Sends the header (its magic and payloadSize are filled in) and the payload, waits for the reply;
+    // false on a connection error, otherwise see reply.status
+    bool request(SegmentationServer::RequestHeader, const void*, SegmentationServer::ReplyHeader &,
+                 std::vector<uchar> &);
+};
+
+SegmentationServer::SegmentationServer(const std::string &socketPath) : socketPath(socketPath) {
+    // Standard output is the daemon log, not a per-request coverage line
+    growAndMerge.set_quiet(true);
+}
+
+SegmentationServer::~SegmentationServer() {
+    stop();
+}
+
+void SegmentationServer::set_max_batch(size_t size) {
+    maxBatch = std::max<size_t>(1, size);
+}
+
+void SegmentationServer::set_max_division(int division) {
+    maxDivision = division;
+}
+
+void SegmentationServer::set_fill_gaps(bool value) {
+    fillGaps = value;
+}
+
+void SegmentationServer::set_thread_pool(ThreadPool &pool) {
+    threadPool = &pool;
+    growAndMerge.set_thread_pool(pool);
+    positioningV2.set_thread_pool(pool);
+}
+
+ThreadPool &SegmentationServer::get_thread_pool() {
+    return threadPool ? *threadPool : ThreadPool::shared();
+}
+
+void SegmentationServer::stop() {
+    stopping = true;
+}
+
+double SegmentationServer::percentile(const std::vector<double> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t rank = (size_t)std::ceil(p / 100.0 * sorted.size());
+    return sorted[std::min(sorted.size(), std::max<size_t>(1, rank)) - 1];
+}
+
+void SegmentationServer::record(Job const& job, double latencyMs) {
+    std::lock_guard<std::mutex> guard(statsMutex);
+    if (latencies.size() < LATENCY_WINDOW) {
+        latencies.push_back(latencyMs);
+    } else {
+        latencies[numRequests % LATENCY_WINDOW] = latencyMs;
+    }
+    numRequests++;
+    if (job.reply.status != Ok) {
+        numFailures++;
+    }
+}
+
+std::string SegmentationServer::report_json() const {
+    std::lock_guard<std::mutex> guard(statsMutex);
+    std::vector<double> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+
+    std::ostringstream os;
+    os << "{\"requests\": " << numRequests << ", \"failures\": " << numFailures << ", \"batches\": " << numBatches
+       << ", \"mean_batch\": " << (numBatches ? (double)numRequests / numBatches : 0.0)
+       << ", \"segment_seconds\": " << segmentSeconds
+       << ", \"latency_ms\": {\"p50\": " << percentile(sorted, 50) << ", \"p90\": " << percentile(sorted, 90)
+       << ", \"p99\": " << percentile(sorted, 99) << ", \"max\": " << (sorted.empty() ? 0.0 : sorted.back())
+       << ", \"samples\": " << sorted.size() << "}}";
+    return os.str();
+}
+
+void SegmentationServer::print_report(std::ostream &os) const {
+    std::lock_guard<std::mutex> guard(statsMutex);
+    std::vector<double> sorted(latencies);
+    std::sort(sorted.begin(), sorted.end());
+
+    char line[160];
+    std::snprintf(line, sizeof(line), "%10s %8s %8s %10s %10s %10s %10s %10s\n",
+                  "Requests", "Failed", "Batches", "Per batch", "p50 (ms)", "p90 (ms)", "p99 (ms)", "max (ms)");
+    os << line;
+    std::snprintf(line, sizeof(line), "%10zu %8zu %8zu %10.2f %10.3f %10.3f %10.3f %10.3f\n",
+                  numRequests, numFailures, numBatches, numBatches ? (double)numRequests / numBatches : 0.0,
+                  percentile(sorted, 50), percentile(sorted, 90), percentile(sorted, 99),
+                  sorted.empty() ? 0.0 : sorted.back());
+    os << line;
+}
+
+void SegmentationServer::build_reply(Job &job) {
+    const cv::Mat &labels = growAndMerge.get_labels();
+    SegmentationFile::compact_regions(labels, growAndMerge.get_regions(), compactId, records);
+
+    size_t recordBytes = records.size() * sizeof(SegmentationFile::Region);
+    size_t labelBytes = (job.request.content == Labels) ? labels.total() * sizeof(uint32_t) : 0;
+    job.replyPayload.resize(recordBytes + labelBytes);
+    std::memcpy(job.replyPayload.data(), records.data(), recordBytes);
+    if (labelBytes) {
+        uint32_t* out = reinterpret_cast<uint32_t*>(job.replyPayload.data() + recordBytes);
+        for (int i = 0; i < labels.rows; ++i) {
+            const int* row = labels.ptr<int>(i);
+            for (int j = 0; j < labels.cols; ++j) {
+                *out++ = compactId[row[j]];
+            }
+        }
+    }
+    job.reply.width = labels.cols;
+    job.reply.height = labels.rows;
+    job.reply.numRegions = (uint32_t)records.size();
+    job.reply.payloadSize = job.replyPayload.size();
+}
+
+/**
+ * Decoding and preprocessing are single-threaded per image, so they run side by side for the whole
+ * batch; seeding and growing are parallel inside each image and run one image at a time.
+ */
+void SegmentationServer::segment_batch(std::vector<std::shared_ptr<Job>> &batch) {
+    RG_STAGE("server_batch");
+    Clock::time_point begin = Clock::now();
+    int n = (int)batch.size();
+    if (processors.size() < batch.size()) {
+        processors.resize(batch.size());
+    }
+
+    get_thread_pool().parallel_for(0, n, 1, [this, &batch](int first, int last) {
+        for (int b = first; b < last; ++b) {
+            Job &job = *batch[b];
+            try {
+                if (job.request.source == Encoded) {
+                    job.image = cv::imdecode(job.payload, cv::IMREAD_COLOR);
+                }
+                if (job.image.empty()) {
+                    job.reply.status = BadImage;
+                    continue;
+                }
+                // Every view the seeding and growing stages need, computed here for the whole batch
+                processors[b].process_image(job.image);
+                processors[b].get_integral_image();
+            } catch (...) {
+                // cv::Exception on a corrupt file, std::bad_alloc on a huge one
+                job.reply.status = job.image.empty() ? BadImage : InternalError;
+            }
+        }
+    });
+
+    for (int b = 0; b < n; ++b) {
+        Job &job = *batch[b];
+        job.reply.batchSize = (uint32_t)n;
+        job.reply.queueMs = std::chrono::duration<double, std::milli>(begin - job.received).count();
+        if (job.reply.status != Ok) {
+            continue;
+        }
+        Clock::time_point start = Clock::now();
+        try {
+            const cv::Mat &image = processors[b].get_image_rgb();
+            int division = job.request.maxDivision > 0 ? job.request.maxDivision : maxDivision;
+
+            // position_germs only reads the image
+            seeds.clear();
+            positioningV2.position_germs(const_cast<cv::Mat &>(image), division, seeds, processors[b].get_integral_image());
+
+            growAndMerge.set_fill_gaps(fillGaps || (job.request.flags & FILL_GAPS));
+            growAndMerge.set_features(processors[b].get_image_hsv());
+            mask.create(image.size(), CV_8UC3);
+            mask.setTo(cv::Scalar::all(0));
+            growAndMerge.rg_seg(image, mask, seeds, false, false);
+
+            build_reply(job);
+        } catch (...) {
+            // The other jobs of the batch still get their reply; the colors this one handed out are free again
+            growAndMerge.get_context().discard();
+            job.reply.status = InternalError;
+            job.reply.width = job.reply.height = 0;
+            job.reply.numRegions = 0;
+            job.reply.payloadSize = 0;
+            job.replyPayload.clear();
+        }
+        job.reply.segmentMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(statsMutex);
+        numBatches++;
+        segmentSeconds += std::chrono::duration<double>(Clock::now() - begin).count();
+    }
+    for (int b = 0; b < n; ++b) {
+        Job &job = *batch[b];
+        // The image may point into the payload or the shared mapping: both go with the job
+        processors[b].process_image(cv::Mat());
+        record(job, std::chrono::duration<double, std::milli>(Clock::now() - job.received).count());
+        job.done.set_value();
+    }
+}
+
+void SegmentationServer::segmentation_loop() {
+    std::vector<std::shared_ptr<Job>> batch;
+    while (true) {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobReady.wait(lock, [this]() { return !jobs.empty() || closed; });
+            if (jobs.empty()) {
+                return;
+            }
+            while (!jobs.empty() && batch.size() < maxBatch) {
+                batch.push_back(std::move(jobs.front()));
+                jobs.pop_front();
+            }
+        }
+        segment_batch(batch);
+    }
+}
+
+void SegmentationServer::warm_up() {
+    // Starts the pool threads and sizes the buffers of every stage on a small synthetic image
+    cv::Mat image(64, 64, CV_8UC3);
+    for (int i = 0; i < image.rows; ++i) {
+        for (int j = 0; j < image.cols; ++j) {
+            image.at<cv::Vec3b>(i, j) = cv::Vec3b((uchar)(4 * i), (uchar)(4 * j), (uchar)(j < 32 ? 40 : 200));
+        }
+    }
+    auto job = std::make_shared<Job>();
+    job->request.magic = REQUEST_MAGIC;
+    job->request.source = Raw;
+    job->image = image;
+    job->received = Clock::now();
+    std::vector<std::shared_ptr<Job>> batch = {job};
+    segment_batch(batch);
+
+    std::lock_guard<std::mutex> guard(statsMutex);
+    latencies.clear();
+    numRequests = numFailures = numBatches = 0;
+    segmentSeconds = 0.0;
+}
+
+#if defined(_WIN32)
+
+bool SegmentationServer::read_all(int, void*, size_t) {
+    return false;
+}
+
+bool SegmentationServer::write_all(int, const void*, size_t) {
+    return false;
+}
+
+bool SegmentationServer::receive(int, Job &) {
+    return false;
+}
+
+void SegmentationServer::serve(Connection &connection) {
+    connection.finished = true;
+}
+
+bool SegmentationServer::run() {
+    std::cerr << "The segmentation daemon needs Unix domain sockets" << std::endl;
+    return false;
+}
+
+SegmentationClient::~SegmentationClient() { }
+
+bool SegmentationClient::connect(const std::string &) {
+    return false;
+}
+
+void SegmentationClient::close() { }
+
+bool SegmentationClient::request(SegmentationServer::RequestHeader, const void*, SegmentationServer::ReplyHeader &,
+                                 std::vector<uchar> &) {
+    return false;
+}
+
+#else
+
+bool SegmentationServer::read_all(int fd, void* data, size_t size) {
+    char* cursor = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t count = ::read(fd, cursor, size);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        cursor += count;
+        size -= (size_t)count;
+    }
+    return true;
+}
+
+bool SegmentationServer::write_all(int fd, const void* data, size_t size) {
+    const char* cursor = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t count = ::write(fd, cursor, size);
+        if (count < 0 && errno == EINTR) {
+            continue;
+        }
+        if (count <= 0) {
+            return false;
+        }
+        cursor += count;
+        size -= (size_t)count;
+    }
+    return true;
+}
+
+bool SegmentationServer::receive(int fd, Job &job) {
+    const RequestHeader &request = job.request;
+    if (request.magic != REQUEST_MAGIC || request.payloadSize > MAX_PAYLOAD) {
+        return false;
+    }
+    job.payload.resize((size_t)request.payloadSize);
+    if (!read_all(fd, job.payload.data(), job.payload.size())) {
+        return false;
+    }
+    job.received = Clock::now();
+
+    bool sized = request.width > 0 && request.height > 0 && (uint64_t)request.width * request.height * 3 <= MAX_PAYLOAD;
+    size_t bytes = sized ? (size_t)request.width * request.height * 3 : 0;
+    if (request.source == Raw && sized && job.payload.size() == bytes) {
+        job.image = cv::Mat(request.height, request.width, CV_8UC3, job.payload.data());
+    } else if (request.source == Shared && sized) {
+        std::string name(job.payload.begin(), job.payload.end());
+        if (job.shared.open_shared(name) && job.shared.size() >= bytes) {
+            job.image = cv::Mat(request.height, request.width, CV_8UC3, const_cast<uchar*>(job.shared.data()));
+        } else {
+            job.reply.status = BadImage;
+        }
+    } else if (request.source != Encoded || request.content > Labels) {
+        job.reply.status = BadRequest;
+    }
+    return true;
+}
+
+void SegmentationServer::serve(Connection &connection) {
+    int fd = connection.fd;
+    while (!stopping) {
+        auto job = std::make_shared<Job>();
+        if (!read_all(fd, &job->request, sizeof(RequestHeader))) {
+            break;
+        }
+        job->reply.magic = REPLY_MAGIC;
+        job->reply.status = Ok;
+
+        if (job->request.magic == REQUEST_MAGIC && job->request.source == Report) {
+            std::string report = report_json();
+            job->reply.payloadSize = report.size();
+            if (!write_all(fd, &job->reply, sizeof(ReplyHeader)) || !write_all(fd, report.data(), report.size())) {
+                break;
+            }
+            continue;
+        }
+        if (!receive(fd, *job)) {
+            // The next header cannot be found anymore: answer and drop the connection
+            job->reply.status = BadRequest;
+            write_all(fd, &job->reply, sizeof(ReplyHeader));
+            break;
+        }
+
+        std::future<void> done = job->done.get_future();
+        bool queued = false;
+        if (job->reply.status == Ok) {
+            std::lock_guard<std::mutex> guard(jobMutex);
+            if (closed) {
+                job->reply.status = ShuttingDown;
+            } else {
+                jobs.push_back(job);
+                queued = true;
+            }
+        }
+        if (queued) {
+            jobReady.notify_one();
+            done.wait();
+        } else {
+            record(*job, std::chrono::duration<double, std::milli>(Clock::now() - job->received).count());
+        }
+
+        if (!write_all(fd, &job->reply, sizeof(ReplyHeader)) ||
+            !write_all(fd, job->replyPayload.data(), job->replyPayload.size())) {
+            break;
+        }
+    }
+    connection.finished = true;
+}
+
+bool SegmentationServer::run() {
+    sockaddr_un address{};
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Socket path too long: " << socketPath << std::endl;
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    // A client closing early must not kill the daemon
+    std::signal(SIGPIPE, SIG_IGN);
+
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+        std::cerr << "Cannot create a socket: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    ::unlink(socketPath.c_str());
+    if (bind(listenFd, (sockaddr*)&address, sizeof(address)) != 0 || listen(listenFd, 64) != 0) {
+        std::cerr << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        ::close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    warm_up();
+    std::thread segmentation([this]() { segmentation_loop(); });
+    std::cout << "Listening on " << socketPath << " (" << get_thread_pool().get_num_workers() << " workers)" << std::endl;
+
+    while (!stopping) {
+        // Wakes up regularly to notice stop()
+        pollfd pending{listenFd, POLLIN, 0};
+        int ready = poll(&pending, 1, 200);
+        for (auto it = connections.begin(); it != connections.end();) {
+            if (it->finished) {
+                it->thread.join();
+                ::close(it->fd);
+                it = connections.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (ready <= 0 || !(pending.revents & POLLIN)) {
+            continue;
+        }
+        int fd = accept(listenFd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        connections.emplace_back();
+        Connection &connection = connections.back();
+        connection.fd = fd;
+        connection.thread = std::thread([this, &connection]() { serve(connection); });
+    }
+
+    ::close(listenFd);
+    listenFd = -1;
+    ::unlink(socketPath.c_str());
+
+    // The queued requests are still answered, the new ones are refused
+    {
+        std::lock_guard<std::mutex> guard(jobMutex);
+        closed = true;
+    }
+    jobReady.notify_all();
+    segmentation.join();
+
+    for (Connection &connection : connections) {
+        shutdown(connection.fd, SHUT_RDWR);
+    }
+    for (Connection &connection : connections) {
+        connection.thread.join();
+        ::close(connection.fd);
+    }
+    connections.clear();
+    return true;
+}
+
+SegmentationClient::~SegmentationClient() {
+    close();
+}
+
+bool SegmentationClient::connect(const std::string &socketPath) {
+    close();
+    sockaddr_un address{};
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    address.sun_family = AF_UNIX;
+    std::strncpy(address.sun_path, socketPath.c_str(), sizeof(address.sun_path) - 1);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return false;
+    }
+    if (::connect(fd, (sockaddr*)&address, sizeof(address)) != 0) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+void SegmentationClient::close() {
+    if (fd >= 0) {
+        ::close(fd);
+    }
+    fd = -1;
+}
+
+bool SegmentationClient::request(SegmentationServer::RequestHeader header, const void* payload,
+                                 SegmentationServer::ReplyHeader &reply, std::vector<uchar> &replyPayload) {
+    header.magic = SegmentationServer::REQUEST_MAGIC;
+    if (header.source == SegmentationServer::Report) {
+        header.payloadSize = 0;
+    }
+    if (fd < 0 || !SegmentationServer::write_all(fd, &header, sizeof(header)) ||
+        !SegmentationServer::write_all(fd, payload, (size_t)header.payloadSize) ||
+        !SegmentationServer::read_all(fd, &reply, sizeof(reply)) || reply.magic != SegmentationServer::REPLY_MAGIC) {
+        return false;
+    }
+    replyPayload.resize((size_t)reply.payloadSize);
+    return SegmentationServer::read_all(fd, replyPayload.data(), replyPayload.size());
+}
+
+#endif
@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Work-stealing thread pool shared by the seeding, growing and rendering stages.
+ *
+ * Every worker owns a deque: it pushes and pops its own tasks at the back (depth-first, cache
+ * friendly for recursive subdivisions) while idle workers steal from the front of the others. The
+ * deque is a ring allocated with the pool, only reallocated when it overflows, so that queueing a
+ * task whose function fits the small buffer of std::function allocates nothing.
+ * Tasks are attached to a TaskGroup; wait() returns once every task of the group, including the
+ * tasks they spawned, has finished. A worker calling wait() keeps executing tasks meanwhile, so
+ * nested waits never deadlock; any other thread simply blocks.
+ *
+ * shared() is the process-wide instance: stages use it by default so that the process never runs
+ * more compute threads than set_shared_num_workers() asked for (default: hardware concurrency).
+ */
+class ThreadPool {
+public:
+    class TaskGroup {
+    private:
+        std::atomic<int> pending{0};
+        std::mutex errorMutex;
+        std::exception_ptr error;
+
+        friend class ThreadPool;
+    };
+
+private:
+    struct Task {
+        std::function<void()> function;
+        TaskGroup *group;
+    };
+
+    // Double-ended queue of tasks on a ring, twice as large whenever it is full
+    struct Worker {
+        std::mutex mutex;
+        std::vector<Task> ring; // power of two size
+        size_t head = 0;
+        size_t count = 0;
+
+        Worker();
+
+        void grow();
+
+        // O(1) amortized
+        void push_back(Task &&);
+
+        // O(1)
+        Task pop_back();
+
+        // O(1)
+        Task pop_front();
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    std::atomic<int> queued{0};
+    std::atomic<unsigned> nextQueue{0};
+    std::atomic<bool> stopping{false};
+
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+
+    std::mutex doneMutex;
+    std::condition_variable done;
+
+    static int &shared_num_workers();
+
+    static thread_local ThreadPool *currentPool;
+    static thread_local int currentWorker;
+
+    void worker_loop(int);
+
+    bool try_pop(int, Task &);
+
+    bool try_steal(int, Task &);
+
+    bool run_one(int);
+
+    void execute(Task &);
+
+public:
+    explicit ThreadPool(int numWorkers = 0);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    static ThreadPool &shared();
+
+    // Only effective before the first call to shared()
+    static void set_shared_num_workers(int);
+
+    int get_num_workers() const;
+
+    // Index of the calling worker in [0, get_num_workers()), -1 outside of this pool
+    int current_worker() const;
+
+    void run(TaskGroup &, std::function<void()>);
+
+    // Rethrows the first exception raised by a task of the group
+    void wait(TaskGroup &);
+
+    // Calls function(begin, end) on chunks of [begin, end) of at most grain items and waits. A single
+    // chunk, or a pool of one worker, runs on the calling thread without queueing any task
+    template <class Function>
+    void parallel_for(int, int, int, const Function &);
+};
+
+thread_local ThreadPool *ThreadPool::currentPool = nullptr;
+thread_local int ThreadPool::currentWorker = -1;
+
+// Room for every task of a parallel_for() over the rows of an 8K image (540 chunks of
+// BasicGrowAndMerge::row_grain()), even when they all land on one worker
+ThreadPool::Worker::Worker() : ring(1024) {}
+
+void ThreadPool::Worker::grow() {
+    std::vector<Task> larger(ring.size() * 2);
+    for (size_t i = 0; i < count; ++i) {
+        larger[i] = std::move(ring[(head + i) & (ring.size() - 1)]);
+    }
+    ring.swap(larger);
+    head = 0;
+}
+
+void ThreadPool::Worker::push_back(Task &&task) {
+    if (count == ring.size()) {
+        grow();
+    }
+    ring[(head + count) & (ring.size() - 1)] = std::move(task);
+    count++;
+}
+
+ThreadPool::Task ThreadPool::Worker::pop_back() {
+    count--;
+    return std::move(ring[(head + count) & (ring.size() - 1)]);
+}
+
+ThreadPool::Task ThreadPool::Worker::pop_front() {
+    Task task = std::move(ring[head]);
+    head = (head + 1) & (ring.size() - 1);
+    count--;
+    return task;
+}
+
+ThreadPool::ThreadPool(int numWorkers) {
+    if (numWorkers <= 0) {
+        numWorkers = (int)std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (int i = 0; i < numWorkers; ++i) {
+        workers.emplace_back(new Worker());
+    }
+    for (int i = 0; i < numWorkers; ++i) {
+        threads.emplace_back(&ThreadPool::worker_loop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (std::thread &t : threads) {
+        t.join();
+    }
+}
+
+int &ThreadPool::shared_num_workers() {
+    static int numWorkers = 0;
+    return numWorkers;
+}
+
+ThreadPool &ThreadPool::shared() {
+    static ThreadPool pool(shared_num_workers());
+    return pool;
+}
+
+void ThreadPool::set_shared_num_workers(int numWorkers) {
+    shared_num_workers() = numWorkers;
+}
+
+int ThreadPool::get_num_workers() const {
+    return (int)workers.size();
+}
+
+int ThreadPool::current_worker() const {
+    return (currentPool == this) ? currentWorker : -1;
+}
+
+void ThreadPool::run(TaskGroup &group, std::function<void()> function) {
+    group.pending++;
+
+    int owner = current_worker();
+    if (owner < 0) {
+        owner = (int)(nextQueue++ % workers.size());
+    }
+    {
+        std::lock_guard<std::mutex> guard(workers[owner]->mutex);
+        workers[owner]->push_back(Task{std::move(function), &group});
+    }
+    queued++;
+    {
+        std::lock_guard<std::mutex> guard(sleepMutex);
+    }
+    wakeUp.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup &group) {
+    int self = current_worker();
+    if (self >= 0) {
+        while (group.pending > 0) {
+            if (!run_one(self)) {
+                std::this_thread::yield();
+            }
+        }
+    } else {
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&group]() { return group.pending == 0; });
+    }
+
+    std::lock_guard<std::mutex> guard(group.errorMutex);
+    if (group.error) {
+        std::exception_ptr error = group.error;
+        group.error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
+
+template <class Function>
+void ThreadPool::parallel_for(int begin, int end, int grain, const Function &function) {
+    grain = std::max(1, grain);
+    if (end - begin <= grain || workers.size() == 1) {
+        for (int first = begin; first < end; first += grain) {
+            function(first, std::min(end, first + grain));
+        }
+        return;
+    }
+
+    // The task only holds a reference and two ints, small enough for std::function not to allocate
+    TaskGroup group;
+    for (int first = begin; first < end; first += grain) {
+        int last = std::min(end, first + grain);
+        run(group, [&function, first, last]() { function(first, last); });
+    }
+    wait(group);
+}
+
+bool ThreadPool::try_pop(int self, Task &task) {
+    Worker &worker = *workers[self];
+    std::lock_guard<std::mutex> guard(worker.mutex);
+    if (worker.count == 0) {
+        return false;
+    }
+    task = worker.pop_back();
+    return true;
+}
+
+bool ThreadPool::try_steal(int self, Task &task) {
+    int numWorkers = (int)workers.size();
+    for (int i = 1; i < numWorkers; ++i) {
+        Worker &victim = *workers[(self + i) % numWorkers];
+        std::lock_guard<std::mutex> guard(victim.mutex);
+        if (victim.count > 0) {
+            task = victim.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ThreadPool::run_one(int self) {
+    Task task;
+    if (try_pop(self, task) || try_steal(self, task)) {
+        queued--;
+        execute(task);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::execute(Task &task) {
+    try {
+        task.function();
+    } catch (...) {
+        std::lock_guard<std::mutex> guard(task.group->errorMutex);
+        if (!task.group->error) {
+            task.group->error = std::current_exception();
+        }
+    }
+
+    if (--task.group->pending == 0) {
+        std::lock_guard<std::mutex> guard(doneMutex);
+        done.notify_all();
+    }
+}
+
+void ThreadPool::worker_loop(int self) {
+    currentPool = this;
+    currentWorker = self;
+
+    while (true) {
+        if (run_one(self)) {
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this]() { return stopping || queued > 0; });
+        if (stopping && queued == 0) {
+            return;
+        }
+    }
+}
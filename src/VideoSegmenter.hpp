@@ -0,0 +1,270 @@
+#pragma once
+
+#include "GermsPositioning.hpp"
+#include "GrowAndMerge.hpp"
+
+#include "opencv2/imgproc.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/**
+ * @brief Temporally coherent segmentation of a stream of frames from a fixed camera.
+ *
+ * The label image and the region table of the previous frame are kept. Each new frame is compared
+ * block by block with a reference image (mean absolute gray difference); the changed blocks, grown
+ * by one block so that region borders can settle, are the only ones seeded again and re-grown, see
+ * GrowAndMerge::rg_seg_update(). Everything else keeps its region ID and color. The reference only
+ * follows the frame in the re-segmented blocks, so a slow drift is eventually caught as well.
+ *
+ * The first frame, a change of frame size, or a change covering more than the key frame ratio of
+ * the blocks (a scene cut) trigger a full segmentation.
+ */
+class VideoSegmenter {
+private:
+    GrowAndMerge growAndMerge;
+
+    cv::Mat reference;
+
+    int blockSize = 32;
+    double changeThreshold = 10.0;
+    double keyFrameRatio = 0.5;
+    int maxDivision = 5;
+    bool randColorization = false;
+    bool onlyEdge = false;
+
+    size_t frameCount = 0;
+    double changedRatio = 1.0;
+
+    // O(pixels) - CV_8U grid with one cell per block, non-zero when the block changed
+    void changed_blocks(const cv::Mat &, cv::Mat &) const;
+
+    // Connected components (8-connected) of the changed blocks, as pixel rectangles
+    std::vector<cv::Rect> changed_areas(const cv::Mat &, const cv::Size &) const;
+
+    void seed_area(cv::Mat &, const cv::Rect &, const cv::Mat &, std::vector<cv::Point> &);
+
+    void full_frame(cv::Mat &, cv::Mat &);
+
+public:
+    // Preprocesses the BGR frame like ImageProcessor::process_image and renders its segmentation
+    void process_frame(const cv::Mat &, cv::Mat &);
+
+    // The next frame is segmented from scratch
+    void reset();
+
+    const cv::Mat& get_labels() const;
+
+    const RegionTable& get_regions() const;
+
+    size_t get_frame_count() const;
+
+    // Fraction of the blocks re-segmented for the last frame (1 for a full segmentation)
+    double get_changed_ratio() const;
+
+    void set_block_size(int);
+
+    void set_change_threshold(double);
+
+    void set_key_frame_ratio(double);
+
+    void set_max_division(int);
+
+    void set_rand_colorization(bool);
+
+    void set_only_edge(bool);
+
+    GrowAndMerge& get_grow_and_merge();
+};
+
+void VideoSegmenter::process_frame(const cv::Mat &frame, cv::Mat &mask) {
+    // Same image as ImageProcessor::get_image_rgb() after process_image(frame)
+    cv::Mat image;
+    cv::GaussianBlur(frame, image, cv::Size(5, 5), 0, 0);
+
+    mask = cv::Mat::zeros(image.size(), CV_8UC3);
+    frameCount++;
+
+    if (reference.empty() || reference.size() != image.size()) {
+        full_frame(image, mask);
+        return;
+    }
+
+    cv::Mat blocks;
+    changed_blocks(image, blocks);
+
+    int numChanged = cv::countNonZero(blocks);
+    changedRatio = (double)numChanged / (double)blocks.total();
+    if (numChanged == 0) {
+        growAndMerge.render_mask(mask, onlyEdge);
+        return;
+    }
+    if (changedRatio > keyFrameRatio) {
+        full_frame(image, mask);
+        return;
+    }
+
+    cv::Mat dirty(image.size(), CV_8U, cv::Scalar(0));
+    for (int by = 0; by < blocks.rows; ++by) {
+        for (int bx = 0; bx < blocks.cols; ++bx) {
+            if (blocks.at<uchar>(by, bx)) {
+                cv::Rect block = cv::Rect(bx * blockSize, by * blockSize, blockSize, blockSize) &
+                                 cv::Rect(0, 0, image.cols, image.rows);
+                dirty(block).setTo(255);
+            }
+        }
+    }
+
+    std::vector<cv::Point> seeds;
+    for (const cv::Rect &area : changed_areas(blocks, image.size())) {
+        seed_area(image, area, dirty, seeds);
+    }
+
+    growAndMerge.rg_seg_update(image, mask, dirty, seeds, randColorization, onlyEdge);
+    image.copyTo(reference, dirty);
+}
+
+void VideoSegmenter::changed_blocks(const cv::Mat &image, cv::Mat &blocks) const {
+    cv::Mat diff, grayDiff, sum;
+    cv::absdiff(image, reference, diff);
+    cv::cvtColor(diff, grayDiff, cv::COLOR_BGR2GRAY);
+    cv::integral(grayDiff, sum, CV_64F);
+
+    int blocksX = (image.cols + blockSize - 1) / blockSize;
+    int blocksY = (image.rows + blockSize - 1) / blockSize;
+    cv::Mat changed(blocksY, blocksX, CV_8U, cv::Scalar(0));
+    for (int by = 0; by < blocksY; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx) {
+            int x0 = bx * blockSize, y0 = by * blockSize;
+            int x1 = std::min(image.cols, x0 + blockSize), y1 = std::min(image.rows, y0 + blockSize);
+            double total = sum.at<double>(y1, x1) - sum.at<double>(y0, x1) - sum.at<double>(y1, x0) + sum.at<double>(y0, x0);
+            if (total / ((double)(x1 - x0) * (y1 - y0)) > changeThreshold) {
+                changed.at<uchar>(by, bx) = 255;
+            }
+        }
+    }
+
+    // One block of margin around every change
+    cv::dilate(changed, blocks, cv::Mat::ones(3, 3, CV_8U));
+}
+
+std::vector<cv::Rect> VideoSegmenter::changed_areas(const cv::Mat &blocks, const cv::Size &imageSize) const {
+    std::vector<cv::Rect> areas;
+    cv::Mat visited(blocks.size(), CV_8U, cv::Scalar(0));
+    std::vector<cv::Point> stack;
+
+    for (int by = 0; by < blocks.rows; ++by) {
+        for (int bx = 0; bx < blocks.cols; ++bx) {
+            if (!blocks.at<uchar>(by, bx) || visited.at<uchar>(by, bx)) {
+                continue;
+            }
+            cv::Point topLeft(bx, by), bottomRight(bx, by);
+            visited.at<uchar>(by, bx) = 1;
+            stack.emplace_back(bx, by);
+            while (!stack.empty()) {
+                cv::Point block = stack.back();
+                stack.pop_back();
+                topLeft.x = std::min(topLeft.x, block.x);
+                topLeft.y = std::min(topLeft.y, block.y);
+                bottomRight.x = std::max(bottomRight.x, block.x);
+                bottomRight.y = std::max(bottomRight.y, block.y);
+                for (int dy = -1; dy <= 1; ++dy) {
+                    for (int dx = -1; dx <= 1; ++dx) {
+                        cv::Point next(block.x + dx, block.y + dy);
+                        if (next.x >= 0 && next.y >= 0 && next.x < blocks.cols && next.y < blocks.rows &&
+                            blocks.at<uchar>(next) && !visited.at<uchar>(next)) {
+                            visited.at<uchar>(next) = 1;
+                            stack.push_back(next);
+                        }
+                    }
+                }
+            }
+            areas.push_back(cv::Rect(topLeft * blockSize, (bottomRight + cv::Point(1, 1)) * blockSize) &
+                            cv::Rect(cv::Point(0, 0), imageSize));
+        }
+    }
+    return areas;
+}
+
+void VideoSegmenter::seed_area(cv::Mat &image, const cv::Rect &area, const cv::Mat &dirty, std::vector<cv::Point> &seeds) {
+    // Same smallest quad as a full frame: the subdivision depth shrinks with the area
+    double minQuad = std::max(1.0, std::max(image.cols, image.rows) / std::pow(2.0, maxDivision));
+    int division = (int)std::ceil(std::log2(std::max(1.0, std::max(area.width, area.height) / minQuad)));
+    division = std::max(1, std::min(maxDivision, division));
+
+    cv::Mat part = image(area).clone();
+    std::vector<cv::Point> areaSeeds;
+    GermsPositioningV2 positioningV2;
+    positioningV2.set_thread_pool(growAndMerge.get_thread_pool());
+    positioningV2.position_germs(part, division, areaSeeds);
+
+    for (const cv::Point &seed : areaSeeds) {
+        cv::Point pixel = seed + area.tl();
+        if (dirty.at<uchar>(pixel)) {
+            seeds.push_back(pixel);
+        }
+    }
+}
+
+void VideoSegmenter::full_frame(cv::Mat &image, cv::Mat &mask) {
+    std::vector<cv::Point> seeds;
+    GermsPositioningV2 positioningV2;
+    positioningV2.set_thread_pool(growAndMerge.get_thread_pool());
+    positioningV2.position_germs(image, maxDivision, seeds);
+
+    growAndMerge.rg_seg(image, mask, seeds, randColorization, onlyEdge);
+    reference = image.clone();
+    changedRatio = 1.0;
+}
+
+void VideoSegmenter::reset() {
+    reference.release();
+    frameCount = 0;
+    changedRatio = 1.0;
+}
+
+const cv::Mat& VideoSegmenter::get_labels() const {
+    return growAndMerge.get_labels();
+}
+
+const RegionTable& VideoSegmenter::get_regions() const {
+    return growAndMerge.get_regions();
+}
+
+size_t VideoSegmenter::get_frame_count() const {
+    return frameCount;
+}
+
+double VideoSegmenter::get_changed_ratio() const {
+    return changedRatio;
+}
+
+void VideoSegmenter::set_block_size(int size) {
+    blockSize = std::max(1, size);
+    reset();
+}
+
+void VideoSegmenter::set_change_threshold(double threshold) {
+    changeThreshold = threshold;
+}
+
+void VideoSegmenter::set_key_frame_ratio(double ratio) {
+    keyFrameRatio = ratio;
+}
+
+void VideoSegmenter::set_max_division(int division) {
+    maxDivision = division;
+}
+
+void VideoSegmenter::set_rand_colorization(bool value) {
+    randColorization = value;
+}
+
+void VideoSegmenter::set_only_edge(bool value) {
+    onlyEdge = value;
+}
+
+GrowAndMerge& VideoSegmenter::get_grow_and_merge() {
+    return growAndMerge;
+}
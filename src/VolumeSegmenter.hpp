@@ -0,0 +1,589 @@
+#pragma once
+
+#include "MappedFile.hpp"
+#include "GermsPositioning.hpp"
+#include "GrowthPolicies.hpp"
+#include "RegionGraph.hpp"
+#include "RegionTable.hpp"
+#include "ThreadPool.hpp"
+
+#include "opencv2/imgcodecs.hpp"
+#include "opencv2/imgproc.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// Slices [z0, z1) of the volume with their own region table, label IDs local to the slab
+struct VolumeSlab {
+    int z0 = 0;
+    int z1 = 0;
+    std::vector<cv::Mat> bgr;
+    std::vector<cv::Mat> packed;
+    std::vector<cv::Mat> labels;
+    RegionTable regions;
+    std::vector<uint64_t> contacts;
+    std::vector<cv::Point3i> queue;
+};
+
+/**
+ * @brief Region growing over a volume given as a stack of 2D slices (CT, microscopy).
+ *
+ * The slices are streamed: the volume is cut along z into slabs whose depth follows the memory
+ * budget, and only one wave of slabs, one per worker of the pool, is resident at a time. Each slab
+ * is blurred slice by slice like ImageProcessor::process_image, seeded by an octree subdivision
+ * (GermsPositioningOctree) and grown on its own with the predicate of BasicGrowAndMerge over the
+ * 6 or 26 neighbors of a voxel, recording the region contacts. Once a wave is done its region
+ * tables are appended to the global one, its provisional labels are written to the label file and
+ * its first slice is put in contact with the last slice of the slab before. A single merge stage,
+ * the one of MergeStrategy::Graph, then merges the adjacent regions by increasing distance of their
+ * means, across the slab borders as well as within the slabs, and a final pass over the label file
+ * rewrites every voxel with its root ID.
+ *
+ * Outputs: <prefix>_labels.raw (int32 root IDs, slice after slice, row-major, native endianness)
+ * and optionally <prefix>_seg_NNNN.png (rendered slices). Bounding boxes of the region table are
+ * the xy footprints of the regions.
+ */
+template <class Predicate, class Connectivity>
+class BasicVolumeSegmenter {
+private:
+    // Slab working set per voxel: blurred BGR, features, packed features, labels and the HSV
+    // summed-area tables (2 x 3 x CV_64F) of the seeding
+    static constexpr size_t BYTES_PER_VOXEL = 3 + 3 + 4 + 4 + 48;
+
+    // Either a list of slice images or a memory-mapped raw volume
+    std::vector<std::filesystem::path> slicePaths;
+    MappedFile input;
+    int rawChannels = 0;
+
+    cv::Size sliceSize;
+    int depth = 0;
+
+    size_t memoryBudget = (size_t)512 << 20;
+    int maxDivision = 5;
+    bool writeMasks = false;
+    ThreadPool *threadPool = nullptr; // nullptr: ThreadPool::shared()
+
+    RegionTable regions;
+    std::vector<uint64_t> contacts;
+    int slabDepth = 0;
+    int numSlabs = 0;
+
+    bool read_slice(int, cv::Mat &) const;
+
+    void process_slab(VolumeSlab &) const;
+
+    void grow_region(VolumeSlab &, const cv::Point3i &, int) const;
+
+    // O(voxels of the slice) - contacts between the first slice of a slab and the last one of the slab before
+    void stitch(const cv::Mat &, const cv::Mat &);
+
+    bool mergeable(int, int) const;
+
+    static double mean_distance(RegionTable const&, int, int);
+
+    // Graph merge stage over the contacts of every slab, see BasicGrowAndMerge::merge_graph
+    void merge_regions();
+
+    bool finalize(const std::string &, const std::string &);
+
+public:
+    // Directory of slice images (sorted by name) or text file listing them, one per line
+    bool open_slices(const std::string &);
+
+    // Headerless 8-bit volume, slice after slice, with 1 (gray) or 3 (BGR) channels per voxel
+    bool open_raw(const std::string &, const cv::Size &, int, int);
+
+    void set_memory_budget(size_t);
+
+    void set_max_division(int);
+
+    // Also renders every slice to <prefix>_seg_NNNN.png
+    void set_write_masks(bool);
+
+    ThreadPool &get_thread_pool();
+
+    void set_thread_pool(ThreadPool &);
+
+    cv::Size get_slice_size() const;
+
+    int get_depth() const;
+
+    // Slices per slab for the current budget, slice size and number of workers
+    int get_slab_depth();
+
+    int get_num_slabs() const;
+
+    const RegionTable& get_regions() const;
+
+    bool run(const std::string &);
+};
+
+using VolumeSegmenter = BasicVolumeSegmenter<HsvIntervalPredicate, SixConnected>;
+
+template <class Predicate, class Connectivity>
+bool BasicVolumeSegmenter<Predicate, Connectivity>::open_slices(const std::string &path) {
+    slicePaths.clear();
+    input.close();
+
+    std::filesystem::path source(path);
+    if (std::filesystem::is_directory(source)) {
+        const std::vector<std::string> extensions = {".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff",
+                                                     ".ppm", ".pgm", ".pnm", ".webp"};
+        for (const auto &entry : std::filesystem::directory_iterator(source)) {
+            std::string extension = entry.path().extension().string();
+            std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (entry.is_regular_file() &&
+                std::find(extensions.begin(), extensions.end(), extension) != extensions.end()) {
+                slicePaths.push_back(entry.path());
+            }
+        }
+        std::sort(slicePaths.begin(), slicePaths.end());
+    } else {
+        // One path per line, blank lines and '#' comments are skipped
+        std::ifstream list(source);
+        std::string line;
+        while (std::getline(list, line)) {
+            if (!line.empty() && line.back() == '\r') {
+                line.pop_back();
+            }
+            if (!line.empty() && line[0] != '#') {
+                slicePaths.emplace_back(line);
+            }
+        }
+    }
+
+    // The first slice gives the size of every other one
+    cv::Mat first = slicePaths.empty() ? cv::Mat() : cv::imread(slicePaths[0].string(), cv::IMREAD_COLOR);
+    if (first.empty()) {
+        slicePaths.clear();
+        std::cerr << "No readable slice in " << path << std::endl;
+        return false;
+    }
+    sliceSize = first.size();
+    depth = (int)slicePaths.size();
+    return true;
+}
+
+template <class Predicate, class Connectivity>
+bool BasicVolumeSegmenter<Predicate, Connectivity>::open_raw(const std::string &path, const cv::Size &size, int numSlices,
+                                                             int channels) {
+    slicePaths.clear();
+    if ((channels != 1 && channels != 3) || size.area() <= 0 || numSlices <= 0 || !input.open(path) ||
+        input.size() < (size_t)size.width * size.height * channels * numSlices) {
+        input.close();
+        std::cerr << "Raw volume too small for " << size.width << "x" << size.height << "x" << numSlices
+                  << " with " << channels << " channel(s): " << path << std::endl;
+        return false;
+    }
+    sliceSize = size;
+    depth = numSlices;
+    rawChannels = channels;
+    return true;
+}
+
+template <class Predicate, class Connectivity>
+void BasicVolumeSegmenter<Predicate, Connectivity>::set_memory_budget(size_t bytes) {
+    memoryBudget = bytes;
+}
+
+template <class Predicate, class Connectivity>
+void BasicVolumeSegmenter<Predicate, Connectivity>::set_max_division(int division) {
+    maxDivision = division;
+}
+
+template <class Predicate, class Connectivity>
+void BasicVolumeSegmenter<Predicate, Connectivity>::set_write_masks(bool value) {
+    writeMasks = value;
+}
+
+template <class Predicate, class Connectivity>
+ThreadPool &BasicVolumeSegmenter<Predicate, Connectivity>::get_thread_pool() {
+    return threadPool ? *threadPool : ThreadPool::shared();
+}
+
+template <class Predicate, class Connectivity>
+void BasicVolumeSegmenter<Predicate, Connectivity>::set_thread_pool(ThreadPool &pool) {
+    threadPool = &pool;
+}
+
+template <class Predicate, class Connectivity>
+cv::Size BasicVolumeSegmenter<Predicate, Connectivity>::get_slice_size() const {
+    return sliceSize;
+}
+
+template <class Predicate, class Connectivity>
+int BasicVolumeSegmenter<Predicate, Connectivity>::get_depth() const {
+    return depth;
+}
+
+template <class Predicate, class Connectivity>
+int BasicVolumeSegmenter<Predicate, Connectivity>::get_slab_depth() {
+    if (sliceSize.area() <= 0 || depth <= 0) {
+        return 0;
+    }
+    size_t bytesPerSlice = (size_t)sliceSize.area() * BYTES_PER_VOXEL * get_thread_pool().get_num_workers();
+    return std::max(1, (int)std::min<size_t>(memoryBudget / bytesPerSlice, (size_t)depth));
+}
+
+template <class Predicate, class Connectivity>
+int BasicVolumeSegmenter<Predicate, Connectivity>::get_num_slabs() const {
+    return numSlabs;
+}
+
+template <class Predicate, class Connectivity>
+const RegionTable& BasicVolumeSegmenter<Predicate, Connectivity>::get_regions() const {
+    return regions;
+}
+
+// Slice z as BGR, blurred like ImageProcessor::process_image
+template <class Predicate, class Connectivity>
+bool BasicVolumeSegmenter<Predicate, Connectivity>::read_slice(int z, cv::Mat &slice) const {
+    cv::Mat bgr;
+    if (!slicePaths.empty()) {
+        bgr = cv::imread(slicePaths[z].string(), cv::IMREAD_COLOR);
+        if (bgr.size() != sliceSize) {
+            std::cerr << "Slice " << slicePaths[z] << " is missing or not " << sliceSize << std::endl;
+            return false;
+        }
+    } else {
+        // Zero-copy view of the mapping, never written to
+        size_t sliceBytes = (size_t)sliceSize.area() * rawChannels;
+        cv::Mat raster(sliceSize, rawChannels == 1 ? CV_8UC1 : CV_8UC3, (void*)(input.data() + (size_t)z * sliceBytes));
+        if (rawChannels == 1) {
+            cv::cvtColor(raster, bgr, cv::COLOR_GRAY2BGR);
+        } else {
+            bgr = raster;
+        }
+    }
+    cv::GaussianBlur(bgr, slice, cv::Size(5, 5), 0, 0);
+    return true;
+}
+
+template <class Predicate, class Connectivity>
+void BasicVolumeSegmenter<Predicate, Connectivity>::process_slab(VolumeSlab &slab) const {
+    int slabSlices = slab.z1 - slab.z0;
+    slab.bgr.resize(slabSlices);
+    slab.packed.resize(slabSlices);
+    slab.labels.resize(slabSlices);
+    slab.regions.clear();
+    slab.regions.add_region(cv::Point(-1, -1), 0);
+    slab.contacts.clear();
+
+    std::vector<cv::Mat> hsv(slabSlices);
+    for (int z = 0; z < slabSlices; ++z) {
+        if (!read_slice(slab.z0 + z, slab.bgr[z])) {
+            slab.bgr[z] = cv::Mat::zeros(sliceSize, CV_8UC3);
+        }
+        cv::cvtColor(slab.bgr[z], hsv[z], cv::COLOR_BGR2HSV);
+
+        // The HSV slice doubles as the features of the default predicate
+        cv::Mat features;
+        if constexpr (std::is_same_v<Predicate, HsvIntervalPredicate>) {
+            features = hsv[z];
+        } else {
+            Predicate::convert(slab.bgr[z], features);
+        }
+        cv::cvtColor(features, slab.packed[z], cv::COLOR_BGR2BGRA);
+        slab.labels[z] = cv::Mat::zeros(sliceSize, CV_32S);
+    }
+
+    std::vector<cv::Point3i> seeds;
+    {
+        GermsPositioningOctree positioning;
+        positioning.position_germs(hsv, maxDivision, seeds);
+    }
+    hsv.clear();
+
+    for (const cv::Point3i &seed : seeds) {
+        if (slab.labels[seed.z].at<int>(seed.y, seed.x) != 0) {
+            continue;
+        }
+        cv::Vec3b color = slab.bgr[seed.z].at<cv::Vec3b>(seed.y, seed.x);
+        int id = slab.regions.add_region(cv::Point(seed.x, seed.y), (color[2] << 16) | (color[1] << 8) | color[0]);
+        grow_region(slab, seed, id);
+    }
+
+    // A long shared surface gives the same pair over and over
+    std::sort(slab.contacts.begin(), slab.contacts.end());
+    slab.contacts.erase(std::unique(slab.contacts.begin(), slab.contacts.end()), slab.contacts.end());
+    slab.bgr.clear();
+    slab.packed.clear();
+}
+
+// Breadth-first growth of one seed, labels are set when a voxel is queued
+template <class Predicate, class Connectivity>
+void BasicVolumeSegmenter<Predicate, Connectivity>::grow_region(VolumeSlab &slab, const cv::Point3i &seed, int id) const {
+    int slabSlices = slab.z1 - slab.z0;
+    cv::Vec4b seedValue = slab.packed[seed.z].at<cv::Vec4b>(seed.y, seed.x);
+    cv::Vec4b lowerb, upperb;
+    Predicate::seed_bounds(seedValue, lowerb, upperb);
+    slab.regions.set_packed_bounds(id, lowerb, upperb);
+    slab.regions.add_pixel(id, cv::Point(seed.x, seed.y), seedValue);
+    slab.labels[seed.z].at<int>(seed.y, seed.x) = id;
+
+    std::vector<cv::Point3i> &queue = slab.queue;
+    queue.clear();
+    queue.push_back(seed);
+    for (size_t head = 0; head < queue.size(); ++head) {
+        cv::Point3i voxel = queue[head];
+        for (int n = 0; n < Connectivity::size; ++n) {
+            int x = voxel.x + Connectivity::dx[n], y = voxel.y + Connectivity::dy[n], z = voxel.z + Connectivity::dz[n];
+            if (x < 0 || y < 0 || z < 0 || x >= sliceSize.width || y >= sliceSize.height || z >= slabSlices) {
+                continue;
+            }
+            int &label = slab.labels[z].at<int>(y, x);
+            if (label == 0) {
+                cv::Vec4b const& value = slab.packed[z].at<cv::Vec4b>(y, x);
+                if (Predicate::accepts(lowerb, upperb, value)) {
+                    label = id;
+                    slab.regions.add_pixel(id, cv::Point(x, y), value);
+                    queue.emplace_back(x, y, z);
+                }
+            } else if (label != id) {
+                uint64_t edge = RegionGraph::pack(id, label);
+                if (slab.contacts.empty() || slab.contacts.back() != edge) {
+                    slab.contacts.push_back(edge);
+                }
+            }
+        }
+    }
+}
+
+template <class Predicate, class Connectivity>
+void BasicVolumeSegmenter<Predicate, Connectivity>::stitch(const cv::Mat &below, const cv::Mat &above) {
+    for (int y = 0; y < sliceSize.height; ++y) {
+        const int* row = above.ptr<int>(y);
+        for (int x = 0; x < sliceSize.width; ++x) {
+            if (row[x] == 0) {
+                continue;
+            }
+            for (int n = 0; n < Connectivity::size; ++n) {
+                int nx = x + Connectivity::dx[n], ny = y + Connectivity::dy[n];
+                if (Connectivity::dz[n] != -1 || nx < 0 || ny < 0 || nx >= sliceSize.width || ny >= sliceSize.height) {
+                    continue;
+                }
+                int label = below.at<int>(ny, nx);
+                if (label != 0) {
+                    uint64_t edge = RegionGraph::pack(row[x], label);
+                    if (contacts.empty() || contacts.back() != edge) {
+                        contacts.push_back(edge);
+                    }
+                }
+            }
+        }
+    }
+}
+
+template <class Predicate, class Connectivity>
+bool BasicVolumeSegmenter<Predicate, Connectivity>::mergeable(int key1, int key2) const {
+    uint64_t sum1[3], sum2[3];
+    for (int c = 0; c < 3; ++c) {
+        sum1[c] = regions.get_sum(key1, c);
+        sum2[c] = regions.get_sum(key2, c);
+    }
+    return Predicate::accepts_mean(regions.get_packed_lower_bound(key1), regions.get_packed_upper_bound(key1),
+                                   sum2, regions.get_pixel_count(key2)) &&
+           Predicate::accepts_mean(regions.get_packed_lower_bound(key2), regions.get_packed_upper_bound(key2),
+                                   sum1, regions.get_pixel_count(key1));
+}
+
+template <class Predicate, class Connectivity>
+double BasicVolumeSegmenter<Predicate, Connectivity>::mean_distance(RegionTable const& table, int key1, int key2) {
+    cv::Scalar mean1 = table.get_mean(key1), mean2 = table.get_mean(key2);
+    double distance = 0;
+    for (int c = 0; c < 3; ++c) {
+        distance += (mean1[c] - mean2[c]) * (mean1[c] - mean2[c]);
+    }
+    return distance;
+}
+
+template <class Predicate, class Connectivity>
+void BasicVolumeSegmenter<Predicate, Connectivity>::merge_regions() {
+    RegionGraph graph;
+    graph.clear(regions.size());
+    graph.add_contacts(contacts);
+    contacts.clear();
+    contacts.shrink_to_fit();
+    graph.build();
+
+    for (uint64_t edge : graph.get_edges()) {
+        int key1 = regions.find(RegionGraph::first(edge));
+        int key2 = regions.find(RegionGraph::second(edge));
+        if (key1 != key2) {
+            graph.push({mean_distance(regions, key1, key2), std::min(key1, key2), std::max(key1, key2), 0, 0});
+        }
+    }
+
+    while (!graph.empty()) {
+        RegionGraph::Candidate candidate = graph.pop();
+        int key1 = regions.find(candidate.region1);
+        int key2 = regions.find(candidate.region2);
+        if (key1 == key2) {
+            continue;
+        }
+        if (key1 != candidate.region1 || key2 != candidate.region2 ||
+            graph.get_stamp(key1) != candidate.stamp1 || graph.get_stamp(key2) != candidate.stamp2) {
+            int low = std::min(key1, key2), high = std::max(key1, key2);
+            graph.push({mean_distance(regions, low, high), low, high, graph.get_stamp(low), graph.get_stamp(high)});
+            continue;
+        }
+        if (!mergeable(key1, key2)) {
+            continue;
+        }
+
+        cv::Vec4b lowerb1 = regions.get_packed_lower_bound(key1), upperb1 = regions.get_packed_upper_bound(key1);
+        cv::Vec4b lowerb2 = regions.get_packed_lower_bound(key2), upperb2 = regions.get_packed_upper_bound(key2);
+        int survivor = regions.merge(key1, key2);
+        if constexpr (!Predicate::interval) {
+            // The table keeps the union of the two intervals, which means nothing here
+            if (survivor == key1) {
+                regions.set_packed_bounds(survivor, lowerb1, upperb1);
+            } else {
+                regions.set_packed_bounds(survivor, lowerb2, upperb2);
+            }
+        }
+        graph.bump(survivor);
+    }
+}
+
+template <class Predicate, class Connectivity>
+bool BasicVolumeSegmenter<Predicate, Connectivity>::run(const std::string &outputPrefix) {
+    if (depth <= 0) {
+        return false;
+    }
+    std::string labelPath = outputPrefix + "_labels.raw";
+    std::ofstream labelsOut(labelPath, std::ios::binary | std::ios::trunc);
+    if (!labelsOut) {
+        std::cerr << "Cannot write " << labelPath << std::endl;
+        return false;
+    }
+
+    ThreadPool &pool = get_thread_pool();
+    slabDepth = get_slab_depth();
+    numSlabs = 0;
+    regions.clear();
+    regions.add_region(cv::Point(-1, -1), 0);
+    contacts.clear();
+
+    // One wave of slabs per worker, grown in parallel, then appended in z order
+    std::vector<VolumeSlab> wave(pool.get_num_workers());
+    cv::Mat lastSlice;
+    for (int waveZ = 0; waveZ < depth; waveZ += slabDepth * (int)wave.size()) {
+        int count = 0;
+        for (VolumeSlab &slab : wave) {
+            slab.z0 = waveZ + count * slabDepth;
+            if (slab.z0 >= depth) {
+                break;
+            }
+            slab.z1 = std::min(depth, slab.z0 + slabDepth);
+            count++;
+        }
+
+        pool.parallel_for(0, count, 1, [&](int first, int last) {
+            for (int i = first; i < last; ++i) {
+                process_slab(wave[i]);
+            }
+        });
+
+        for (int i = 0; i < count; ++i) {
+            VolumeSlab &slab = wave[i];
+            // Local ID k > 0 becomes k + offset, the background stays 0
+            int offset = regions.append(slab.regions, 1) - 1;
+            for (uint64_t edge : slab.contacts) {
+                contacts.push_back(RegionGraph::pack(RegionGraph::first(edge) + offset, RegionGraph::second(edge) + offset));
+            }
+
+            for (cv::Mat &labels : slab.labels) {
+                for (int y = 0; y < labels.rows; ++y) {
+                    int* row = labels.ptr<int>(y);
+                    for (int x = 0; x < labels.cols; ++x) {
+                        row[x] += (row[x] != 0) ? offset : 0;
+                    }
+                    labelsOut.write((const char*)row, (std::streamsize)labels.cols * sizeof(int));
+                }
+            }
+            if (!lastSlice.empty()) {
+                stitch(lastSlice, slab.labels.front());
+            }
+            lastSlice = slab.labels.back();
+
+            slab.labels.clear();
+            slab.regions.clear();
+            slab.contacts.clear();
+            numSlabs++;
+        }
+    }
+    labelsOut.close();
+    if (!labelsOut) {
+        std::cerr << "Cannot write " << labelPath << std::endl;
+        return false;
+    }
+
+    merge_regions();
+    return finalize(labelPath, outputPrefix);
+}
+
+template <class Predicate, class Connectivity>
+bool BasicVolumeSegmenter<Predicate, Connectivity>::finalize(const std::string &labelPath, const std::string &outputPrefix) {
+    std::vector<int> roots(regions.size(), 0);
+    for (int id = 1; id < (int)regions.size(); ++id) {
+        roots[id] = regions.find(id);
+    }
+
+    std::fstream labelsFile(labelPath, std::ios::binary | std::ios::in | std::ios::out);
+    if (!labelsFile) {
+        std::cerr << "Cannot read " << labelPath << std::endl;
+        return false;
+    }
+
+    cv::Mat labels(sliceSize, CV_32S);
+    cv::Mat mask(sliceSize, CV_8UC3);
+    std::streamsize sliceBytes = (std::streamsize)sliceSize.area() * sizeof(int);
+    uint64_t labeled = 0;
+    // Reads slice z, rewrites it with root IDs in place
+    for (int z = 0; z < depth; ++z) {
+        labelsFile.seekg((std::streamoff)z * sliceBytes);
+        labelsFile.read((char*)labels.data, sliceBytes);
+        for (int y = 0; y < labels.rows; ++y) {
+            int* row = labels.ptr<int>(y);
+            for (int x = 0; x < labels.cols; ++x) {
+                row[x] = roots[row[x]];
+                labeled += (row[x] != 0);
+            }
+        }
+        labelsFile.seekp((std::streamoff)z * sliceBytes);
+        labelsFile.write((const char*)labels.data, sliceBytes);
+
+        if (writeMasks) {
+            for (int y = 0; y < labels.rows; ++y) {
+                const int* row = labels.ptr<int>(y);
+                cv::Vec3b* out = mask.ptr<cv::Vec3b>(y);
+                for (int x = 0; x < labels.cols; ++x) {
+                    int color = regions.get_color(row[x]);
+                    out[x] = cv::Vec3b((uchar)(color & 0xFF), (uchar)((color >> 8) & 0xFF), (uchar)((color >> 16) & 0xFF));
+                }
+            }
+            char suffix[32];
+            std::snprintf(suffix, sizeof(suffix), "_seg_%04d.png", z);
+            if (!cv::imwrite(outputPrefix + suffix, mask)) {
+                std::cerr << "Cannot write " << outputPrefix + suffix << std::endl;
+                return false;
+            }
+        }
+    }
+
+    int numRegions = 0;
+    for (int id = 1; id < (int)regions.size(); ++id) {
+        numRegions += (roots[id] == id && regions.get_pixel_count(id) > 0);
+    }
+    std::cout << "Regions: " << numRegions << ", coverage percentage: "
+              << (double)labeled / ((double)sliceSize.area() * depth) * 100 << "%" << std::endl;
+    return (bool)labelsFile;
+}
@@ -3,6 +3,18 @@
 #include "GermsPositioning.hpp"
 #include "GrowAndMerge.hpp"
 #include "ImageUtil.hpp"
+#include "BatchPipeline.hpp"
+#include "VideoSegmenter.hpp"
+#include "BandedSegmenter.hpp"
+#include "PyramidSegmenter.hpp"
+#include "SegmentationServer.hpp"
+#include "VolumeSegmenter.hpp"
+
+#include <opencv2/videoio.hpp>
+
+#include <csignal>
+#include <fstream>
+#include <sstream>
 
 std::chrono::high_resolution_clock::time_point start;
 std::chrono::high_resolution_clock::time_point stop;
@@ -17,36 +29,335 @@ std::chrono::microseconds duration;
         std::cout << "Time taken by " << #func << ": " << (duration.count() / 1000.0) << "ms" << std::endl; \
 
 
+SegmentationServer* daemonServer = nullptr;
+
+void stop_daemon(int) {
+    if (daemonServer) {
+        daemonServer->stop();
+    }
+}
+
+bool parse_flag(const char* argument) {
+    try {
+        return std::stoi(argument) != 0;
+    } catch (const std::invalid_argument& ia) {
+        std::cerr << "Invalid argument: " << ia.what() << '\n';
+    } catch (const std::out_of_range& oor) {
+        std::cerr << "Out of Range error: " << oor.what() << '\n';
+    }
+    return false;
+}
+
 int main(int argc, char** argv) {
     if (argc < 2) {
         printf("Enter relative path to an image.\n");
         return -1;
     }
 
+    // Headless mode: seg --batch <input directory | list file> <output directory> [display mode] [colorization mode]
+    //                          [fill gaps]
+    if (std::string(argv[1]) == "--batch") {
+        if (argc < 4) {
+            printf("Usage: %s --batch <input directory | list file> <output directory> [display mode] [colorization mode] [fill gaps]\n", argv[0]);
+            return -1;
+        }
+
+        BatchPipeline pipeline(argv[2], argv[3]);
+        pipeline.set_only_edge(argc > 4 && parse_flag(argv[4]));
+        pipeline.set_rand_colorization(argc > 5 && parse_flag(argv[5]));
+        pipeline.set_fill_gaps(argc > 6 && parse_flag(argv[6]));
+
+        if (!pipeline.run()) {
+            return -1;
+        }
+        pipeline.print_report(std::cout);
+        return 0;
+    }
+
+    // Daemon mode: seg --daemon <socket path> [threads] [max batch] [fill gaps]
+    if (std::string(argv[1]) == "--daemon") {
+        if (argc < 3) {
+            printf("Usage: %s --daemon <socket path> [threads] [max batch] [fill gaps]\n", argv[0]);
+            return -1;
+        }
+        if (argc > 3) {
+            ThreadPool::set_shared_num_workers(std::atoi(argv[3]));
+        }
+
+        SegmentationServer server(argv[2]);
+        if (argc > 4) {
+            server.set_max_batch((size_t)std::max(1, std::atoi(argv[4])));
+        }
+        server.set_fill_gaps(argc > 5 && parse_flag(argv[5]));
+
+        // Ctrl+C or kill: the queued requests are answered, then the latency report is printed
+        daemonServer = &server;
+        std::signal(SIGINT, stop_daemon);
+        std::signal(SIGTERM, stop_daemon);
+        bool served = server.run();
+        daemonServer = nullptr;
+        server.print_report(std::cout);
+        return served ? 0 : -1;
+    }
+
+    // Out-of-core mode: seg --banded <input.ppm | input.raw> <output prefix> [memory budget in MB]
+    //                                [display mode] [colorization mode] [WxH, for raw input]
+    if (std::string(argv[1]) == "--banded") {
+        if (argc < 4) {
+            printf("Usage: %s --banded <input.ppm | input.raw> <output prefix> [memory budget in MB] [display mode] [colorization mode] [WxH]\n", argv[0]);
+            return -1;
+        }
+
+        BandedSegmenter segmenter;
+        bool opened;
+        if (argc > 7) {
+            int width = 0, height = 0;
+            if (sscanf(argv[7], "%dx%d", &width, &height) != 2) {
+                printf("Invalid size %s, expected WxH\n", argv[7]);
+                return -1;
+            }
+            opened = segmenter.open_raw(argv[2], cv::Size(width, height));
+        } else {
+            opened = segmenter.open_pnm(argv[2]);
+        }
+        if (!opened) {
+            return -1;
+        }
+
+        if (argc > 4) {
+            segmenter.set_memory_budget((size_t)std::max(1, std::atoi(argv[4])) << 20);
+        }
+        segmenter.set_only_edge(argc > 5 && parse_flag(argv[5]));
+        segmenter.set_rand_colorization(argc > 6 && parse_flag(argv[6]));
+
+        MEASURE_TIME(opened = segmenter.run(argv[3]));
+        std::cout << segmenter.get_num_bands() << " bands of " << segmenter.get_band_height() << " rows" << std::endl;
+        return opened ? 0 : -1;
+    }
+
+    // Volume mode: seg --volume <slices directory | list file | input.raw> <output prefix> [connectivity 6 or 26]
+    //                         [memory budget in MB] [write masks] [WxHxD or WxHxDxC, for raw input]
+    if (std::string(argv[1]) == "--volume") {
+        if (argc < 4) {
+            printf("Usage: %s --volume <slices directory | list file | input.raw> <output prefix> [connectivity 6|26] [memory budget in MB] [write masks] [WxHxD[xC]]\n", argv[0]);
+            return -1;
+        }
+
+        int width = 0, height = 0, depth = 0, channels = 1;
+        if (argc > 7 && sscanf(argv[7], "%dx%dx%dx%d", &width, &height, &depth, &channels) < 3) {
+            printf("Invalid size %s, expected WxHxD or WxHxDxC\n", argv[7]);
+            return -1;
+        }
+
+        auto segment = [&](auto &segmenter) {
+            bool opened = (argc > 7) ? segmenter.open_raw(argv[2], cv::Size(width, height), depth, channels)
+                                     : segmenter.open_slices(argv[2]);
+            if (!opened) {
+                return -1;
+            }
+            if (argc > 5) {
+                segmenter.set_memory_budget((size_t)std::max(1, std::atoi(argv[5])) << 20);
+            }
+            segmenter.set_write_masks(argc > 6 && parse_flag(argv[6]));
+
+            MEASURE_TIME(opened = segmenter.run(argv[3]));
+            std::cout << segmenter.get_num_slabs() << " slabs of " << segmenter.get_slab_depth() << " slices" << std::endl;
+            return opened ? 0 : -1;
+        };
+
+        if (argc > 4 && std::atoi(argv[4]) == 26) {
+            BasicVolumeSegmenter<HsvIntervalPredicate, TwentySixConnected> segmenter;
+            return segment(segmenter);
+        }
+        VolumeSegmenter segmenter;
+        return segment(segmenter);
+    }
+
+    // Video mode: seg --video <video file | camera index> [display mode] [colorization mode] [output video]
+    if (std::string(argv[1]) == "--video") {
+        if (argc < 3) {
+            printf("Usage: %s --video <video file | camera index> [display mode] [colorization mode] [output video]\n", argv[0]);
+            return -1;
+        }
+
+        cv::VideoCapture capture;
+        std::string source = argv[2];
+        bool isCamera = !source.empty() && std::all_of(source.begin(), source.end(), ::isdigit);
+        if (isCamera ? !capture.open(std::stoi(source)) : !capture.open(source)) {
+            printf("Cannot open %s\n", argv[2]);
+            return -1;
+        }
+
+        VideoSegmenter segmenter;
+        segmenter.set_only_edge(argc > 3 && parse_flag(argv[3]));
+        segmenter.set_rand_colorization(argc > 4 && parse_flag(argv[4]));
+
+        // With an output file the mode is headless, otherwise the frames are shown until Esc
+        cv::VideoWriter writer;
+        bool headless = argc > 5;
+
+        cv::Mat frame, mask;
+        double totalMs = 0.0;
+        while (capture.read(frame)) {
+            auto begin = std::chrono::high_resolution_clock::now();
+            segmenter.process_frame(frame, mask);
+            totalMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+
+            if (headless) {
+                if (!writer.isOpened()) {
+                    double fps = capture.get(cv::CAP_PROP_FPS);
+                    if (!writer.open(argv[5], cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), fps > 0 ? fps : 30.0, mask.size())) {
+                        printf("Cannot write %s\n", argv[5]);
+                        return -1;
+                    }
+                }
+                writer.write(mask);
+            } else {
+                cv::imshow("Segmentation", mask);
+                if (cv::waitKey(1) == 27) {
+                    break;
+                }
+            }
+        }
+
+        size_t frames = segmenter.get_frame_count();
+        std::cout << frames << " frames, " << (frames ? totalMs / frames : 0.0) << "ms per frame ("
+                  << (totalMs > 0 ? frames * 1000.0 / totalMs : 0.0) << " fps)" << std::endl;
+        return 0;
+    }
+
+    // Pyramid mode: seg --pyramid <image> [levels] [display mode] [colorization mode]
+    if (std::string(argv[1]) == "--pyramid") {
+        if (argc < 3) {
+            printf("Usage: %s --pyramid <image> [levels] [display mode] [colorization mode]\n", argv[0]);
+            return -1;
+        }
+
+        ImageProcessor imageProcessor;
+        imageProcessor.process_image(argv[2]);
+        cv::Mat image = imageProcessor.get_image_rgb();
+
+        bool showEdge = argc > 4 && parse_flag(argv[4]);
+        bool randColorization = argc > 5 && parse_flag(argv[5]);
+
+        PyramidSegmenter pyramid;
+        pyramid.set_levels(argc > 3 ? std::atoi(argv[3]) : 1);
+        pyramid.set_only_edge(showEdge);
+        pyramid.set_rand_colorization(randColorization);
+
+        // Full resolution reference, for the speedup and the accuracy
+        GermsPositioningV2 positioningV2;
+        GrowAndMerge reference;
+        std::vector<cv::Point> seeds;
+        cv::Mat referenceMask;
+        MEASURE_TIME(positioningV2.position_germs(image, 5, seeds); reference.rg_seg(image, referenceMask, seeds, randColorization, showEdge));
+        double referenceMs = duration.count() / 1000.0;
+
+        cv::Mat mask;
+        MEASURE_TIME(pyramid.process(image, mask));
+        double pyramidMs = duration.count() / 1000.0;
+
+        std::cout << "Speedup: " << (pyramidMs > 0 ? referenceMs / pyramidMs : 0.0) << "x, agreement with the full resolution labels: "
+                  << PyramidSegmenter::agreement(pyramid.get_labels(), reference.get_labels()) * 100.0 << "%, refined pixels: "
+                  << pyramid.get_refined_ratio() * 100.0 << "%" << std::endl;
+
+        cv::imshow("Segmentation", mask);
+        cv::imshow("Full resolution segmentation", referenceMask);
+
+        cv::waitKey(0);
+        return 0;
+    }
+
+    // ROI mode: seg --roi <image> <mask image | x,y,w,h[;x,y,w,h...]> [display mode] [colorization mode]
+    if (std::string(argv[1]) == "--roi") {
+        if (argc < 4) {
+            printf("Usage: %s --roi <image> <mask image | x,y,w,h[;x,y,w,h...]> [display mode] [colorization mode]\n", argv[0]);
+            return -1;
+        }
+
+        ImageProcessor imageProcessor;
+        imageProcessor.process_image(argv[2]);
+        cv::Mat image = imageProcessor.get_image_rgb();
+
+        bool showEdge = argc > 4 && parse_flag(argv[4]);
+        bool randColorization = argc > 5 && parse_flag(argv[5]);
+
+        // Rectangles when the argument holds commas, a mask image (non-zero pixels) otherwise
+        std::vector<cv::Rect> rects;
+        cv::Mat roiMask;
+        std::string roi = argv[3];
+        if (roi.find(',') != std::string::npos) {
+            std::stringstream list(roi);
+            std::string item;
+            while (std::getline(list, item, ';')) {
+                cv::Rect rect;
+                if (sscanf(item.c_str(), "%d,%d,%d,%d", &rect.x, &rect.y, &rect.width, &rect.height) != 4) {
+                    printf("Invalid rectangle %s, expected x,y,w,h\n", item.c_str());
+                    return -1;
+                }
+                rects.push_back(rect);
+            }
+        } else {
+            roiMask = cv::imread(roi, cv::IMREAD_GRAYSCALE);
+            if (roiMask.size() != image.size()) {
+                printf("The mask %s is missing or not of the image size\n", argv[3]);
+                return -1;
+            }
+        }
+
+        GermsPositioningV2 positioningV2;
+        GrowAndMerge growAndMerge;
+        std::vector<cv::Point> seeds;
+        cv::Mat mask;
+        if (rects.empty()) {
+            MEASURE_TIME(positioningV2.position_germs(image, 5, seeds, roiMask); growAndMerge.rg_seg_roi(image, mask, roiMask, seeds, randColorization, showEdge));
+        } else {
+            MEASURE_TIME(positioningV2.position_germs(image, 5, seeds, rects); growAndMerge.rg_seg_roi(image, mask, rects, seeds, randColorization, showEdge));
+        }
+        double roiMs = duration.count() / 1000.0;
+
+        // Full frame reference, for the speedup
+        GermsPositioningV2 fullPositioning;
+        GrowAndMerge full;
+        std::vector<cv::Point> fullSeeds;
+        cv::Mat fullMask;
+        MEASURE_TIME(fullPositioning.position_germs(image, 5, fullSeeds); full.rg_seg(image, fullMask, fullSeeds, randColorization, showEdge));
+        double fullMs = duration.count() / 1000.0;
+
+        cv::Rect area = growAndMerge.get_label_area();
+        std::cout << "ROI bounding box: " << area << " (" << (double)area.area() / image.total() * 100.0
+                  << "% of the image), speedup: " << (roiMs > 0 ? fullMs / roiMs : 0.0) << "x" << std::endl;
+
+        cv::imshow("Segmentation", mask);
+        cv::waitKey(0);
+        return 0;
+    }
+
     bool showEdge = false;
     bool randColorization = false;
+    bool fillGaps = false;
 
     if(argc > 2) {
-        try {
-            if (std::stoi(argv[2]) != 0) {
-                showEdge = true;
-            }
-        } catch (const std::invalid_argument& ia) {
-            std::cerr << "Invalid argument: " << ia.what() << '\n';
-        } catch (const std::out_of_range& oor) {
-            std::cerr << "Out of Range error: " << oor.what() << '\n';
-        }
+        showEdge = parse_flag(argv[2]);
     }
 
     if(argc > 3) {
-        try {
-            if (std::stoi(argv[3]) != 0) {
-                randColorization = true;
-            }
-        } catch (const std::invalid_argument& ia) {
-            std::cerr << "Invalid argument: " << ia.what() << '\n';
-        } catch (const std::out_of_range& oor) {
-            std::cerr << "Out of Range error: " << oor.what() << '\n';
+        randColorization = parse_flag(argv[3]);
+    }
+
+    if(argc > 4) {
+        fillGaps = parse_flag(argv[4]);
+    }
+
+    // Greedy merges by default, the region adjacency graph on request
+    MergeStrategy mergeStrategy = MergeStrategy::Greedy;
+    if (argc > 5) {
+        std::string merge = argv[5];
+        if (merge == "graph") {
+            mergeStrategy = MergeStrategy::Graph;
+        } else if (merge != "greedy") {
+            printf("Invalid merge strategy %s, expected greedy or graph\n", argv[5]);
+            return -1;
         }
     }
 
@@ -63,15 +374,28 @@ int main(int argc, char** argv) {
 
     std::vector<cv::Point> seeds;
 
-    MEASURE_TIME(positioningV2.position_germs(image, 5, seeds)); // the second parameter can be change
+    // The HSV plane and its summed-area tables are computed once, here, and shared by the seeding and the growing
+    MEASURE_TIME(positioningV2.position_germs(image, 5, seeds, imageProcessor.get_integral_image())); // the second parameter can be change
 
     // Grow and merge parts
 
     GrowAndMerge growAndMerge;
+    growAndMerge.set_fill_gaps(fillGaps);
+    growAndMerge.set_merge_strategy(mergeStrategy);
+    growAndMerge.set_features(imageProcessor.get_image_hsv());
 
     cv::Mat mask = cv::Mat::zeros(image.size(), CV_8UC3);
     MEASURE_TIME(growAndMerge.rg_seg(image, mask, seeds, randColorization, showEdge));
 
+    // Only recorded in a build with RG_INSTRUMENTATION
+    if (Instrumentation::enabled()) {
+        std::ofstream counters("seg_counters.json");
+        std::ofstream trace("seg_trace.json");
+        Instrumentation::global().write_json(counters);
+        Instrumentation::global().write_chrome_trace(trace);
+        std::cout << "Counters written to seg_counters.json, timeline to seg_trace.json" << std::endl;
+    }
+
     // Display solutions
 
     GermsDisplay germsDisplay;
@@ -79,7 +403,7 @@ int main(int argc, char** argv) {
     cv::Mat germsAndRegion;
 
     germsDisplay.display_germs(image, germsAndRegion, seeds);
-    germsDisplay.display_segmented_regions(image, germsAndRegion, positioningV2.get_germs_regions(), cv::Scalar(0, 150, 0));
+    germsDisplay.display_segmented_regions(image, germsAndRegion, positioningV2.get_quadtree(), cv::Scalar(0, 150, 0));
 
     cv::imshow("Segmentation", mask);
     cv::imshow("Germs and regions", germsAndRegion);
@@ -0,0 +1,444 @@
+#include "SegBench.hpp"
+
+#include <cstring>
+
+/**
+ * seg_tests - the checks of ctest, one test per argument (all of them without one).
+ *
+ *   seg_tests [verify] [tiles] [allocations] [context] [quadtree] [variance] [octree] [rects]
+ *             [--baseline FILE]
+ *
+ * verify: seg_bench --verify all on every input at 640x480, 4 workers. Every variant must give the
+ * partition of the reference rg_seg; with --baseline (the RG_SPEEDUP_BASELINE CMake cache entry)
+ * its speedup must also stay above 0.8 times the recorded one, otherwise it is not checked.
+ *
+ * tiles: tile-parallel growing, which legitimately differs from the reference, must give the same
+ * partition on 4 workers as on one, for both engines, both merge strategies and two tile sizes.
+ *
+ * allocations: once warmed up, rg_seg, fill_mask and edge_mask of a reused GrowAndMerge make no heap
+ * allocation on one worker or 4 (seg_bench is built with RG_HEAP_ACCOUNTING).
+ *
+ * context: one GrowAndMerge segmenting every input in turn, at two sizes, from the label plane the
+ * last image left, gives the labels of a new instance per image.
+ *
+ * quadtree: LinearQuadtree::read() gives back the tree write() dumped, and rejects, leaving the
+ * tree empty, a truncated dump and headers whose leaf count the area or the stream cannot hold.
+ *
+ * variance: on every input, IntegralImage::region_variance gives exactly (==) the value of
+ * ImageUtil::calculate_region_variance, on the quads of a division and on random rectangles.
+ *
+ * octree: GermsPositioningOctree::region_variance gives exactly the population variance summed voxel
+ * by voxel, on random cuboids of a random slab.
+ *
+ * rects: seeding over one rectangle gives the seeds of the mask of that rectangle, and over two the
+ * quadtree keeps the leaves of both, every one of them meeting a rectangle, with every seed in one.
+ */
+
+// Labels of one tile-parallel run of the input
+cv::Mat tiled_labels(const cv::Mat &image, const std::vector<cv::Point> &seeds, ThreadPool &pool, cv::Size tileSize,
+                     GrowAndMerge::Engine engine, MergeStrategy merge) {
+    GrowAndMerge growAndMerge;
+    growAndMerge.set_thread_pool(pool);
+    growAndMerge.set_tile_size(tileSize);
+    growAndMerge.set_growth_engine(engine);
+    growAndMerge.set_merge_strategy(merge);
+    growAndMerge.set_quiet(true);
+    cv::Mat mask = cv::Mat::zeros(image.size(), CV_8UC3);
+    std::vector<cv::Point> runSeeds = seeds;
+    growAndMerge.rg_seg(image, mask, runSeeds, true, false);
+    return growAndMerge.get_labels().clone();
+}
+
+// Labels of one rg_seg of the input, on the given instance
+cv::Mat seg_labels(GrowAndMerge &growAndMerge, const cv::Mat &image, const std::vector<cv::Point> &seeds) {
+    cv::Mat mask = cv::Mat::zeros(image.size(), CV_8UC3);
+    std::vector<cv::Point> runSeeds = seeds;
+    growAndMerge.rg_seg(image, mask, runSeeds, true, false);
+    return growAndMerge.get_labels().clone();
+}
+
+bool test_verify(const std::string &baselinePath) {
+    BenchConfig config;
+    config.sizes = {cv::Size(640, 480)};
+    config.threads = {4};
+    config.repetitions = 3;
+    config.verify = {"all"};
+    config.baselinePath = baselinePath;
+
+    std::vector<VerifyResult> results;
+    run_verification(config, results);
+
+    bool passed = true;
+    for (const VerifyResult &result : results) {
+        if (!result.passed) {
+            std::cerr << "verify: " << result.variant << " on " << result.input << ": "
+                      << (result.identical ? "same partition" : "ARI " + std::to_string(result.ari)) << ", speedup "
+                      << result.speedup << " (baseline "
+                      << (result.inBaseline ? std::to_string(result.baselineSpeedup) : std::string("missing")) << ")" << std::endl;
+            passed = false;
+        }
+    }
+    if (baselinePath.empty()) {
+        std::cerr << "verify: WARNING: no baseline, the speedups were NOT checked (set RG_SPEEDUP_BASELINE)" << std::endl;
+    }
+    return passed && !results.empty();
+}
+
+bool test_tiles() {
+    BenchConfig config;
+    ThreadPool serialPool(1);
+    ThreadPool parallelPool(4);
+
+    bool passed = true;
+    for (const std::string &name : config.inputs) {
+        cv::Mat source = make_input(name, cv::Size(640, 480), config.ressources);
+        if (source.empty()) {
+            std::cerr << "tiles: cannot load " << name << " from " << config.ressources << std::endl;
+            passed = false;
+            continue;
+        }
+        ImageProcessor imageProcessor;
+        imageProcessor.process_image(source);
+        cv::Mat image = imageProcessor.get_image_rgb();
+
+        std::vector<cv::Point> seeds;
+        GermsPositioningV2 positioningV2;
+        positioningV2.set_thread_pool(serialPool);
+        positioningV2.position_germs(image, config.maxDivision, seeds);
+
+        for (cv::Size tileSize : {cv::Size(128, 128), cv::Size(256, 256)}) {
+            for (GrowAndMerge::Engine engine : {GrowAndMerge::Engine::Queue, GrowAndMerge::Engine::Span}) {
+                for (MergeStrategy merge : {MergeStrategy::Greedy, MergeStrategy::Graph}) {
+                    cv::Mat serial = tiled_labels(image, seeds, serialPool, tileSize, engine, merge);
+                    cv::Mat parallel = tiled_labels(image, seeds, parallelPool, tileSize, engine, merge);
+                    if (!same_partition(contingency(serial, parallel))) {
+                        std::cerr << "tiles: " << name << ", " << tileSize.width << "x" << tileSize.height << " tiles, "
+                                  << (engine == GrowAndMerge::Engine::Span ? "span" : "queue") << ", "
+                                  << (merge == MergeStrategy::Greedy ? "greedy" : "graph")
+                                  << ": 4 workers differ from one" << std::endl;
+                        passed = false;
+                    }
+                }
+            }
+        }
+    }
+    return passed;
+}
+
+bool test_allocations() {
+    BenchConfig config;
+    config.sizes = {cv::Size(640, 480)};
+    config.stages = {"rg_seg", "fill_mask", "edge_mask"};
+    config.threads = {1, 4};
+    config.repetitions = 3;
+
+    std::vector<BenchResult> results;
+    std::vector<CounterReport> counters;
+    run_benchmarks(config, results, counters);
+
+    bool passed = true;
+    for (const BenchResult &result : results) {
+        if (result.allocations > 0) {
+            std::cerr << "allocations: " << result.stage << " on " << result.input << ", " << result.threads
+                      << " thread(s): " << result.allocations << " allocations per call" << std::endl;
+            passed = false;
+        }
+    }
+    return passed && !results.empty();
+}
+
+bool test_context() {
+    BenchConfig config;
+    ThreadPool pool(4);
+    GrowAndMerge reused;
+    reused.set_thread_pool(pool);
+    reused.set_quiet(true);
+
+    bool passed = true;
+    // Larger then smaller: the second size reads a plane the first one left labeled
+    for (cv::Size size : {cv::Size(640, 480), cv::Size(320, 240)}) {
+        for (const std::string &name : config.inputs) {
+            cv::Mat source = make_input(name, size, config.ressources);
+            if (source.empty()) {
+                std::cerr << "context: cannot load " << name << " from " << config.ressources << std::endl;
+                passed = false;
+                continue;
+            }
+            ImageProcessor imageProcessor;
+            imageProcessor.process_image(source);
+            cv::Mat image = imageProcessor.get_image_rgb();
+
+            std::vector<cv::Point> seeds;
+            GermsPositioningV2 positioningV2;
+            positioningV2.set_thread_pool(pool);
+            positioningV2.position_germs(image, config.maxDivision, seeds);
+
+            GrowAndMerge fresh;
+            fresh.set_thread_pool(pool);
+            fresh.set_quiet(true);
+            cv::Mat expected = seg_labels(fresh, image, seeds);
+            cv::Mat labels = seg_labels(reused, image, seeds);
+            if (cv::countNonZero(expected != labels) != 0) {
+                std::cerr << "context: " << name << " " << size.width << "x" << size.height
+                          << ": the reused instance gives other labels than a new one" << std::endl;
+                passed = false;
+            }
+        }
+    }
+    return passed;
+}
+
+bool test_quadtree() {
+    cv::Mat image = make_input("image_couche", cv::Size(640, 480), RG_RESSOURCES_DIR);
+    if (image.empty()) {
+        std::cerr << "quadtree: cannot load image_couche from " << RG_RESSOURCES_DIR << std::endl;
+        return false;
+    }
+    std::vector<cv::Point> seeds;
+    GermsPositioningV2 positioningV2;
+    positioningV2.position_germs(image, 5, seeds);
+    const LinearQuadtree &tree = positioningV2.get_quadtree();
+    std::stringstream dump;
+    tree.write(dump);
+    std::string bytes = dump.str();
+
+    bool passed = true;
+    auto check = [&](bool condition, const std::string &what) {
+        if (!condition) {
+            std::cerr << "quadtree: " << what << std::endl;
+            passed = false;
+        }
+    };
+
+    LinearQuadtree loaded;
+    std::stringstream whole(bytes);
+    check(loaded.read(whole) && loaded.size() == tree.size() && loaded.get_root() == tree.get_root(), "the dump is not read back");
+    for (size_t leaf = 0; passed && leaf < tree.size(); ++leaf) {
+        check(loaded.get_code((int)leaf) == tree.get_code((int)leaf) && loaded.get_level((int)leaf) == tree.get_level((int)leaf) &&
+              loaded.get_top_left((int)leaf) == tree.get_top_left((int)leaf) &&
+              loaded.get_bottom_right((int)leaf) == tree.get_bottom_right((int)leaf), "leaf " + std::to_string(leaf) + " differs");
+    }
+
+    std::stringstream truncated(bytes.substr(0, bytes.size() - 1));
+    check(!loaded.read(truncated) && loaded.empty() && loaded.get_root().empty(), "a truncated dump is read");
+
+    // Header only, the leaf count patched: more leaves than pixels, then more than the bytes left
+    const size_t countOffset = 4 * sizeof(int32_t);
+    for (uint64_t count : {(uint64_t)1 << 60, (uint64_t)tree.size() + 1}) {
+        std::string patched = bytes;
+        std::memcpy(&patched[countOffset], &count, sizeof(count));
+        std::stringstream corrupt(patched);
+        check(!loaded.read(corrupt) && loaded.empty(), "a leaf count of " + std::to_string(count) + " is read");
+    }
+    return passed;
+}
+
+bool test_variance() {
+    BenchConfig config;
+    std::mt19937 generator(7);
+    bool passed = true;
+    for (const std::string &name : config.inputs) {
+        cv::Mat source = make_input(name, cv::Size(640, 480), config.ressources);
+        if (source.empty()) {
+            std::cerr << "variance: cannot load " << name << " from " << config.ressources << std::endl;
+            passed = false;
+            continue;
+        }
+        ImageProcessor imageProcessor;
+        imageProcessor.process_image(source);
+        cv::Mat image = imageProcessor.get_image_rgb();
+        const IntegralImage &integral = imageProcessor.get_integral_image();
+
+        std::vector<cv::Point> seeds;
+        GermsPositioningV2 positioningV2;
+        positioningV2.position_germs(image, config.maxDivision, seeds, integral);
+        std::vector<cv::Rect> rects;
+        const LinearQuadtree &tree = positioningV2.get_quadtree();
+        for (int leaf = 0; leaf < (int)tree.size(); ++leaf) {
+            rects.emplace_back(tree.get_top_left(leaf), tree.get_bottom_right(leaf));
+        }
+        std::uniform_int_distribution<int> x(0, image.cols), y(0, image.rows);
+        for (int i = 0; i < 50; ++i) {
+            rects.emplace_back(cv::Point(x(generator), y(generator)), cv::Point(x(generator), y(generator)));
+        }
+
+        ImageUtil imageUtil;
+        for (const cv::Rect &rect : rects) {
+            if (rect.empty()) {
+                continue;
+            }
+            double expected = imageUtil.calculate_region_variance(image, rect.tl(), rect.br());
+            double variance = integral.region_variance(rect.tl(), rect.br());
+            if (variance != expected) {
+                std::cerr << "variance: " << name << " " << rect << ": " << variance << " instead of " << expected << std::endl;
+                passed = false;
+                break;
+            }
+        }
+    }
+    return passed;
+}
+
+bool test_octree() {
+    std::mt19937 generator(11);
+    std::uniform_int_distribution<int> value(0, 255);
+    std::vector<cv::Mat> slices(9);
+    for (cv::Mat &slice : slices) {
+        slice.create(64, 96, CV_8UC3);
+        for (int y = 0; y < slice.rows; ++y) {
+            for (int x = 0; x < slice.cols; ++x) {
+                slice.at<cv::Vec3b>(y, x) = cv::Vec3b((uchar)value(generator), (uchar)value(generator), (uchar)value(generator));
+            }
+        }
+    }
+    GermsPositioningOctree octree;
+    octree.set_slices(slices);
+
+    std::uniform_int_distribution<int> x(0, 96), y(0, 64), z(0, 9);
+    for (int i = 0; i < 200; ++i) {
+        int x0 = x(generator), x1 = x(generator), y0 = y(generator), y1 = y(generator), z0 = z(generator), z1 = z(generator);
+        cv::Point3i topLeft(std::min(x0, x1), std::min(y0, y1), std::min(z0, z1));
+        cv::Point3i bottomRight(std::max(x0, x1), std::max(y0, y1), std::max(z0, z1));
+        double count = (double)(bottomRight.x - topLeft.x) * (bottomRight.y - topLeft.y) * (bottomRight.z - topLeft.z);
+        if (count <= 0) {
+            continue;
+        }
+        // Integer sums, exact in a double like the ones of the tables
+        uint64_t values[3] = {0, 0, 0}, squares[3] = {0, 0, 0};
+        for (int vz = topLeft.z; vz < bottomRight.z; ++vz) {
+            for (int vy = topLeft.y; vy < bottomRight.y; ++vy) {
+                for (int vx = topLeft.x; vx < bottomRight.x; ++vx) {
+                    const cv::Vec3b &voxel = slices[vz].at<cv::Vec3b>(vy, vx);
+                    for (int c = 0; c < 3; ++c) {
+                        values[c] += voxel[c];
+                        squares[c] += (uint64_t)voxel[c] * voxel[c];
+                    }
+                }
+            }
+        }
+        double expected = 0.0;
+        for (int c = 0; c < 3; ++c) {
+            expected += std::max(0.0, count * (double)squares[c] - (double)values[c] * (double)values[c]) / (count * count);
+        }
+        expected /= 3.0;
+        double variance = octree.region_variance(topLeft, bottomRight);
+        if (variance != expected) {
+            std::cerr << "octree: " << topLeft << " - " << bottomRight << ": " << variance << " instead of " << expected << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool test_rects() {
+    BenchConfig config;
+    const cv::Rect first(32, 24, 200, 150), second(400, 300, 200, 150);
+    bool passed = true;
+    for (const std::string &name : config.inputs) {
+        cv::Mat source = make_input(name, cv::Size(640, 480), config.ressources);
+        if (source.empty()) {
+            std::cerr << "rects: cannot load " << name << " from " << config.ressources << std::endl;
+            passed = false;
+            continue;
+        }
+        ImageProcessor imageProcessor;
+        imageProcessor.process_image(source);
+        cv::Mat image = imageProcessor.get_image_rgb();
+
+        GermsPositioningV2 positioningV2;
+        cv::Mat roiMask = cv::Mat::zeros(image.size(), CV_8U);
+        roiMask(first).setTo(255);
+        std::vector<cv::Point> maskSeeds, rectSeeds;
+        positioningV2.position_germs(image, config.maxDivision, maskSeeds, roiMask);
+        positioningV2.position_germs(image, config.maxDivision, rectSeeds, std::vector<cv::Rect>{first});
+        if (rectSeeds != maskSeeds) {
+            std::cerr << "rects: " << name << ": one rectangle gives other seeds than its mask" << std::endl;
+            passed = false;
+        }
+
+        std::vector<cv::Point> seeds;
+        positioningV2.position_germs(image, config.maxDivision, seeds, std::vector<cv::Rect>{first, second});
+        const LinearQuadtree &tree = positioningV2.get_quadtree();
+        cv::Rect box = first | second;
+        cv::Rect areas[2] = {first - box.tl(), second - box.tl()};
+        int met[2] = {0, 0};
+        for (int leaf = 0; leaf < (int)tree.size(); ++leaf) {
+            cv::Rect quad(tree.get_top_left(leaf), tree.get_bottom_right(leaf));
+            bool meets = false;
+            for (int r = 0; r < 2; ++r) {
+                if ((quad & areas[r]).area() > 0) {
+                    met[r]++;
+                    meets = true;
+                }
+            }
+            if (!meets) {
+                std::cerr << "rects: " << name << ": leaf " << quad << " meets no rectangle" << std::endl;
+                passed = false;
+                break;
+            }
+        }
+        if (tree.get_root().size() != box.size() || met[0] == 0 || met[1] == 0) {
+            std::cerr << "rects: " << name << ": the quadtree does not hold the leaves of both rectangles" << std::endl;
+            passed = false;
+        }
+        for (const cv::Point &seed : seeds) {
+            if (!first.contains(seed) && !second.contains(seed)) {
+                std::cerr << "rects: " << name << ": seed " << seed << " out of the rectangles" << std::endl;
+                passed = false;
+                break;
+            }
+        }
+    }
+    return passed;
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> tests;
+    std::string baselinePath;
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        if (argument == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (argument == "verify" || argument == "tiles" || argument == "allocations" || argument == "context" ||
+                   argument == "quadtree" || argument == "variance" || argument == "octree" ||
+                   argument == "rects") {
+            tests.push_back(argument);
+        } else {
+            std::cerr << "seg_tests: unknown argument " << argument << std::endl;
+            return -1;
+        }
+    }
+    if (tests.empty()) {
+        tests = {"verify", "tiles", "allocations", "context", "quadtree", "variance", "octree", "rects"};
+    }
+
+    bool passed = true;
+    for (const std::string &test : tests) {
+        bool testPassed;
+        try {
+            if (test == "verify") {
+                testPassed = test_verify(baselinePath);
+            } else if (test == "tiles") {
+                testPassed = test_tiles();
+            } else if (test == "allocations") {
+                testPassed = test_allocations();
+            } else if (test == "context") {
+                testPassed = test_context();
+            } else if (test == "quadtree") {
+                testPassed = test_quadtree();
+            } else if (test == "variance") {
+                testPassed = test_variance();
+            } else if (test == "octree") {
+                testPassed = test_octree();
+            } else {
+                testPassed = test_rects();
+            }
+        } catch (const std::exception &e) {
+            std::cerr << test << ": " << e.what() << std::endl;
+            testPassed = false;
+        }
+        std::cout << test << ": " << (testPassed ? "passed" : "FAILED") << std::endl;
+        passed = passed && testPassed;
+    }
+    return passed ? 0 : -1;
+}